@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Array allocated in an Arena, a view, it doesn't own the elements
+template <class T> class ArenaSpan {
+    T *items = nullptr;
+    uint32_t count = 0;
+
+  public:
+    ArenaSpan() = default;
+    ArenaSpan(T *items, uint32_t count) : items(items), count(count) {}
+
+    T *begin() const { return items; }
+    T *end() const { return items + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T &operator[](size_t i) const { return items[i]; }
+    T &back() const { return items[count - 1]; }
+};
+
+/**
+ * Bump allocator, for eg. for AST nodes of a definition
+ *
+ * Allocation is just moving a pointer forward in the current block, and
+ * everything is freed at once by reset() (or destruction), instead of object
+ * by object. reset() keeps the blocks, so parsing the next definition reuses
+ * the same memory, without calling the allocator at all
+ *
+ * @note: Destructors are never run, so only trivially destructible types can
+ * be allocated
+ */
+class Arena {
+    struct Block {
+        std::unique_ptr<std::byte[]> data;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    size_t current = 0; // index of block being allocated from
+    uintptr_t ptr = 0, end = 0;
+
+    void *allocate_slow(size_t size, size_t align);
+
+  public:
+    static constexpr size_t FIRST_BLOCK_SIZE = 16 * 1024;
+    static constexpr size_t MAX_BLOCK_SIZE = 1024 * 1024;
+
+    Arena() = default;
+    Arena(Arena &&) = default;
+    Arena &operator=(Arena &&) = default;
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(size_t size, size_t align) {
+        auto aligned = (ptr + align - 1) & ~(align - 1);
+        if (aligned + size > end) // also when there's no block yet (end == 0)
+            return allocate_slow(size, align);
+
+        ptr = aligned + size;
+        return reinterpret_cast<void *>(aligned);
+    }
+
+    template <class T, class... Args> T *make(Args &&...args) {
+        static_assert(std::is_trivially_destructible_v<T>,
+                      "Arena never runs destructors");
+        return new (allocate(sizeof(T), alignof(T)))
+            T(std::forward<Args>(args)...);
+    }
+
+    // Copy of the items (eg. a temporary vector), into the arena
+    template <class T, class Range> ArenaSpan<T> copy(const Range &items) {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        auto n = static_cast<uint32_t>(std::size(items));
+        if (n == 0)
+            return {};
+
+        auto *p = static_cast<T *>(allocate(sizeof(T) * n, alignof(T)));
+        std::uninitialized_copy(std::begin(items), std::end(items), p);
+        return {p, n};
+    }
+
+    // Free everything allocated till now, keeping the memory for reuse
+    void reset();
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "ast.hpp"
 #include "lexer.hpp"
 #include "tokens.hpp"
 #include <iostream>
@@ -9,9 +10,7 @@
 
 #include <rang.hpp>
 
-extern Token CurrentToken;
-
-template <unsigned int LINE> void debug_assert(bool b) {
+template <unsigned int LINE> void debug_assert(Lexer &lexer, bool b) {
 #ifdef DEBUG
     if (!b) {
         auto visiter_tok_to_str =
@@ -27,19 +26,24 @@ template <unsigned int LINE> void debug_assert(bool b) {
             overload{[](const TOK_EOF &t) -> utf8::string { return ""; },
                      [](const TOK_FN &t) -> utf8::string { return ""; },
                      [](const TOK_EXTERN &t) -> utf8::string { return ""; },
-                     [](const TOK_IDENTIFIER &t) { return t.identifier_str; },
-                     [](const TOK_KEYWORDS &t) { return t.str; },
+                     [&](const TOK_IDENTIFIER &t) {
+                         return utf8::string(lexer.text(t));
+                     },
+                     [&](const TOK_KEYWORDS &t) {
+                         return utf8::string(lexer.text(t));
+                     },
                      [](const TOK_NUMBER &t) { return std::to_string(t.val); },
                      [](const TOK_OTHER &t) { return utf8::to_string(t.c); }};
 
-        CurrentToken = get_next_token();
-        std::cerr << rang::fg::red
-                  << "Assertion failed at Line:" + std::to_string(LINE) + " !"
-                  << rang::style::reset << std::endl;
+        lexer.advance();
+        diagnostics() << rang::fg::red
+                      << "Assertion failed at Line:" + std::to_string(LINE) +
+                             " !"
+                      << rang::style::reset << std::endl;
         throw std::logic_error(
             std::string("CurrentToken = ") +
-            std::visit(visiter_tok_to_str, CurrentToken) + " { " +
-            std::visit(visiter_datastr, CurrentToken) + " }");
+            std::visit(visiter_tok_to_str, lexer.current()) + " { " +
+            std::visit(visiter_datastr, lexer.current()) + " }");
     }
 #endif
 }
@@ -1,134 +1,343 @@
 #pragma once
 
+#include "arena.hpp"
+#include "flat_ast.hpp"
+#include "lexer.hpp"
+#include "symbols.hpp"
 #include "tokens.hpp"
 #include "utf8.hpp"
 #include "util.hpp"
-#include <map>
+#include <array>
+#include <cstdint>
+#include <iosfwd>
 #include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
+#include <llvm/ADT/ArrayRef.h>
 #include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
 #include <llvm/IR/Value.h>
+#include <llvm/Support/ErrorHandling.h>
 
 using std::vector;
 
+/**
+ * All nodes are allocated in an Arena (see the parse* functions), and are
+ * freed along with it, so they only hold raw pointers to their children, and
+ * ArenaSpan instead of vectors. Nothing is deleted through an ExprAST*, so no
+ * virtual destructor, which keeps the nodes trivially destructible
+ */
+
+/**
+ * This tree is what the parser builds, it's then flattened into a
+ * FlatFunction (see flat_ast.hpp), on which codegen and everything else works
+ */
+
 // Base Class
 struct ExprAST {
-  public:
-    virtual llvm::Value *codegen() = 0;
-    virtual ~ExprAST() {}
+    // Which of the node types below this is, set by their constructors, so
+    // code walking the tree can switch on it (see ExprVisitor) instead of
+    // virtual calls or dynamic_cast
+    const NodeKind kind;
+
+  protected:
+    explicit ExprAST(NodeKind kind) : kind(kind) {}
 };
 
+/**
+ * Flatten the tree at 'root' into 'out', children before the parent
+ *
+ * Uses an explicit stack, instead of recursing for each level, so depth of
+ * the tree is only limited by memory
+ */
+NodeIndex flatten(const ExprAST *root, FlatFunction &out);
+
 // Number
 struct NumberAST : public ExprAST {
     double value;
+    ValueType type; // from its suffix, for eg. 1i64, else ValueType::ANY
+    bool fraction;  // written with a '.' or an exponent, so never an i64
 
-    llvm::Value *codegen() override;
-    explicit NumberAST(double val) : value(val) {}
+    explicit NumberAST(double val, ValueType type = ValueType::ANY,
+                       bool fraction = false)
+        : ExprAST(NodeKind::NUMBER), value(val), type(type),
+          fraction(fraction) {}
 };
 
 // Variable
 struct VariableAST : public ExprAST {
-    const utf8::string var_name;
+    const Symbol var_name;
 
-    llvm::Value *codegen() override;
-    explicit VariableAST(const utf8::string &var_name) : var_name(var_name) {}
+    explicit VariableAST(Symbol var_name)
+        : ExprAST(NodeKind::VARIABLE), var_name(var_name) {}
 };
 
-static const std::map<utf8::_char, int> OPERATOR_PRECENDENCE_TABLE = {
-    {'<', 5}, {'>', 5}, {'+', 10}, {'-', 10}, {'*', 20}, {'/', 20}};
+enum class Associativity : uint8_t { LEFT, RIGHT };
+
+struct OperatorInfo {
+    uint8_t binary_precedence = 0; // 0 if it isn't a binary operator
+    Associativity associativity = Associativity::LEFT;
+    uint8_t unary_precedence = 0; // 0 if it isn't a prefix operator
+
+    constexpr bool is_binary() const { return binary_precedence != 0; }
+    constexpr bool is_unary() const { return unary_precedence != 0; }
+};
+
+/**
+ * Operators are single ascii characters (TOK_OTHER), so the table is a dense
+ * array indexed by the character, and looking up an operator is one load.
+ * Higher precedence binds tighter.
+ *
+ * To add an operator, add its row here, and its IR in visit_binary() or
+ * visit_unary() of ExprCodegen
+ */
+constexpr std::array<OperatorInfo, 128> make_operator_table() {
+    std::array<OperatorInfo, 128> table{};
+    table['<'] = table['>'] = {5, Associativity::LEFT};
+    table['+'] = {10, Associativity::LEFT};
+    table['-'] = {10, Associativity::LEFT, /*unary*/ 30};
+    table['*'] = table['/'] = {20, Associativity::LEFT};
+    return table;
+}
+
+static constexpr auto OPERATORS = make_operator_table();
+
+inline const OperatorInfo &operator_info(char c) {
+    return OPERATORS[static_cast<uint8_t>(c) & 0x7F];
+}
+
+// Unary Expressions, for eg. -x
+struct UnaryExprAST : public ExprAST {
+    const char opr;
+    ExprAST *operand;
+
+    UnaryExprAST(char opr, ExprAST *operand)
+        : ExprAST(NodeKind::UNARY), opr(opr), operand(operand) {}
+};
 
 // Binary Expressions
 struct BinaryExprAST : public ExprAST {
-    const utf8::_char opr;
-    Ptr<ExprAST> lhs, rhs;
+    const char opr;
+    ExprAST *lhs, *rhs;
 
-    virtual llvm::Value *codegen();
-    BinaryExprAST(Ptr<ExprAST> lhs, const utf8::_char &opr, Ptr<ExprAST> rhs)
-        : lhs(std::move(lhs)), opr(opr), rhs(std::move(rhs)) {}
+    BinaryExprAST(ExprAST *lhs, char opr, ExprAST *rhs)
+        : ExprAST(NodeKind::BINARY), lhs(lhs), opr(opr), rhs(rhs) {}
 };
 
 // Expression class for if/then/else
 struct IfExprAST : public ExprAST {
-    Ptr<ExprAST> condition, then_, else_;
+    ExprAST *condition, *then_, *else_;
 
-    llvm::Value *codegen();
-    IfExprAST(Ptr<ExprAST> condition, Ptr<ExprAST> then_, Ptr<ExprAST> else_)
-        : condition(std::move(condition)), then_(std::move(then_)),
-          else_(std::move(else_)) {}
+    IfExprAST(ExprAST *condition, ExprAST *then_, ExprAST *else_)
+        : ExprAST(NodeKind::IF), condition(condition), then_(then_),
+          else_(else_) {}
 };
 
 struct BlockAST : public ExprAST {
-    const vector<Ptr<ExprAST>> expressions;
-
-    llvm::Value *codegen();
-    virtual llvm::Value *codegen(llvm::Function *func, bool is_if_else = false);
+    const ArenaSpan<ExprAST *> expressions;
 
-    BlockAST(vector<Ptr<ExprAST>> expressions)
-        : expressions(std::move(expressions)) {}
+    BlockAST(ArenaSpan<ExprAST *> expressions)
+        : ExprAST(NodeKind::BLOCK), expressions(expressions) {}
 };
 
 // Function call
 struct FunctionCallAST : public ExprAST {
-    const utf8::string callee;
-    const vector<Ptr<ExprAST>> args;
+    const Symbol callee;
+    const ArenaSpan<ExprAST *> args;
+
+    FunctionCallAST(Symbol callee, ArenaSpan<ExprAST *> args)
+        : ExprAST(NodeKind::CALL), callee(callee), args(args) {}
+};
+
+/**
+ * Assignment, for eg. x = x + 1, its value is the one assigned. A name that
+ * isn't a parameter becomes a local variable of the function when it's first
+ * assigned (see read_before_assignment())
+ */
+struct AssignAST : public ExprAST {
+    const Symbol variable;
+    ExprAST *value;
+
+    AssignAST(Symbol variable, ExprAST *value)
+        : ExprAST(NodeKind::ASSIGN), variable(variable), value(value) {}
+};
+
+/**
+ * Loop, running 'body' while 'condition' isn't 0, its value is 0. A 'for'
+ * loop is parsed into an assignment and one of these
+ */
+struct WhileAST : public ExprAST {
+    ExprAST *condition, *body;
+
+    WhileAST(ExprAST *condition, ExprAST *body)
+        : ExprAST(NodeKind::WHILE), condition(condition), body(body) {}
+};
 
-    virtual llvm::Value *codegen();
-    FunctionCallAST(const utf8::string &callee, vector<Ptr<ExprAST>> args)
-        : callee(callee), args(std::move(args)) {}
+/**
+ * Static dispatch on the kind of a node: visit() switches on node->kind and
+ * calls visit_number(), visit_binary() etc. of 'Derived' with the node cast
+ * to its type, and any extra arguments. A pass inherits this (CRTP), for eg.
+ *
+ *     struct CountCalls : ExprVisitor<CountCalls, int> {
+ *         int visit_call(const FunctionCallAST *call) { return 1; }
+ *         int visit_node(const ExprAST *) { return 0; }
+ *     };
+ *
+ * so there's no virtual call, nor any cast that can fail, per node. Kinds a
+ * pass doesn't handle go to its visit_node(), a pass handling all kinds needs
+ * none, and it doesn't compile if a kind is neither handled nor has a
+ * visit_node() to go to
+ *
+ * FlatVisitor (in flat_ast.hpp) is the same for the flattened nodes
+ */
+template <class Derived, class R = void> class ExprVisitor {
+  public:
+    template <class... Args> R visit(const ExprAST *node, Args &&...args) {
+        auto &self = static_cast<Derived &>(*this);
+        switch (node->kind) {
+        case NodeKind::NUMBER:
+            return self.visit_number(static_cast<const NumberAST *>(node),
+                                     std::forward<Args>(args)...);
+        case NodeKind::VARIABLE:
+            return self.visit_variable(static_cast<const VariableAST *>(node),
+                                       std::forward<Args>(args)...);
+        case NodeKind::UNARY:
+            return self.visit_unary(static_cast<const UnaryExprAST *>(node),
+                                    std::forward<Args>(args)...);
+        case NodeKind::BINARY:
+            return self.visit_binary(static_cast<const BinaryExprAST *>(node),
+                                     std::forward<Args>(args)...);
+        case NodeKind::IF:
+            return self.visit_if(static_cast<const IfExprAST *>(node),
+                                 std::forward<Args>(args)...);
+        case NodeKind::BLOCK:
+            return self.visit_block(static_cast<const BlockAST *>(node),
+                                    std::forward<Args>(args)...);
+        case NodeKind::CALL:
+            return self.visit_call(static_cast<const FunctionCallAST *>(node),
+                                   std::forward<Args>(args)...);
+        case NodeKind::ASSIGN:
+            return self.visit_assign(static_cast<const AssignAST *>(node),
+                                     std::forward<Args>(args)...);
+        case NodeKind::WHILE:
+            return self.visit_while(static_cast<const WhileAST *>(node),
+                                    std::forward<Args>(args)...);
+        }
+        llvm_unreachable("Invalid NodeKind");
+    }
+
+    // Defaults, for the kinds 'Derived' doesn't handle itself
+#define EXPR_VISITOR_DEFAULT(method, type)                                    \
+    template <class... Args> R method(const type *node, Args &&...args) {    \
+        return static_cast<Derived &>(*this).visit_node(                      \
+            node, std::forward<Args>(args)...);                               \
+    }
+    EXPR_VISITOR_DEFAULT(visit_number, NumberAST)
+    EXPR_VISITOR_DEFAULT(visit_variable, VariableAST)
+    EXPR_VISITOR_DEFAULT(visit_unary, UnaryExprAST)
+    EXPR_VISITOR_DEFAULT(visit_binary, BinaryExprAST)
+    EXPR_VISITOR_DEFAULT(visit_if, IfExprAST)
+    EXPR_VISITOR_DEFAULT(visit_block, BlockAST)
+    EXPR_VISITOR_DEFAULT(visit_call, FunctionCallAST)
+    EXPR_VISITOR_DEFAULT(visit_assign, AssignAST)
+    EXPR_VISITOR_DEFAULT(visit_while, WhileAST)
+#undef EXPR_VISITOR_DEFAULT
 };
 
 // Function prototype
-struct FunctionPrototypeAST : public ExprAST {
-    const vector<utf8::string> parameter_names;
+struct FunctionPrototypeAST {
+    const ArenaSpan<Symbol> parameter_names;
+    const ArenaSpan<ValueType> parameter_types; // ValueType::ANY if none
+    const ValueType return_type;
 
-    const utf8::string function_name;
+    const Symbol function_name; // Symbol::EMPTY for anonymous functions
 
-    llvm::Function *codegen() override;
-    FunctionPrototypeAST(const utf8::string &name,
-                         const vector<utf8::string> &param_names)
-        : function_name(name), parameter_names(param_names) {}
+    // Set name, parameters and types of 'out'
+    void flatten(FlatFunction &out) const;
+    FunctionPrototypeAST(Symbol name, ArenaSpan<Symbol> param_names,
+                         ArenaSpan<ValueType> param_types = {},
+                         ValueType return_type = ValueType::ANY)
+        : function_name(name), parameter_names(param_names),
+          parameter_types(param_types), return_type(return_type) {}
 };
 
 // Function
-struct FunctionAST : public ExprAST {
-    const Ptr<FunctionPrototypeAST> prototype;
-    const Ptr<BlockAST> block;
+struct FunctionAST {
+    FunctionPrototypeAST *const prototype;
+    BlockAST *const block;
+    const FPMode fp_mode; // from its annotation, if any
 
-    llvm::Function *codegen() override;
-    FunctionAST(Ptr<FunctionPrototypeAST> prototype, Ptr<BlockAST> block)
-        : prototype(std::move(prototype)), block(std::move(block)) {}
+    void flatten(FlatFunction &out) const;
+    FunctionAST(FunctionPrototypeAST *prototype, BlockAST *block,
+                FPMode fp_mode = FPMode::DEFAULT)
+        : prototype(prototype), block(block), fp_mode(fp_mode) {}
 };
 
 /**
- * functions are typed with just a count of their arguments. Since all values
- * are double precision floating point, the type of each argument doesn’t need
- * to be stored anywhere. In a more aggressive and realistic language, the
- * “ExprAST” class would probably have a type field
+ * Values are double precision floating point, unless annotated otherwise
+ * (see ValueType), so only parameters, returns and literals have a type
+ * field, types of the rest are inferred from them when generating the code
+ * (see types.hpp)
  */
 
 // NOT using the CurToken & getNextToken as given in the tutorial
 
+// Generate IR for a flattened function, or an extern declaration
+llvm::Function *codegen(const FlatFunction &f);
+
+// Same for a function, with 'types' as the type each node is computed in,
+// instead of inferring them (see infer_types()), so they must be consistent
+llvm::Function *codegen(const FlatFunction &f,
+                        const std::vector<ValueType> &types);
+
+// FPMode of functions without an annotation (FPMode::STRICT by default)
+void set_default_fp_mode(FPMode mode);
+
+// Parameter names 'function' was declared with, which are used by its
+// definition too (see the @bug in codegen_function)
+llvm::ArrayRef<Symbol> declared_parameters(Symbol function);
+
+// Function declared (or defined) as 'function', nullptr if none
+llvm::Function *declared_function(Symbol function);
+
+// Exported constant global 'name', with 'value'
+llvm::GlobalVariable *codegen_constant(const std::string &name, double value);
+
+/**
+ * Stream the parser's error messages go to, std::cerr unless redirected on
+ * this thread, for eg. to keep messages of a definition parsed on a worker
+ * thread, till they can be printed in order
+ */
+std::ostream &diagnostics();
+
+// Redirects diagnostics() on this thread to 'out', till destroyed
+class DiagnosticsTo {
+    std::ostream *previous;
+
+  public:
+    explicit DiagnosticsTo(std::ostream &out);
+    ~DiagnosticsTo();
+
+    DiagnosticsTo(const DiagnosticsTo &) = delete;
+    DiagnosticsTo &operator=(const DiagnosticsTo &) = delete;
+};
+
 // Helper functions
-Ptr<ExprAST> LogError(const utf8::string &str);
-Ptr<FunctionPrototypeAST> LogErrorP(const utf8::string &str);
+ExprAST *LogError(const utf8::string &str);
+FunctionPrototypeAST *LogErrorP(const utf8::string &str);
 llvm::Value *LogErrorV(const utf8::string &str);
 
 // These WON'T do error checking, if current token is okay
 
-// 'Primary' expressions
-Ptr<NumberAST> parseNumberExpr();
-Ptr<ExprAST> parseParenExpr();
-Ptr<ExprAST> parseIdentifierAndCalls();
-
-Ptr<ExprAST> parsePrimaryExpression();
-Ptr<ExprAST> parseBinaryHelperFn(Ptr<ExprAST> lhs, int min_precedence);
+// All nodes are allocated in 'arena', and live till it's reset
 
-Ptr<ExprAST> parseIfExpr();
+NumberAST *parseNumberExpr(Lexer &lexer, Arena &arena);
 
-Ptr<FunctionPrototypeAST> parsePrototypeExpr();
-Ptr<FunctionAST> parseFunctionExpr();
-Ptr<BlockAST> parseBlock();
-Ptr<ExprAST> parseExpression();
-Ptr<FunctionPrototypeAST> parseExternPrototypeExpr();
-Ptr<FunctionAST> parseTopLevelExpr();
+FunctionPrototypeAST *parsePrototypeExpr(Lexer &lexer, Arena &arena);
+FunctionAST *parseFunctionExpr(Lexer &lexer, Arena &arena);
+BlockAST *parseBlock(Lexer &lexer, Arena &arena);
+ExprAST *parseExpression(Lexer &lexer, Arena &arena);
+FunctionPrototypeAST *parseExternPrototypeExpr(Lexer &lexer, Arena &arena);
+FunctionAST *parseTopLevelExpr(Lexer &lexer, Arena &arena);
@@ -4,6 +4,17 @@
 
 #include <llvm/Target/TargetMachine.h>
 
-llvm::TargetMachine *InitialisationCompiler();
+/**
+ * Target machine for the host's triple, or its 'arch' instead (a target name
+ * as in 'llc -march', for eg. x86-64 or aarch64), generating code for 'cpu'
+ * (as in 'llc -mcpu', for eg. haswell or x86-64-v3). "native" for either is
+ * the host's, for cpu also with all features the host has. With 'pic', code
+ * is position independent
+ *
+ * Prints the error and throws if the target or cpu isn't known
+ */
+llvm::TargetMachine *InitialisationCompiler(const std::string &cpu = "generic",
+                                            const std::string &arch = "",
+                                            bool pic = false);
 int CompileToObjectFile(const std::string &filename,
                         llvm::TargetMachine *target_machine);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "flat_ast.hpp"
+#include "symbols.hpp"
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+
+/**
+ * Runs saras functions at compile time, so a value known at build time (for
+ * eg. virhanka(5)) can be compiled as a constant instead of a call
+ *
+ * Functions are evaluated from their flattened form, with the same results
+ * as the IR codegen emits for them. Evaluation gives up (returns nullopt),
+ * and the code is left to run at runtime, if it:
+ * - calls an extern, or a function not defined (yet), since it may have
+ *   side effects, or isn't known
+ * - uses an unknown variable, or a local variable not assigned yet (0 at
+ *   runtime), or passes wrong number of arguments
+ * - takes more than 'fuel' steps (a step is roughly a node evaluated), so a
+ *   function that never returns can't hang the compiler
+ *
+ * Calls are kept on an explicit stack, so deep recursion is only limited by
+ * the fuel
+ */
+class ConstantEvaluator {
+    std::vector<FlatFunction> definitions; // by Symbol, is_extern() if none
+    uint64_t fuel;
+
+  public:
+    static constexpr uint64_t DEFAULT_FUEL = 1'000'000;
+
+    explicit ConstantEvaluator(uint64_t fuel = DEFAULT_FUEL) : fuel(fuel) {}
+
+    /**
+     * Make 'f' callable, with 'parameters' as names of its parameters (the
+     * ones codegen used for it, which can differ from f.parameters, see the
+     * @bug in codegen_function). Values are computed as doubles, so 'f' must
+     * be without types (see is_untyped())
+     */
+    void define(const FlatFunction &f, llvm::ArrayRef<Symbol> parameters);
+
+    // Value of callee(args...)
+    std::optional<double> call(Symbol callee,
+                               llvm::ArrayRef<double> args) const;
+
+    // Value of a function without parameters, ie. a top-level expression
+    std::optional<double> evaluate(const FlatFunction &f) const;
+
+  private:
+    std::optional<double> run(const FlatFunction &f,
+                              llvm::ArrayRef<double> args) const;
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "symbols.hpp"
+#include <cstdint>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/Support/ErrorHandling.h>
+
+enum class NodeKind : uint8_t {
+    NUMBER,   // operand: index in numbers
+    VARIABLE, // operand: Symbol of the name
+    BINARY,   // operand: the operator (ascii), children: lhs, rhs
+    IF,       // children: condition, then block, else block
+    BLOCK,    // children: the expressions
+    CALL,     // operand: Symbol of the callee, children: the arguments
+    UNARY,    // operand: the operator (ascii), children: operand
+    ASSIGN,   // operand: Symbol of the variable, children: the value
+    WHILE,    // children: condition, body
+};
+
+// Floating point optimisations allowed in a function, see codegen_function
+enum class FPMode : uint8_t {
+    DEFAULT,  // as per --ffast-math and --fp-contract
+    STRICT,   // none, ie. same results as IEEE says, whatever the options
+    CONTRACT, // a*b + c can be a fused multiply-add (rounded once)
+    FAST,     // all fast-math flags, ie. also reassociating, no NaN/inf etc.
+};
+
+// Type of a value, as annotated, for eg. "n: i64", "2.5f32" (see types.hpp)
+enum class ValueType : uint8_t {
+    ANY, // not annotated: f64 for parameters and returns, a literal is the
+         // type of what it's used with
+    I64, // signed 64-bit integer
+    F32,
+    F64,
+};
+
+using NodeIndex = uint32_t;
+constexpr NodeIndex NO_NODE = ~0u;
+
+/**
+ * Flat form of one function (or extern declaration), nodes are just indices
+ * into arrays (struct of arrays), so whole function is a handful of
+ * contiguous arrays, instead of a tree of separately allocated nodes
+ *
+ * Nodes are in post-order, ie. children always come before their parent, and
+ * the body is the last node. So an analysis that doesn't care about the tree
+ * shape (for eg. "does it call X") is just a loop over the kinds
+ *
+ * Children of a node are consecutive in 'children', so a node only needs an
+ * offset and a count. Unlike pointers, 32-bit indices stay valid when the
+ * arrays grow, or are copied/moved elsewhere as a whole
+ */
+struct FlatFunction {
+    Symbol name = Symbol::EMPTY; // Symbol::EMPTY for top-level expressions
+    std::vector<Symbol> parameters;
+    std::vector<ValueType> parameter_types; // one per parameter
+    ValueType return_type = ValueType::ANY;
+    NodeIndex body = NO_NODE; // a BLOCK, or NO_NODE for an extern
+    FPMode fp_mode = FPMode::DEFAULT;
+
+    // Per node
+    std::vector<NodeKind> kinds;
+    std::vector<uint32_t> operands;
+    std::vector<uint32_t> first_child; // offset in children
+    std::vector<uint32_t> child_count;
+
+    std::vector<NodeIndex> children;
+    std::vector<double> numbers;
+    std::vector<ValueType> number_types; // per number, its suffix if any
+    std::vector<bool> number_fractions;  // per number, see NumberAST
+
+    size_t size() const { return kinds.size(); }
+    bool is_extern() const { return body == NO_NODE; }
+
+    double number(NodeIndex n) const { return numbers[operands[n]]; }
+    ValueType number_type(NodeIndex n) const {
+        return number_types[operands[n]];
+    }
+    bool number_fraction(NodeIndex n) const {
+        return number_fractions[operands[n]];
+    }
+    Symbol symbol(NodeIndex n) const { return static_cast<Symbol>(operands[n]); }
+    char opr(NodeIndex n) const { return static_cast<char>(operands[n]); }
+
+    llvm::ArrayRef<NodeIndex> children_of(NodeIndex n) const {
+        return llvm::ArrayRef<NodeIndex>(children).slice(first_child[n],
+                                                         child_count[n]);
+    }
+
+    NodeIndex add(NodeKind kind, uint32_t operand,
+                  llvm::ArrayRef<NodeIndex> node_children = {});
+    NodeIndex add_number(double value, ValueType type = ValueType::ANY,
+                         bool fraction = false);
+
+    // Empty it, keeping the allocated memory, to flatten the next function
+    void clear();
+
+    // Some node assigns to the variable 'name'
+    bool assigns(Symbol name) const;
+};
+
+/**
+ * A local variable is one that's assigned to, but isn't a parameter, and its
+ * type is of the first value assigned to it (see infer_types()), so it can't
+ * be read before that, in the order of the nodes (ie. in the source)
+ *
+ * @returns the first VARIABLE node reading a local before it's assigned, or
+ * NO_NODE
+ */
+NodeIndex read_before_assignment(const FlatFunction &f);
+
+/**
+ * Same as ExprVisitor (see ast.hpp), for node 'n' of a FlatFunction: visit()
+ * switches on f.kinds[n] and calls visit_number(f, n, args...) etc. of
+ * 'Derived', kinds it doesn't handle go to its visit_node(f, n, args...)
+ */
+template <class Derived, class R = void> class FlatVisitor {
+  public:
+    template <class... Args>
+    R visit(const FlatFunction &f, NodeIndex n, Args &&...args) {
+        auto &self = static_cast<Derived &>(*this);
+        switch (f.kinds[n]) {
+        case NodeKind::NUMBER:
+            return self.visit_number(f, n, std::forward<Args>(args)...);
+        case NodeKind::VARIABLE:
+            return self.visit_variable(f, n, std::forward<Args>(args)...);
+        case NodeKind::UNARY:
+            return self.visit_unary(f, n, std::forward<Args>(args)...);
+        case NodeKind::BINARY:
+            return self.visit_binary(f, n, std::forward<Args>(args)...);
+        case NodeKind::IF:
+            return self.visit_if(f, n, std::forward<Args>(args)...);
+        case NodeKind::BLOCK:
+            return self.visit_block(f, n, std::forward<Args>(args)...);
+        case NodeKind::CALL:
+            return self.visit_call(f, n, std::forward<Args>(args)...);
+        case NodeKind::ASSIGN:
+            return self.visit_assign(f, n, std::forward<Args>(args)...);
+        case NodeKind::WHILE:
+            return self.visit_while(f, n, std::forward<Args>(args)...);
+        }
+        llvm_unreachable("Invalid NodeKind");
+    }
+
+#define FLAT_VISITOR_DEFAULT(method)                                          \
+    template <class... Args>                                                  \
+    R method(const FlatFunction &f, NodeIndex n, Args &&...args) {            \
+        return static_cast<Derived &>(*this).visit_node(                      \
+            f, n, std::forward<Args>(args)...);                               \
+    }
+    FLAT_VISITOR_DEFAULT(visit_number)
+    FLAT_VISITOR_DEFAULT(visit_variable)
+    FLAT_VISITOR_DEFAULT(visit_unary)
+    FLAT_VISITOR_DEFAULT(visit_binary)
+    FLAT_VISITOR_DEFAULT(visit_if)
+    FLAT_VISITOR_DEFAULT(visit_block)
+    FLAT_VISITOR_DEFAULT(visit_call)
+    FLAT_VISITOR_DEFAULT(visit_assign)
+    FLAT_VISITOR_DEFAULT(visit_while)
+#undef FLAT_VISITOR_DEFAULT
+};
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "ast.hpp"
+#include "lexer.hpp"
+#include "pipeline.hpp"
 #include "tokens.hpp"
 #include "util.hpp"
 #include <iostream>
@@ -8,12 +10,91 @@
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
+#include <string>
+#include <string_view>
 #include <unordered_set>
 
-extern Token CurrentToken;
+class ConstantEvaluator;
+class IntegerPromoter;
+class Specialiser;
+class TailCalls;
+class ThreadPool;
 
-Ptr<FunctionAST> HandleFunctionDefinition(bool print_ir = true);
-Ptr<FunctionPrototypeAST> HandleExtern(bool print_ir = true);
-Ptr<FunctionAST> HandleTopLevelExpression(bool print_ir = true);
+// What an iteration of the interpreter loop does, based on its first token
+enum class ItemKind { END, SEPARATOR, EXTERN, FUNCTION, EXPRESSION };
 
-void run_interpreter(std::unordered_set<std::string> options = {});
+ItemKind top_level_kind(const Token &token);
+
+/**
+ * Names of the exported constants top-level expressions become (see
+ * HandleTopLevelItem()), "saras_expr_<stem>_<N>" for the Nth top-level
+ * expression (from 0) of the source file, whose name without extension is
+ * 'stem', so objects compiled from different files link together
+ */
+struct ConstantNames {
+    std::string stem;
+    size_t expressions = 0; // top-level expressions seen, known or not
+
+    explicit ConstantNames(std::string_view stem);
+
+    // Name for the next top-level expression
+    std::string next();
+};
+
+// Optional passes run on each definition before its codegen, null if off
+struct DefinitionPasses {
+    ConstantEvaluator *evaluator = nullptr;  // see evaluate.hpp
+    ConstantNames *constant_names = nullptr; // with an evaluator
+    Specialiser *specialiser = nullptr;      // see specialise.hpp
+    IntegerPromoter *promoter = nullptr;     // see promote.hpp
+    TailCalls *tail_calls = nullptr;         // see tail_calls.hpp
+};
+
+/**
+ * Parse (into 'arena') next top-level item, ie. the one at lexer.current(),
+ * and flatten it into 'flat', optimised (see optimise.hpp) unless
+ * 'optimise_ast' is false. Doesn't touch any LLVM state, so items can be
+ * parsed on multiple threads
+ *
+ * @returns false if it's not a definition, or couldn't be parsed
+ */
+bool ParseTopLevelItem(Lexer &lexer, Arena &arena, ItemKind kind,
+                       FlatFunction &flat, bool optimise_ast = true);
+
+/**
+ * Codegen (and visualise) a parsed item, 'flat' is nullptr if it couldn't be
+ * parsed
+ *
+ * With an evaluator, it's evaluated at compile time first (see
+ * evaluate.hpp), calls with constant arguments become their values, and a
+ * top-level expression with a known value becomes an exported constant,
+ * named by passes.constant_names
+ *
+ * With a specialiser, calls in a function still having some constant
+ * arguments go to specialised copies of their callees, which are
+ * codegen-ed just before it
+ *
+ * With a promoter, a function computing with whole numbers gets a copy using
+ * i64s, codegen-ed just after it
+ */
+void HandleTopLevelItem(ItemKind kind, FlatFunction *flat, bool parser_mode,
+                        bool print_ir = true, DefinitionPasses passes = {});
+
+/**
+ * Parse and codegen all top-level items, till EOF
+ *
+ * If a pool is passed, and lexer.lex_parallel() has been called, items are
+ * parsed on the pool, and only codegen is in order, on this thread
+ *
+ * 'passes' are run on each item, see HandleTopLevelItem(), the specialiser
+ * only if the AST is optimised. With "report-specialisations" in 'options',
+ * the specialisations done are printed at the end, and same for
+ * "report-int-promotions" and "report-tail-calls"
+ *
+ * Once all are done, tail calls are marked (if passes.tail_calls is set),
+ * and the whole module is optimised as per 'pipeline'
+ */
+void run_interpreter(Lexer &lexer,
+                     std::unordered_set<std::string> options = {},
+                     ThreadPool *pool = nullptr, DefinitionPasses passes = {},
+                     const PipelineOptions &pipeline = {});
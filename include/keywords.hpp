@@ -0,0 +1,221 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Language neutral kind of a keyword, all spellings (in english, hindi,
+// telugu, or any loaded alias) map to one of these
+enum class Keyword : uint8_t {
+    NONE, // not a keyword
+    FN,
+    EXTERN,
+    IF,
+    THEN,
+    ELSE,
+    FOR,
+    WHILE,
+    RETURN,
+};
+
+struct KeywordAlias {
+    std::string_view spelling;
+    Keyword kind = Keyword::NONE;
+};
+
+// clang-format off
+static constexpr std::array<KeywordAlias, 24> BUILTIN_KEYWORDS = {{
+    {"fn", Keyword::FN}, {"extern", Keyword::EXTERN},
+    {"if", Keyword::IF}, {"then", Keyword::THEN}, {"else", Keyword::ELSE},
+    {"for", Keyword::FOR}, {"while", Keyword::WHILE}, {"return", Keyword::RETURN},
+
+    {"प्रकर", Keyword::FN}, {"बाहरीप्रकर", Keyword::EXTERN},
+    {"यदि", Keyword::IF}, {"तब", Keyword::THEN}, {"अथवा", Keyword::ELSE},
+    {"लूप", Keyword::FOR}, {"लघुलूप", Keyword::WHILE}, {"वापसी", Keyword::RETURN},
+
+    {"ప్రక్రియ", Keyword::FN}, {"బాహ్య-ప్రక్రియ", Keyword::EXTERN},
+    {"ఉంటే", Keyword::IF}, {"అప్పుడు", Keyword::THEN}, {"లేకపోతే", Keyword::ELSE},
+    {"లూప్", Keyword::FOR}, {"అయితే", Keyword::WHILE}, {"తిరిగి", Keyword::RETURN},
+}};
+// clang-format on
+
+namespace perfect_hash {
+// FNV-1a, with a seed, and a final mix so that low bits are usable directly
+constexpr uint32_t hash(std::string_view s, uint32_t seed) {
+    uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+    for (auto c : s) {
+        h ^= static_cast<uint8_t>(c);
+        h *= 16777619u;
+    }
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    return h;
+}
+
+constexpr uint32_t UNPLACED = 0x80000000u;
+constexpr uint32_t END = ~0u;
+
+/**
+ * 'Hash and displace' construction of a collision free table: keys are
+ * grouped into buckets by hash(key, 0), then, biggest bucket first, a seed 'd'
+ * is searched for each bucket such that hash(key, d) puts all its keys into
+ * free slots. Lookup is then always two hashes and one comparison.
+ *
+ * Works with std::array (so it can run at compile time) and std::vector (for
+ * tables built at runtime), slots.size() == seeds.size() must be a power of 2,
+ * chain.size() == n + slots.size(), and keys must be unique
+ *
+ * @returns false if no seed could be found (only if table is too full)
+ */
+template <class Slots, class Seeds, class Chain>
+constexpr bool build(const KeywordAlias *keys, size_t n, Slots &slots,
+                     Seeds &seeds, Chain &chain) {
+    const size_t mask = slots.size() - 1;
+
+    for (auto &s : slots)
+        s = KeywordAlias{};
+    for (auto &d : seeds)
+        d = 0;
+    for (auto &c : chain)
+        c = END;
+
+    // chain[n + b] is first key in bucket 'b', and chain[i] is the key after
+    // keys[i] in its bucket
+    // seeds[b] holds (UNPLACED | number of keys) till bucket 'b' is placed
+    uint32_t max_bucket = 0;
+    for (size_t i = 0; i < n; ++i) {
+        auto b = hash(keys[i].spelling, 0) & mask;
+        chain[i] = chain[n + b];
+        chain[n + b] = i;
+
+        auto &d = seeds[b];
+        d = UNPLACED | ((d & ~UNPLACED) + 1);
+        if ((d & ~UNPLACED) > max_bucket)
+            max_bucket = d & ~UNPLACED;
+    }
+
+    for (auto count = max_bucket; count > 0; --count) {
+        for (size_t b = 0; b < seeds.size(); ++b) {
+            if (seeds[b] != (UNPLACED | count))
+                continue;
+
+            bool placed = false;
+            for (uint32_t d = 1; d < (1u << 16) && !placed; ++d) {
+                placed = true;
+                auto i = chain[n + b];
+                for (; i != END; i = chain[i]) {
+                    auto &slot = slots[hash(keys[i].spelling, d) & mask];
+                    if (slot.kind != Keyword::NONE) {
+                        placed = false;
+                        break;
+                    }
+                    slot = keys[i];
+                }
+
+                // undo the partial placement, to retry with next seed
+                for (auto j = chain[n + b]; !placed && j != i; j = chain[j])
+                    slots[hash(keys[j].spelling, d) & mask] = KeywordAlias{};
+
+                if (placed)
+                    seeds[b] = d;
+            }
+
+            if (!placed)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+template <class Slots, class Seeds>
+constexpr Keyword lookup(const Slots &slots, const Seeds &seeds,
+                         std::string_view s) {
+    const size_t mask = slots.size() - 1;
+    auto d = seeds[hash(s, 0) & mask];
+    if (d == 0)
+        return Keyword::NONE; // empty bucket
+
+    auto &slot = slots[hash(s, d) & mask];
+    return slot.spelling == s ? slot.kind : Keyword::NONE;
+}
+
+// Table built at compile time, for the fixed set of keys
+template <size_t Size, size_t N> struct StaticTable {
+    std::array<KeywordAlias, Size> slots{};
+    std::array<uint32_t, Size> seeds{};
+    bool ok = false;
+
+    constexpr explicit StaticTable(const std::array<KeywordAlias, N> &keys) {
+        static_assert((Size & (Size - 1)) == 0, "Size must be a power of 2");
+        static_assert(N <= Size / 2, "Keep table at most half full");
+
+        std::array<uint32_t, N + Size> chain{};
+        ok = build(keys.data(), N, slots, seeds, chain);
+    }
+
+    constexpr Keyword find(std::string_view s) const {
+        return lookup(slots, seeds, s);
+    }
+};
+} // namespace perfect_hash
+
+static constexpr auto BUILTIN_KEYWORD_TABLE =
+    perfect_hash::StaticTable<64, BUILTIN_KEYWORDS.size()>(BUILTIN_KEYWORDS);
+static_assert(BUILTIN_KEYWORD_TABLE.ok,
+              "Failed to find a perfect hash for builtin keywords");
+static_assert(BUILTIN_KEYWORD_TABLE.find("यदि") == Keyword::IF);
+static_assert(BUILTIN_KEYWORD_TABLE.find("iff") == Keyword::NONE);
+
+/**
+ * Keywords in use by the lexer. Starts as the compile time table of
+ * BUILTIN_KEYWORDS, and is rebuilt (with the same perfect hash construction)
+ * when alias packs are loaded, so lookup stays O(1) for any number of
+ * languages
+ *
+ * @note: Load all alias packs at startup, before lexing; concurrent find() is
+ * fine, but not concurrently with load_alias_pack()
+ */
+class KeywordTable {
+    std::vector<KeywordAlias> keys; // all spellings, builtin + aliases
+    std::vector<KeywordAlias> slots;
+    std::vector<uint32_t> seeds;
+    std::deque<std::string> alias_storage; // owns the loaded spellings
+    size_t built_keys = 0; // keys[built_keys..] are not in the table yet
+
+  public:
+    KeywordTable();
+
+    Keyword find(std::string_view s) const {
+        return perfect_hash::lookup(slots, seeds, s);
+    }
+
+    /**
+     * Add a new spelling for an existing keyword, eg. add_alias("if", "si")
+     *
+     * @throws std::runtime_error if 'existing' is not a keyword, or 'alias' is
+     * already a keyword
+     */
+    void add_alias(std::string_view existing, std::string_view alias);
+
+    /**
+     * Load a file of aliases, each line is "<existing keyword> <alias>", and
+     * '#' starts a comment, for eg. programs/spanish.keywords
+     *
+     * @throws std::runtime_error on failure to read, or an invalid alias
+     */
+    void load_alias_pack(const std::string &filename);
+
+  private:
+    // Same as find(), but also sees the keys inserted since last rebuild()
+    Keyword find_pending(std::string_view s) const;
+
+    void insert(std::string_view existing, std::string_view alias);
+    void rebuild();
+};
+
+extern KeywordTable LangKeywords;
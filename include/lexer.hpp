@@ -3,22 +3,168 @@
 #include <cctype>
 #include <cstdio>
 #include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#include "keywords.hpp"
+#include "source.hpp"
 #include "tokens.hpp"
 #include "utf8.hpp"
 
-// clang-format off
-static const std::vector<utf8::string> LANG_KEYWORDS
-    = {
-        "if", "then", "else", "for", "while", "return",
-        "यदि","तब", "अथवा", "लूप", "लघुलूप", "वापसी",
-        "ఉంటే", "అప్పుడు", "లేకపోతే", "లూప్", "అయితే", "తిరిగి"
-      };
-// clang-format on
+class ThreadPool;
 
-// The actual implementation of the lexer is a single function named gettok.
-// ( aka gettok ) - return next token
-Token get_next_token();
+// Error in the source, for eg. a malformed number, what() is prefixed with the
+// "line:column" of the span
+struct LexError : public std::runtime_error {
+    std::string message; // without the location
+    SourceSpan span;
 
-void dump_all_tokens();
+    LexError(std::string message, SourceSpan span)
+        : std::runtime_error(std::to_string(span.line) + ":" +
+                             std::to_string(span.column) + ": " + message),
+          message(std::move(message)), span(span) {}
+};
+
+/**
+ * Lexer over one source buffer, all its state (buffer, position, and the
+ * current token) is in the object, so multiple lexers can run independently,
+ * for eg. on different threads
+ *
+ * The parser works on current(), ie. the lookahead, and calls advance() when
+ * it has consumed it
+ */
+class Lexer {
+    SourceBuffer source;
+
+    size_t pos = 0; // offset of the next unread byte in source
+
+    // Line at pos, and offset where it starts
+    uint32_t line = 1;
+    size_t line_start = 0;
+
+    // Column of the last token, and its offset, columns are counted
+    // incrementally from here, so long lines don't get counted again for each
+    // token
+    uint32_t column = 1;
+    size_t column_pos = 0;
+
+    Token current_token = TOK_EOF{};
+
+    // Filled by lex_parallel(), then advance() replays these instead of
+    // lexing. Read-only once filled, so fork()ed lexers share it
+    struct PendingError {
+        size_t before_token; // thrown when replay reaches this token
+        LexError error;
+    };
+    struct Lexed {
+        std::vector<std::vector<Token>> chunks; // tokens of each chunk, in order
+        std::vector<size_t> first_token;        // index of each chunk's first
+        std::vector<PendingError> errors;
+        size_t size = 0; // tokens in all chunks, last one is TOK_EOF
+    };
+    std::shared_ptr<const Lexed> lexed; // nullptr if not replaying
+    size_t replay_chunk = 0, replay_pos = 0; // next token in lexed
+    size_t replayed = 0; // tokens replayed till now, from all chunks
+    size_t replay_error = 0;
+
+    const Token &replay();
+
+    int peek(size_t ahead = 0);
+    void advance_while(const char *(*kernel)(const char *, const char *));
+    void skip_whitespace();
+    SourceSpan span_from(size_t start);
+    Token lex();
+
+    size_t lex_digits(size_t start, bool hex);
+    TOK_NUMBER lex_number(size_t start);
+    bool at_type_suffix();
+    [[noreturn]] void malformed_number(size_t start);
+
+    // Lex source[begin, end), that starts at a line, for lex_parallel()
+    static void lex_chunk(const SourceBuffer &source, size_t begin, size_t end,
+                          std::vector<Token> &tokens,
+                          std::vector<PendingError> &errors);
+
+  public:
+    explicit Lexer(SourceBuffer source) : source(std::move(source)) {}
+
+    Lexer(Lexer &&) = default;
+    Lexer &operator=(Lexer &&) = default;
+
+    // The lookahead, ie. token the parser is currently working on
+    const Token &current() const { return current_token; }
+
+    // Lex the next token into current()
+    const Token &advance() {
+        current_token = lexed ? replay() : lex();
+        return current_token;
+    }
+
+    /**
+     * Lex the whole source (reading it till EOF, if it's a stream) on the
+     * pool, after which advance() returns the same tokens (and throws the same
+     * errors, at same points) as lexing one by one would
+     *
+     * Source is split into chunks at newlines, since no token, or comment,
+     * continues past a '\n'. Each chunk is lexed independently, into its own
+     * token array, then their lines and offsets are shifted to where the
+     * chunk starts, and the arrays are replayed one after another (instead of
+     * copying them into one array).
+     */
+    void lex_parallel(ThreadPool &pool);
+
+    /**
+     * Point in the replay, ie. current() is token 'replayed - 1', and the
+     * errors before it have been thrown. Replaying from equal checkpoints
+     * gives the same tokens and errors
+     */
+    struct Checkpoint {
+        size_t replayed = 0;
+        size_t replay_error = 0;
+
+        bool operator==(const Checkpoint &o) const {
+            return replayed == o.replayed && replay_error == o.replay_error;
+        }
+        bool operator!=(const Checkpoint &o) const { return !(*this == o); }
+    };
+
+    // Whether tokens are replayed, ie. lex_parallel() has been called
+    bool replaying() const { return lexed != nullptr; }
+
+    // @expects: lex_parallel() has been called, for all functions below
+
+    Checkpoint checkpoint() const { return {replayed, replay_error}; }
+
+    // Checkpoint just after advance() has returned token 'index', ie. the
+    // state when parsing reaches that token without an error
+    Checkpoint checkpoint_at(size_t index) const;
+
+    // Number of tokens, including the final TOK_EOF, and the i'th of those
+    size_t size() const { return lexed->size; }
+    const Token &token(size_t index) const;
+
+    /**
+     * Another lexer replaying the same tokens (without copying them), with
+     * current() and errors as they were at 'from', so multiple parsers can
+     * work on different parts of the source at the same time
+     *
+     * @note: The fork refers to this lexer's source, so it must not outlive
+     * this lexer
+     */
+    Lexer fork(const Checkpoint &from) const;
+
+    // Source text of the token, for eg. name of the identifier
+    std::string_view text(const Token &t) const {
+        auto span = get_span(t);
+        return source.view(span.offset, span.length);
+    }
+
+    // Start lexing (or replaying) again from beginning of the source
+    void reset();
+};
+
+void dump_all_tokens(Lexer &lexer);
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+/**
+ * Makes each exported function of 'module' pick, when the program is loaded,
+ * a version of itself compiled for the best instructions the CPU has:
+ *
+ * - "<name>.default", for the target machine's CPU, ie. the function as it is
+ * - "<name>.avx2", adding AVX2 and FMA
+ * - "<name>.avx512", adding AVX-512 F, VL, BW, DQ and CD (what x86-64-v4 has)
+ *
+ * "<name>" itself becomes an ifunc, whose resolver checks the CPU with the
+ * same runtime support as __builtin_cpu_supports() (__cpu_model, from
+ * libgcc or compiler-rt, linked in by gcc and clang). Internal functions get
+ * the versions too, but no ifunc. Versions of functions call the same
+ * version of each other, so only calls from outside the module go through
+ * the ifunc
+ *
+ * Should be done before optimising, so each version is optimised for its
+ * instructions. Only x86-64 ELF has both ifuncs and these instructions
+ *
+ * @returns false (changing nothing) if the target isn't x86-64 ELF
+ */
+bool multiversion(llvm::Module &module,
+                  const llvm::TargetMachine &target_machine);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "flat_ast.hpp"
+#include "symbols.hpp"
+#include <optional>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/STLExtras.h>
+
+/**
+ * Simplifies a flattened function, between parsing and codegen:
+ *
+ * - Constant folding: an operator on numbers becomes a number, computed the
+ *   same way the IR would at runtime (for eg. '<' of a NaN is 1, like the
+ *   'fcmp ult' it's compiled to)
+ * - Identities that hold for every double, including NaN, infinities and
+ *   -0.0, ie. x*1, 1*x, x/1, x-0, x+(-0), -0+x are x, x*-1, -1*x, x/-1 are -x,
+ *   and -(-x) is x. Not x+0 (-0+0 is +0), nor x*0 (NaN*0 is NaN), nor x-x
+ * - Only numbers without a type suffix are folded, or used for identities,
+ *   which are same for every type (see types.hpp)
+ * - Hash-consing: identical subtrees not containing a call become one node,
+ *   so 'a*a + a*a' has one 'a*a'. Calls are kept apart, since the callee may
+ *   be an extern with side effects, and so are loops, assignments, and
+ *   reads of a variable that's assigned to (its value depends on where it's
+ *   read)
+ * - A nested block of one expression is just that expression
+ *
+ * Nothing that could report an error (unknown variable or function) is
+ * dropped, so errors are the same as without it, only a failing operand's
+ * parent may not repeat the error
+ *
+ * Result is still in post-order, but a node can now be a child of more than
+ * one node (a DAG), codegen reuses the value of such a node wherever the
+ * first one is still in scope. Nodes no longer used are removed
+ */
+void optimise(FlatFunction &f);
+
+// Value of callee(args...) if it's known at compile time
+using CallFolder = llvm::function_ref<std::optional<double>(
+    Symbol callee, llvm::ArrayRef<double> args)>;
+
+/**
+ * Same, and also a call with all arguments numbers (after folding them)
+ * becomes a number, if 'fold_call' gives its value. Only for functions
+ * without types (see is_untyped()), the number has no suffix
+ */
+void optimise(FlatFunction &f, CallFolder fold_call);
+
+// Remove nodes not reachable from the body, keeping the rest in post-order
+void remove_unused(FlatFunction &f);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+// Optimisation levels of -O, same meaning as clang's
+enum class OptLevel { O0, O1, O2, O3, Os, Oz };
+
+// Level for what comes after -O, ie. "0".."3", "s" or "z"
+std::optional<OptLevel> parse_opt_level(const std::string &name);
+
+struct PipelineOptions {
+    OptLevel level = OptLevel::O0;
+    bool print_pipeline = false; // passes run, in 'opt -passes=' syntax
+    bool print_stats = false;    // size of each function before and after
+
+    // Target the code is for, so passes use its costs, nullptr if unknown
+    llvm::TargetMachine *target_machine = nullptr;
+
+    // Versions of each function for newer CPUs, see multiversion.hpp, needs
+    // the target machine
+    bool multiversion = false;
+};
+
+/**
+ * Optimise whole 'module' with LLVM's default pipeline for the level (same
+ * one as clang, built by the new pass manager's PassBuilder), printing the
+ * pipeline and statistics to stderr if asked
+ *
+ * At -O0 with nothing to print, the module is left as it is
+ */
+void run_pipeline(llvm::Module &module, const PipelineOptions &options);
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "flat_ast.hpp"
+#include "symbols.hpp"
+#include <cstdint>
+#include <iosfwd>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/IR/Function.h>
+
+/**
+ * Integer promotion of functions without types (all f64, see is_untyped()):
+ * a function computing with whole numbers, like counters and 'n-1', gets an
+ * internal copy "<name>.int" taking such parameters as i64, in which the
+ * operations proven to stay whole are done on i64s, for eg.
+ *
+ *     fn virhanka(n) if n < 1 then 1 else n*virhanka(n-1)
+ *
+ * compares and decrements 'n' as an i64 in "virhanka.int", and calls itself
+ * directly, while 'n*virhanka(n-1)' is still a double multiplication, as its
+ * range isn't known. The function itself stays as it is, and calls the copy
+ * when its arguments are whole numbers within PARAMETER_LIMIT (see
+ * guard_promotion()), so results are exactly (bit for bit) the same as
+ * computing with doubles
+ *
+ * Each node's range of values is found from the parameters' range, the
+ * literals, and the conditions of 'if's (for eg. n >= 1 in the 'else' of
+ * 'if n < 1'). A node is computed as an i64 only if its operands are, and
+ * all its values are whole numbers within 2^53, which doubles represent
+ * exactly, and never -0 (for eg. 0 * -1), which an i64 can't be, so no
+ * division, and no negation or multiplication that could give 0 with a
+ * negative operand. A call to a promoted function (itself, or one promoted
+ * before) with such arguments goes to its copy, and has its range of results
+ * (found by iterating, for a recursive one)
+ *
+ * Parameters gaining nothing from being i64 stay f64. A function with a loop
+ * or an assignment isn't promoted, nor one gaining less than the guard costs:
+ * at least half its operations must be done as i64s, and either its copy
+ * calls itself (so the guard is only passed once for all the recursion), or
+ * it does GUARD_OPERATIONS of them for each i64 parameter
+ */
+class IntegerPromoter {
+  public:
+    // Range of whole numbers the copy's i64 parameters take
+    static constexpr int64_t PARAMETER_LIMIT = int64_t(1) << 31;
+
+    // About what guard_promotion() costs for each i64 parameter, in
+    // operations done as i64s instead of doubles
+    static constexpr size_t GUARD_OPERATIONS = 4;
+
+    // What's known about a promoted function, for calls to it
+    struct Summary {
+        Symbol copy = Symbol::EMPTY; // Symbol::EMPTY if not promoted
+        bool recursive = false;      // if the copy calls itself
+        std::vector<ValueType> parameter_types; // of the copy, I64 or F64
+        std::optional<std::pair<int64_t, int64_t>> result; // if it's an i64
+        size_t integer_operations = 0, operations = 0;
+    };
+
+    // Copy of a function, to be codegen-ed with 'types' (see codegen())
+    struct Promotion {
+        FlatFunction copy;
+        std::vector<ValueType> types; // I64 or F64, of each node
+        Summary summary;
+    };
+
+    /**
+     * Copy of 'f' (already compiled, with 'parameters' as names of its
+     * parameters) computing with i64s, or nullopt if there's nothing to gain.
+     * Calls to it are promoted once it's codegen-ed, see promoted()
+     */
+    std::optional<Promotion> promote(const FlatFunction &f,
+                                     llvm::ArrayRef<Symbol> parameters);
+
+    // The copy from promote(f) was codegen-ed, so calls can go to it
+    void promoted(const FlatFunction &f, const Promotion &promotion);
+
+    // Each function promoted, with the type of its parameters and result,
+    // and those left as they are, as too few operations would be i64s
+    void report(std::ostream &out) const;
+
+  private:
+    // Worth the guard in front of the copy, see GUARD_OPERATIONS
+    static bool is_profitable(const Summary &summary);
+
+    std::vector<Summary> summaries; // by Symbol of the function
+    std::vector<Symbol> order;      // functions promoted or not, for report()
+};
+
+/**
+ * Make 'func' call 'integer' (its copy from IntegerPromoter::promote()) when
+ * the arguments for the i64 parameters of 'integer' are whole numbers within
+ * IntegerPromoter::PARAMETER_LIMIT (and not -0), converting the result back
+ * to a double, else run its own body
+ */
+void guard_promotion(llvm::Function &func, llvm::Function &integer);
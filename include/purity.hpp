@@ -0,0 +1,26 @@
+#pragma once
+
+#include <llvm/IR/Module.h>
+
+/**
+ * Marks functions of 'module' with what's known about them, so LLVM (and an
+ * LTO build of a caller) can hoist, CSE and vectorize calls to them:
+ *
+ * - memory(none), ie. 'readnone' before LLVM 16: doesn't touch memory, true
+ *   for a saras function unless it (maybe indirectly) calls an extern
+ * - nounwind: can't throw, same condition, since an extern may be C++
+ * - willreturn: always returns, if it's also not recursive (directly or
+ *   through other functions) and has no loops, so termination is certain
+ * - speculatable: all of the above, and no instruction can be undefined
+ *   behaviour for any arguments (llvm::isSafeToSpeculativelyExecute()), so
+ *   a call can even be moved out of the branch guarding it. Dividing doubles
+ *   by 0 just gives inf/NaN. An i64 division by a non-constant has its
+ *   divisor checked first, but LLVM can't tell that 'sdiv' is then safe,
+ *   so such a function isn't speculatable
+ *
+ * Functions are visited callees first (SCCs of the call graph in post-order),
+ * a function in a cycle getting only what its whole SCC has. A declaration
+ * (an extern not defined in this module) is known only by the attributes it
+ * already has, for eg. intrinsics
+ */
+void infer_function_attributes(llvm::Module &module);
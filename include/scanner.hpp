@@ -0,0 +1,38 @@
+#pragma once
+
+/**
+ * Byte-range kernels used by the lexer to classify many bytes at once
+ *
+ * Each function takes [begin, end) and returns the first position where its
+ * class of bytes ends (or 'end'). On x86 these are SSE2 or AVX2 kernels
+ * handling 16 or 32 bytes per step (chosen at runtime, based on the CPU), else
+ * a scalar fallback
+ *
+ * Character classes are same as what the lexer had when classifying each
+ * utf8::_char, ie. ::isspace(), ::isalnum() etc. in "C" locale, and any byte of
+ * a multi-byte utf-8 character counting as a letter
+ */
+namespace scanner {
+
+// ' ', '\t', '\n', '\v', '\f', '\r'
+const char *skip_whitespace(const char *begin, const char *end);
+
+// Till (excluding) '\n' or '\r', ie. rest of a '#' comment
+const char *skip_comment(const char *begin, const char *end);
+
+// [A-Z|a-z|0-9|_] or non-ascii
+const char *scan_identifier(const char *begin, const char *end);
+
+// [0-9|_], ie. digits of a number, with '_' as digit separator
+const char *scan_digits(const char *begin, const char *end);
+
+/**
+ * @returns First byte of an invalid (or truncated) utf-8 sequence, or 'end' if
+ * whole range is valid utf-8
+ *
+ * @ref https://en.wikipedia.org/wiki/UTF-8#Encoding (Table 3-7 of Unicode
+ * standard for the well-formed byte sequences)
+ */
+const char *validate_utf8(const char *begin, const char *end);
+
+} // namespace scanner
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+/**
+ * Contiguous, read-only bytes of the source code being lexed
+ *
+ * Regular files (including a file redirected to stdin, eg. "saras -l < x") are
+ * mmap-ed, so the lexer walks the page cache directly, without any copy.
+ *
+ * Anything else (pipes, terminals) is read in large blocks into an owned
+ * buffer, that grows on refill() as the lexer catches up with it. On a
+ * terminal read() returns after each line, so the interactive prompt keeps
+ * working.
+ *
+ * @note: Remember positions as offsets, NOT pointers, since refill() may
+ * reallocate the owned buffer
+ */
+class SourceBuffer {
+    void *map_base = nullptr; // non-null if mmap-ed
+    size_t map_length = 0;
+    const char *mapped = nullptr; // start of source inside the mapping
+    std::string owned;            // used when the source can't be mapped
+    size_t length = 0;
+    int fd = -1;     // only kept open while refill() can read more
+    bool eof = true; // true, once refill() can't read anything more
+
+    explicit SourceBuffer(int fd);
+
+  public:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    static SourceBuffer from_file(const std::string &filename);
+    static SourceBuffer from_fd(int fd); // for eg. STDIN_FILENO
+    static SourceBuffer from_string(std::string source);
+
+    // Non-owning view of bytes owned by someone else, who must keep them alive
+    // (and unchanged) for as long as this buffer is used
+    static SourceBuffer from_view(const char *data, size_t length);
+
+    SourceBuffer() = default;
+    SourceBuffer(SourceBuffer &&other) noexcept;
+    SourceBuffer &operator=(SourceBuffer &&other) noexcept;
+    SourceBuffer(const SourceBuffer &) = delete;
+    SourceBuffer &operator=(const SourceBuffer &) = delete;
+    ~SourceBuffer();
+
+    const char *data() const { return mapped ? mapped : owned.data(); }
+    size_t size() const { return length; }
+
+    std::string_view view(size_t offset, size_t len) const {
+        return std::string_view(data() + offset, len);
+    }
+
+    /**
+     * Read the next block, if source is a stream
+     *
+     * @returns false if nothing more could be read, ie. EOF */
+    bool refill();
+
+    // Read till EOF, so that whole source is in memory
+    void read_all() {
+        while (refill())
+            ;
+    }
+};
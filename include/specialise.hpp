@@ -0,0 +1,80 @@
+#pragma once
+
+#include "flat_ast.hpp"
+#include "optimise.hpp"
+#include "symbols.hpp"
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+
+/**
+ * Specialisation of functions on constant arguments: a call like foo(a, 4)
+ * becomes a call to a copy of foo, with the constant put in place of its
+ * parameter, and then optimised (see optimise.hpp), for eg.
+ *
+ *     fn foo(a, b) a*b + b*b      ->  fn foo.0(a) a*4 + 16
+ *
+ * Each combination of callee and constant arguments is copied once, and
+ * calls with the same constants (from any function, or the copy itself when
+ * it's recursive) share it
+ *
+ * Only saras functions already compiled (see define()) are copied, never
+ * externs, and only those without types (see is_untyped()), nor for a
+ * constant passed to a parameter that's assigned to. Total size of the
+ * copies (in nodes) is limited by 'budget', and a function gets at most
+ * MAX_COPIES copies, so a recursion with a changing constant (for eg.
+ * f(x, n+1) in f) doesn't take the whole budget. A call is left as it is
+ * once there's no space for a copy of its callee
+ */
+class Specialiser {
+  public:
+    static constexpr size_t DEFAULT_BUDGET = 4096;
+    static constexpr size_t MAX_COPIES = 16;
+
+    explicit Specialiser(size_t budget = DEFAULT_BUDGET) : budget(budget) {}
+
+    // Allow copies of 'f', with 'parameters' as names of its parameters
+    // (the ones codegen used for it)
+    void define(const FlatFunction &f, llvm::ArrayRef<Symbol> parameters);
+
+    /**
+     * Point the calls in 'f' having any constant argument to specialised
+     * copies, the new copies are appended to 'copies' (with calls in them
+     * specialised too), and must be codegen-ed before 'f'. 'fold_call' is
+     * used when optimising the copies
+     */
+    void specialise_calls(FlatFunction &f, std::vector<FlatFunction> &copies,
+                          CallFolder fold_call = {});
+
+    // For each function copied, its copies, and the constants of each
+    void report(std::ostream &out) const;
+
+  private:
+    // An argument of a call, the bits of the double if it's a constant
+    using Pattern = std::vector<std::optional<uint64_t>>;
+
+    struct Copy {
+        Symbol name;
+        Pattern pattern;
+        size_t original_size, size; // in nodes
+    };
+
+    std::vector<FlatFunction> definitions; // by Symbol, is_extern() if none
+    std::map<std::pair<Symbol, Pattern>, Symbol> copy_of;
+    std::map<Symbol, std::vector<Copy>> copies_by_function;
+    size_t budget;
+
+    // Copy for the call 'n' of 'f', or nullopt to leave it as it is
+    std::optional<Symbol> specialise(const FlatFunction &f, NodeIndex n,
+                                     std::vector<FlatFunction> &copies,
+                                     CallFolder fold_call);
+
+    // @returns true if any call was changed
+    bool rewrite_calls(FlatFunction &f, std::vector<FlatFunction> &copies,
+                       CallFolder fold_call);
+};
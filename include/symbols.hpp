@@ -0,0 +1,81 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Dense id of an interned name (eg. an identifier), same name always gets same
+ * id, so names can be compared, and used as index into flat tables, without
+ * hashing or comparing the string again
+ */
+enum class Symbol : uint32_t {
+    EMPTY = 0, // "", for eg. name of anonymous functions
+};
+
+inline uint32_t index(Symbol s) { return static_cast<uint32_t>(s); }
+
+/**
+ * Interns names into Symbols, ids are handed out in order 0, 1, 2..., so
+ * size() is also the size needed for a table indexed by Symbol
+ *
+ * Safe to use from multiple threads (for eg. lexers of parallel chunks): names
+ * are spread over shards by their hash, each with its own lock, so threads
+ * only wait for each other when interning in the same shard at same time.
+ * Names are kept in fixed size blocks that never move, so name() doesn't need
+ * any lock
+ */
+class SymbolTable {
+    static constexpr size_t NUM_SHARDS = 16;
+    static constexpr size_t BLOCK_BITS = 16; // 65536 names per block
+    static constexpr size_t BLOCK_SIZE = size_t(1) << BLOCK_BITS;
+    static constexpr size_t MAX_BLOCKS = size_t(1) << (32 - BLOCK_BITS);
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string_view, Symbol> ids;
+        std::deque<std::string> storage; // owns the names, never moved
+    };
+
+    std::array<Shard, NUM_SHARDS> shards;
+    std::array<std::atomic<std::string_view *>, MAX_BLOCKS> names{};
+    std::atomic<uint32_t> next_id{0};
+
+    void set_name(Symbol s, std::string_view name);
+
+  public:
+    SymbolTable();
+    ~SymbolTable();
+
+    SymbolTable(const SymbolTable &) = delete;
+    SymbolTable &operator=(const SymbolTable &) = delete;
+
+    Symbol intern(std::string_view name);
+
+    // Name of a symbol returned by intern()
+    std::string_view name(Symbol s) const {
+        return names[index(s) >> BLOCK_BITS][index(s) & (BLOCK_SIZE - 1)];
+    }
+
+    // Number of symbols interned yet
+    size_t size() const { return next_id.load(std::memory_order_acquire); }
+};
+
+extern SymbolTable Symbols;
+
+/**
+ * @returns table[s], growing the table (with default values) to have space for
+ * all the symbols interned yet, if needed
+ */
+template <class T> T &symbol_slot(std::vector<T> &table, Symbol s) {
+    if (index(s) >= table.size())
+        table.resize(Symbols.size());
+    return table[index(s)];
+}
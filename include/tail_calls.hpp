@@ -0,0 +1,57 @@
+#pragma once
+
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+
+#include <llvm/ADT/MapVector.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+
+/**
+ * Tail calls, so recursion doesn't use up the stack:
+ *
+ * - A function calling itself in a tail position, ie. returning the call's
+ *   value as it is, jumps back to its start instead, with the arguments as
+ *   its parameters (phis in a "tailrecurse" block), so it's a loop
+ * - Same for a call with a + or * around it, like 'n*virhanka(n-1)', keeping
+ *   the product (or sum) of the other operands in an accumulator, which is
+ *   multiplied with the value returned at the end. This computes in another
+ *   order, so it's done for i64s, but for doubles only if the function can
+ *   be reassociated ([fast], or --ffast-math), since it can round otherwise
+ * - Once all functions are codegen-ed, internal ones (specialised and i64
+ *   copies) called only directly use the 'fastcc' calling convention, and
+ *   other calls in a tail position are marked 'musttail', so they're always
+ *   jumps, for eg. in mutually recursive functions, if the callee has same
+ *   types and calling convention, or 'tail' (a hint) if not
+ */
+class TailCalls {
+  public:
+    /**
+     * Turn calls of 'func' to itself in tail positions into jumps, just
+     * after its codegen (and before guard_promotion(), if it's promoted)
+     *
+     * @returns true if it's changed
+     */
+    bool eliminate_recursion(llvm::Function &func);
+
+    // fastcc and musttail, as above, in all functions of 'module'
+    void mark_tail_calls(llvm::Module &module);
+
+    // What was done to each function
+    void report(std::ostream &out) const;
+
+  private:
+    struct Summary {
+        size_t loops = 0;         // calls to itself now jumps
+        unsigned accumulator = 0; // its opcode, if some had + or * around
+        size_t kept = 0;          // calls to itself left, being on f64s
+        size_t must_tail = 0, tail = 0;
+        bool fastcc = false;
+    };
+
+    // By name, in order of being done, as functions can be removed later
+    llvm::MapVector<std::string, Summary,
+                    std::unordered_map<std::string, unsigned>>
+        summaries;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed set of worker threads, that run the iterations of a parallel_for
+ *
+ * The calling thread also works on the loop, so ThreadPool(1) runs everything
+ * on the calling thread, without any worker
+ */
+class ThreadPool {
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable work_ready, work_done;
+
+    // Current loop, workers pick next index from 'next' till it reaches 'n'
+    const std::function<void(size_t)> *body = nullptr;
+    size_t n = 0;
+    std::atomic<size_t> next{0};
+    size_t busy = 0;        // workers still in current loop
+    size_t generation = 0;  // incremented for each loop, to wake workers
+    bool stopping = false;
+    std::exception_ptr error;
+
+    void worker_loop();
+    void run_iterations();
+
+  public:
+    // 0 threads means one per hardware thread
+    explicit ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Number of threads working on a loop, including the caller
+    unsigned size() const { return workers.size() + 1; }
+
+    /**
+     * Run fn(i) for every i in [0, n), returns once all are done
+     *
+     * If any iteration throws, remaining iterations are skipped, and the
+     * (first) exception is rethrown here
+     */
+    void parallel_for(size_t n, const std::function<void(size_t)> &fn);
+};
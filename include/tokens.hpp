@@ -1,37 +1,80 @@
 #pragma once
 
+#include "keywords.hpp"
+#include "symbols.hpp"
 #include "utf8.hpp"
+#include <cstdint>
+#include <type_traits>
 #include <variant>
 
 // https://stackoverflow.com/a/64018031/12339402
 /* Instead of enums, using Rust like enums (with std::variant, and visitors) */
 
-struct TOK_EOF {};
+/**
+ * Location of a token in the source buffer, tokens don't own any text, eg. an
+ * identifier's name is the source bytes [offset, offset + length)
+ */
+struct SourceSpan {
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    uint32_t line = 0;   // starting from 1
+    uint32_t column = 0; // starting from 1, in utf-8 characters (not bytes)
+};
+
+struct TOK_EOF {
+    SourceSpan span;
+};
 
-struct TOK_FN {};
-struct TOK_EXTERN {};
+struct TOK_FN {
+    SourceSpan span;
+};
+struct TOK_EXTERN {
+    SourceSpan span;
+};
 
 struct TOK_IDENTIFIER {
-    utf8::string identifier_str;
+    Symbol name; // interned while lexing
+    SourceSpan span;
 };
 struct TOK_KEYWORDS {
-    utf8::string str;
+    Keyword kind;
+    SourceSpan span;
 };
 struct TOK_NUMBER {
     double val;
+    SourceSpan span;
 };
 struct TOK_OTHER {
-    utf8::_char c;
+    char c; // always ascii, any non-ascii character is part of an identifier
+    SourceSpan span;
 };
 
 using Token = std::variant<TOK_EOF, TOK_FN, TOK_EXTERN, TOK_IDENTIFIER,
                            TOK_KEYWORDS, TOK_NUMBER, TOK_OTHER>;
 
+// Tokens are copied around a lot (for eg. the parser's lookahead), keep them
+// plain bytes
+static_assert(std::is_trivially_copyable_v<Token>);
+static_assert(sizeof(Token) <= 32);
+
+inline SourceSpan get_span(const Token &t) {
+    return std::visit([](const auto &tok) { return tok.span; }, t);
+}
+
 /* Allows easy comparisons with say for eg. ')' */
-inline bool operator==(const Token& t, utf8::_char c) {
+inline bool operator==(const Token& t, char c) {
     return std::holds_alternative<TOK_OTHER>(t) && (std::get<TOK_OTHER>(t).c == c);
 }
 
-inline bool operator!=(const Token& t, utf8::_char c) {
+inline bool operator!=(const Token& t, char c) {
     return !(t == c);
 }
+
+/* Check for a keyword in any language, for eg. t == Keyword::IF */
+inline bool operator==(const Token& t, Keyword k) {
+    return std::holds_alternative<TOK_KEYWORDS>(t) && (std::get<TOK_KEYWORDS>(t).kind == k);
+}
+
+inline bool operator!=(const Token& t, Keyword k) {
+    return !(t == k);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "flat_ast.hpp"
+#include "symbols.hpp"
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Type.h>
+
+/**
+ * Types of values are i64, f32 and f64 (see ValueType), as annotated on
+ * parameters, returns and literals, for eg.
+ *
+ *     fn virhanka(n: i64): i64 if n < 1 then 1 else n*virhanka(n-1)
+ *
+ * - A parameter or return without annotation is f64, so code without any
+ *   annotation is all f64, same as before there were types
+ * - A literal without suffix, and an operator on only such literals (for eg.
+ *   "1/2"), is computed as f64, then converted to the type of what it's used
+ *   with, ie. the other operand, the parameter it's passed to, or the return.
+ *   It must be a whole number, and written as one (2, not 2.0 or 2e0), to be
+ *   an i64, so "n / 2.0" with n an i64 is an error, not an integer division
+ * - Operands of different types are converted to the wider one, i64 to f32
+ *   to f64 (same as C), and a comparison is 1 or 0 of that type
+ * - A local variable (see read_before_assignment()) is of the type of the
+ *   first value assigned to it, f64 for a literal without suffix, and like
+ *   a parameter, later values are converted to it
+ * - Only these widening conversions are implicit, passing, assigning or
+ *   returning a value where a narrower type is expected is an error.
+ *   i64(x), f32(x) and f64(x) convert explicitly, to i64 rounding towards
+ *   zero, saturating at its limits (NaN is 0)
+ * - i64 arithmetic wraps, and division is never UB: by 0 it's INT64_MAX,
+ *   INT64_MIN (by the sign, as i64(inf) would be) or 0 for 0/0, and
+ *   INT64_MIN / -1 is INT64_MIN, same as -INT64_MIN
+ */
+
+// Type named 'name', ie. "i64", "f32" or "f64"
+std::optional<ValueType> type_named(std::string_view name);
+
+// "i64", "f32" or "f64" (ValueType::ANY is f64)
+const char *type_name(ValueType type);
+
+// The wider of 'a' and 'b', ValueType::ANY is narrower than all
+ValueType join(ValueType a, ValueType b);
+
+llvm::Type *llvm_type(ValueType type, llvm::LLVMContext &context);
+
+// ValueType of an llvm_type(), ValueType::F64 for any other type
+ValueType value_type(const llvm::Type *type);
+
+// Declaration of a function (to know its types), nullptr if it isn't known
+using FunctionLookup = llvm::function_ref<llvm::Function *(Symbol)>;
+
+/**
+ * Check the types in 'f', to be compiled as 'func', whose parameters are
+ * named 'parameter_names' (see the @bug in codegen_function)
+ *
+ * Unknown variables and functions are left to codegen to report, as f64
+ *
+ * @returns the type each node of 'f' is computed in (never ValueType::ANY),
+ * or nullopt after reporting a type error
+ */
+std::optional<std::vector<ValueType>>
+infer_types(const FlatFunction &f, const llvm::Function &func,
+            llvm::ArrayRef<Symbol> parameter_names, FunctionLookup lookup);
+
+/**
+ * Nothing in 'f' is annotated or converted, nor calls a function returning
+ * anything but f64, ie. every value in it is f64. Only such functions are
+ * evaluated at compile time or specialised (see evaluate.hpp), since those
+ * compute with doubles
+ */
+bool is_untyped(const FlatFunction &f, FunctionLookup lookup);
@@ -49,59 +49,6 @@ inline bool isdigit(const _char &c) {
 
 inline bool is_eof(const _char &c) { return holds_alternative<monostate>(c); }
 
-/**
- * @ref There are some implicit properties of the bytes that can let us
- * know if it is ascii or more digits of some utf-8 character follow
- * https://en.wikipedia.org/wiki/UTF-8#Encoding
- * read utf-8 character from stdin
- * static, else it WILL cause multiple definitions linker error (even with
- * #pragma once)
- */
-static _char get_character(std::istream &in = std::cin) {
-    in >> std::noskipws;
-
-    uint8_t t;
-    in >> t;
-
-    if (in.eof()) {
-        return monostate{};
-    }
-
-    if ((t & (1 << 7)) == 0) { /* See table on wikipedia, for 1 byte utf-8
-                                  (ascii), the 8th bit is unset */
-        return (char)t;
-    } else if ((t & (1 << 5)) == 0) {
-        /* 2 byte character */
-
-        array<uint8_t, 2> c;
-        c[0] = t;
-        in >> c[1];
-
-        return c;
-
-    } else if ((t & (1 << 4)) == 0) {
-        /* 3 byte character */
-
-        array<uint8_t, 3> c;
-        c[0] = t;
-        in >> c[1];
-        in >> c[2];
-
-        return c;
-
-    } else {
-        /* 4 byte character */
-
-        array<uint8_t, 4> c;
-        c[0] = t;
-        in >> c[1];
-        in >> c[2];
-        in >> c[3];
-
-        return c;
-    }
-}
-
 static std::string to_string(utf8::_char c);
 } // namespace utf8
 
@@ -1,155 +1,248 @@
 #pragma once
 
-#include "ast.hpp"
+#include "flat_ast.hpp"
+#include "symbols.hpp"
+#include "types.hpp"
 #include "utf8.hpp"
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <vector>
+
+/**
+ * Writes an expression, numbering nodes in pre-order
+ *
+ * Pending nodes are kept on an explicit stack, each with the number of its
+ * children done (step). Each visit_* writes the part of its node due at
+ * 'step', and returns the next child to write, or NO_NODE once the node is
+ * done, so depth of the expression is only limited by memory
+ */
+class AstDotWriter : public FlatVisitor<AstDotWriter, NodeIndex> {
+  public:
+    struct Pending {
+        NodeIndex node;
+        size_t step = 0;
+        int id = 0;     // of the node
+        int parent = 0; // BLOCK: id of the current "Expr[i]"
+    };
+
+  private:
+    int &max_idx;
+    std::ofstream &fout;
+
+  public:
+    AstDotWriter(int &max_idx, std::ofstream &fout)
+        : max_idx(max_idx), fout(fout) {}
+
+    void write(const FlatFunction &f, NodeIndex root) {
+        std::vector<Pending> stack = {{root}};
+
+        while (!stack.empty()) {
+            auto &top = stack.back();
+            auto n = top.node;
+            auto step = top.step++;
+
+            if (step == 0 && !(f.kinds[n] == NodeKind::BLOCK &&
+                               f.children_of(n).size() == 1)) {
+                top.id = ++max_idx;
+            }
+
+            auto next = visit(f, n, top, step);
+            if (next != NO_NODE)
+                stack.push_back({next});
+            else
+                stack.pop_back();
+        }
+    }
 
-template <typename ExprPtrType> bool is_same_ptr(ExprAST *e) {
-    return dynamic_cast<ExprPtrType>(e);
-}
-
-static void recursive_ast(ExprAST *e, int &max_idx, std::ofstream &fout) {
-    ++max_idx;
+    NodeIndex visit_binary(const FlatFunction &f, NodeIndex n, Pending &top,
+                           size_t step) {
+        if (step == 0) {
+            fout << "idx" + std::to_string(max_idx) << ";\n";
+            fout << "idx" + std::to_string(max_idx) << "[label=\""
+                 << f.opr(n) << "\"] ;\n";
+        }
+        if (step < 2) {
+            fout << "idx" + std::to_string(top.id) << " -- "
+                 << "idx" + std::to_string(max_idx + 1) << ";\n";
+            return f.children_of(n)[step];
+        }
+        return NO_NODE;
+    }
 
-    if (is_same_ptr<BinaryExprAST *>(e)) {
-        auto b = dynamic_cast<BinaryExprAST *>(e);
+    NodeIndex visit_unary(const FlatFunction &f, NodeIndex n, Pending &,
+                          size_t step) {
+        if (step != 0)
+            return NO_NODE;
 
         fout << "idx" + std::to_string(max_idx) << ";\n";
-        fout << "idx" + std::to_string(max_idx) << "[label=\""
-             << utf8::to_string(b->opr) << "\"] ;\n";
+        fout << "idx" + std::to_string(max_idx) << "[label=\"" << f.opr(n)
+             << "\"] ;\n";
         fout << "idx" + std::to_string(max_idx) << " -- "
              << "idx" + std::to_string(max_idx + 1) << ";\n";
+        return f.children_of(n)[0];
+    }
 
-        auto curr_id = max_idx;
-        recursive_ast(b->lhs.get(), max_idx, fout);
-        fout << "idx" + std::to_string(curr_id) << " -- "
-             << "idx" + std::to_string(max_idx + 1) << ";\n";
-        recursive_ast(b->rhs.get(), max_idx, fout);
-    } else if (is_same_ptr<NumberAST *>(e)) {
-        auto n = dynamic_cast<NumberAST *>(e);
-
+    NodeIndex visit_number(const FlatFunction &f, NodeIndex n, Pending &,
+                           size_t) {
         fout << "idx" + std::to_string(max_idx) << ";\n";
         fout << "idx" + std::to_string(max_idx) << "[label=\""
-             << std::to_string(n->value) << "\"] ;\n";
-
-    } else if (is_same_ptr<VariableAST *>(e)) {
-        auto v = dynamic_cast<VariableAST *>(e);
-
-        fout << "idx" + std::to_string(max_idx) << ";\n";
-        fout << "idx" + std::to_string(max_idx) << "[label=\"" << v->var_name
+             << std::to_string(f.number(n))
+             << (f.number_type(n) == ValueType::ANY
+                     ? ""
+                     : type_name(f.number_type(n)))
              << "\"] ;\n";
+        return NO_NODE;
+    }
 
-    } else if (is_same_ptr<BlockAST *>(e)) {
-        auto b = dynamic_cast<BlockAST *>(e);
-
-        if (b->expressions.size() == 1) {
-            max_idx--; // to negate effect of ++ in next call, since i want it
-                       // to have current max_id
-            return recursive_ast(b->expressions.back().get(), max_idx, fout);
-        }
-
+    NodeIndex visit_variable(const FlatFunction &f, NodeIndex n, Pending &,
+                             size_t) {
         fout << "idx" + std::to_string(max_idx) << ";\n";
         fout << "idx" + std::to_string(max_idx) << "[label=\""
-             << "Block"
-             << "\"] ;\n";
+             << Symbols.name(f.symbol(n)) << "\"] ;\n";
+        return NO_NODE;
+    }
 
-        fout << "idx" + std::to_string(max_idx) << " -- idx"
-             << std::to_string(max_idx + 1) << ";\n";
-        for (auto i = 0; i < b->expressions.size(); ++i) {
-            ++max_idx;
+    NodeIndex visit_block(const FlatFunction &f, NodeIndex n, Pending &top,
+                          size_t step) {
+        auto children = f.children_of(n);
 
-            auto &expr = b->expressions[i];
+        // Block of one expression is shown as just the expression
+        if (children.size() == 1)
+            return step == 0 ? children[0] : NO_NODE;
 
+        if (step == 0) {
             fout << "idx" + std::to_string(max_idx) << ";\n";
-            fout << "idx" + std::to_string(max_idx) << "[label=\"Expr["
-                 << std::to_string(i) << "]\"] ;\n";
+            fout << "idx" + std::to_string(max_idx) << "[label=\""
+                 << "Block"
+                 << "\"] ;\n";
 
-            auto parent = max_idx;
             fout << "idx" + std::to_string(max_idx) << " -- idx"
                  << std::to_string(max_idx + 1) << ";\n";
-            recursive_ast(expr.get(), max_idx, fout);
-
-            // Dont create a connection for last node, since it doesn't have any
-            // next to connect to
-            if (i < b->expressions.size() - 1)
-                fout << "idx" + std::to_string(parent) << " -- idx"
-                     << std::to_string(max_idx + 1) << ";\n";
+        } else if (step < children.size()) {
+            // Dont create a connection for last node, since it doesn't
+            // have any next to connect to
+            fout << "idx" + std::to_string(top.parent) << " -- idx"
+                 << std::to_string(max_idx + 1) << ";\n";
         }
 
         ++max_idx;
-    } else if (is_same_ptr<FunctionCallAST *>(e)) {
-        auto f = dynamic_cast<FunctionCallAST *>(e);
-        fout << "idx" + std::to_string(max_idx) << ";\n";
-        fout << "idx" + std::to_string(max_idx) << "[label=\""
-             << "FunctionCall: " << f->callee << "\"] ;\n";
+        if (step == children.size())
+            return NO_NODE;
 
-        auto parent_node = max_idx;
-        for (auto &arg : f->args) {
-            recursive_ast(arg.get(), max_idx, fout);
-            fout << "idx" + std::to_string(max_idx) << " -- idx"
-                 << std::to_string(parent_node) << ";\n";
-        }
-    } else if (is_same_ptr<FunctionPrototypeAST *>(e)) {
-        auto f = dynamic_cast<FunctionPrototypeAST *>(e);
         fout << "idx" + std::to_string(max_idx) << ";\n";
-        fout << "idx" + std::to_string(max_idx) << "[label=\""
-             << "Prototype: " << f->function_name << "\"] ;\n";
+        fout << "idx" + std::to_string(max_idx) << "[label=\"Expr["
+             << std::to_string(step) << "]\"] ;\n";
+
+        top.parent = max_idx;
+        fout << "idx" + std::to_string(max_idx) << " -- idx"
+             << std::to_string(max_idx + 1) << ";\n";
+        return children[step];
+    }
 
-        auto parent_node = max_idx;
-        for (auto &arg : f->parameter_names) {
-            ++max_idx;
+    NodeIndex visit_call(const FlatFunction &f, NodeIndex n, Pending &top,
+                         size_t step) {
+        auto args = f.children_of(n);
+        if (step == 0) {
             fout << "idx" + std::to_string(max_idx) << ";\n";
-            fout << "idx" + std::to_string(max_idx) << "[label=\"" << arg
+            fout << "idx" + std::to_string(max_idx) << "[label=\""
+                 << "FunctionCall: " << Symbols.name(f.symbol(n))
                  << "\"] ;\n";
+        } else {
             fout << "idx" + std::to_string(max_idx) << " -- idx"
-                 << std::to_string(parent_node) << ";\n";
+                 << std::to_string(top.id) << ";\n";
         }
 
-    } else if (is_same_ptr<FunctionAST *>(e)) {
-        auto f = dynamic_cast<FunctionAST *>(e);
+        return step < args.size() ? args[step] : NO_NODE;
+    }
 
-        fout << "idx" + std::to_string(max_idx) << ";\n";
-        fout << "idx" + std::to_string(max_idx) << "[label=\""
-             << f->prototype->function_name << "\"] ;\n";
-        fout << "idx" + std::to_string(max_idx) << " -- "
-             << "idx" + std::to_string(max_idx + 1) << ";\n";
-
-        auto parent_node = max_idx;
-        recursive_ast(f->prototype.get(), max_idx, fout);
-        fout << "idx" + std::to_string(parent_node) << " -- "
-             << "idx" + std::to_string(max_idx + 1) << ";\n";
-        recursive_ast(f->block.get(), max_idx, fout);
-    } else if (is_same_ptr<IfExprAST *>(e)) {
-        auto f = dynamic_cast<IfExprAST *>(e);
+    NodeIndex visit_assign(const FlatFunction &f, NodeIndex n, Pending &,
+                           size_t step) {
+        if (step != 0)
+            return NO_NODE;
 
         fout << "idx" + std::to_string(max_idx) << ";\n";
         fout << "idx" + std::to_string(max_idx) << "[label=\""
-             << "If"
-             << "\"] ;\n";
+             << Symbols.name(f.symbol(n)) << " =\"] ;\n";
         fout << "idx" + std::to_string(max_idx) << " -- "
              << "idx" + std::to_string(max_idx + 1) << ";\n";
+        return f.children_of(n)[0];
+    }
+
+    NodeIndex visit_while(const FlatFunction &f, NodeIndex n, Pending &top,
+                          size_t step) {
+        if (step == 0) {
+            fout << "idx" + std::to_string(max_idx) << ";\n";
+            fout << "idx" + std::to_string(max_idx) << "[label=\""
+                 << "While"
+                 << "\"] ;\n";
+        }
+        if (step < 2) {
+            fout << "idx" + std::to_string(top.id) << " -- "
+                 << "idx" + std::to_string(max_idx + 1) << ";\n";
+            return f.children_of(n)[step];
+        }
+        return NO_NODE;
+    }
 
-        auto parent_node = max_idx;
+    NodeIndex visit_if(const FlatFunction &f, NodeIndex n, Pending &top,
+                       size_t step) {
+        if (step == 0) {
+            fout << "idx" + std::to_string(max_idx) << ";\n";
+            fout << "idx" + std::to_string(max_idx) << "[label=\""
+                 << "If"
+                 << "\"] ;\n";
+        }
+        if (step < 3) {
+            fout << "idx" + std::to_string(top.id) << " -- "
+                 << "idx" + std::to_string(max_idx + 1) << ";\n";
+            return f.children_of(n)[step];
+        }
+        return NO_NODE;
+    }
+};
 
-        recursive_ast(f->condition.get(), max_idx, fout);
+static void prototype_ast(const FlatFunction &f, int &max_idx,
+                          std::ofstream &fout) {
+    ++max_idx;
 
-        fout << "idx" + std::to_string(parent_node) << " -- "
-             << "idx" + std::to_string(max_idx + 1) << ";\n";
-        recursive_ast(f->then_.get(), max_idx, fout);
+    fout << "idx" + std::to_string(max_idx) << ";\n";
+    fout << "idx" + std::to_string(max_idx) << "[label=\""
+         << "Prototype: " << Symbols.name(f.name) << "\"] ;\n";
 
-        fout << "idx" + std::to_string(parent_node) << " -- "
-             << "idx" + std::to_string(max_idx + 1) << ";\n";
-        recursive_ast(f->else_.get(), max_idx, fout);
-    } else {
+    auto parent_node = max_idx;
+    for (auto arg : f.parameters) {
+        ++max_idx;
         fout << "idx" + std::to_string(max_idx) << ";\n";
-        fout << "idx" + std::to_string(max_idx) << "[label=\"ExprAST\"] ;\n";
+        fout << "idx" + std::to_string(max_idx) << "[label=\""
+             << Symbols.name(arg) << "\"] ;\n";
+        fout << "idx" + std::to_string(max_idx) << " -- idx"
+             << std::to_string(parent_node) << ";\n";
     }
 }
 
-static void visualise_ast(ExprAST *root) {
+static void function_ast(const FlatFunction &f, int &max_idx,
+                         std::ofstream &fout) {
+    if (f.is_extern())
+        return prototype_ast(f, max_idx, fout);
+
+    ++max_idx;
+
+    fout << "idx" + std::to_string(max_idx) << ";\n";
+    fout << "idx" + std::to_string(max_idx) << "[label=\""
+         << Symbols.name(f.name) << "\"] ;\n";
+    fout << "idx" + std::to_string(max_idx) << " -- "
+         << "idx" + std::to_string(max_idx + 1) << ";\n";
+
+    auto parent_node = max_idx;
+    prototype_ast(f, max_idx, fout);
+    fout << "idx" + std::to_string(parent_node) << " -- "
+         << "idx" + std::to_string(max_idx + 1) << ";\n";
+    AstDotWriter(max_idx, fout).write(f, f.body);
+}
+
+static void visualise_ast(const FlatFunction *root) {
     static int i = 0;
     if (!root)
         return;
@@ -161,7 +254,7 @@ static void visualise_ast(ExprAST *root) {
     fout << "graph \"\" {\n"
          << "label=\"" << i - 1 << ": Abstract Syntax Tree\"";
 
-    recursive_ast(root, max_idx, fout);
+    function_ast(*root, max_idx, fout);
 
     fout << "}";
 
@@ -0,0 +1,71 @@
+#!/bin/sh
+# Times the front end (lexer, parser, codegen to IR) on deeply nested inputs,
+# doubling the depth each time, so non-linear time (or a crash from running
+# out of stack) shows up as a jump between rows
+#
+# Usage: programs/stress.sh [path/to/saras] [max depth]
+
+SARAS=$(realpath "${1:-saras}" 2>/dev/null || command -v saras)
+MAX_DEPTH=${2:-200000}
+
+if [ ! -x "$SARAS" ]; then
+    echo "saras executable not found, pass its path as first argument" >&2
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# Graph of each item is rendered by graphviz, which would be most of the time
+# measured, so a 'dot' that does nothing is put first in PATH
+printf '#!/bin/sh\nexit 0\n' > "$WORK/dot"
+chmod +x "$WORK/dot"
+PATH="$WORK:$PATH"
+cd "$WORK" || exit 1 # graph*.dot files are written to current directory
+
+# generate <kind> <depth>
+generate() {
+    awk -v kind="$1" -v n="$2" 'BEGIN {
+        if (kind == "paren") {
+            printf "fn p(x) "
+            for (i = 0; i < n; ++i) printf "("
+            printf "x"
+            for (i = 0; i < n; ++i) printf "+1)"
+        } else if (kind == "unary") {
+            printf "fn u(x) "
+            for (i = 0; i < n; ++i) printf "-"
+            printf "x"
+        } else if (kind == "call") {
+            printf "fn id(x) x\nfn c(x) "
+            for (i = 0; i < n; ++i) printf "id("
+            printf "x"
+            for (i = 0; i < n; ++i) printf ")"
+        } else if (kind == "if") {
+            printf "fn i(x) "
+            for (i = 0; i < n; ++i) printf "if x then 1 else "
+            printf "x"
+        }
+        printf "\n"
+    }'
+}
+
+now_ms() {
+    echo $(($(date +%s%N) / 1000000))
+}
+
+printf '%-6s %8s %10s %6s\n' kind depth time exit
+for kind in paren unary call if; do
+    depth=1000
+    while [ "$depth" -le "$MAX_DEPTH" ]; do
+        generate "$kind" "$depth" > input.saras
+
+        start=$(now_ms)
+        "$SARAS" --no-print-ir < input.saras > /dev/null 2>&1
+        status=$?
+        end=$(now_ms)
+
+        printf '%-6s %8d %8dms %6d\n' "$kind" "$depth" $((end - start)) \
+            "$status"
+        depth=$((depth * 2))
+    done
+done
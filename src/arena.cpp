@@ -0,0 +1,34 @@
+#include "arena.hpp"
+
+#include <algorithm>
+
+void *Arena::allocate_slow(size_t size, size_t align) {
+    auto needed = size + align - 1;
+
+    // Move to next block (kept from before a reset()) that fits, else add one
+    size_t next = blocks.empty() || ptr == 0 ? current : current + 1;
+    while (next < blocks.size() && blocks[next].size < needed)
+        ++next;
+
+    if (next == blocks.size()) {
+        auto block_size =
+            blocks.empty()
+                ? FIRST_BLOCK_SIZE
+                : std::min(blocks.back().size * 2, MAX_BLOCK_SIZE);
+        block_size = std::max(block_size, needed);
+        blocks.push_back(
+            {std::unique_ptr<std::byte[]>(new std::byte[block_size]),
+             block_size});
+    }
+
+    current = next;
+    ptr = reinterpret_cast<uintptr_t>(blocks[current].data.get());
+    end = ptr + blocks[current].size;
+
+    return allocate(size, align);
+}
+
+void Arena::reset() {
+    current = 0;
+    ptr = end = 0;
+}
@@ -2,44 +2,63 @@
 #include "assert.hpp"
 #include "rang.hpp"
 #include "tokens.hpp"
+#include "types.hpp"
 #include "utf8.hpp"
 #include "util.hpp"
 
 #include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <variant>
 #include <vector>
 
 #include <llvm/ADT/APFloat.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Dominators.h>
 #include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
 #include <llvm/IR/InstrTypes.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/Value.h>
 #include <llvm/IR/Verifier.h>
+#include <llvm/Transforms/Utils/PromoteMemToReg.h>
 
 using llvm::BasicBlock;
-using std::holds_alternative, std::make_unique;
-
-extern Token CurrentToken;
+using std::holds_alternative;
 
 Ptr<llvm::LLVMContext> LContext;
 Ptr<llvm::IRBuilder<>> LBuilder;
 Ptr<llvm::Module> LModule;
 
 // NamedValues keeps tracks of variables defined in the current scope, and maps
-// to their llvm representation
-static std::map<utf8::string, llvm::Value *> NamedValues;
+// to their llvm representation, indexed by Symbol of the variable's name
+static std::vector<llvm::Value *> NamedValues;
+
+// Functions declared (or defined) in LModule, indexed by Symbol of their name,
+// along with parameter names of the declaration, used by the definition too
+struct FunctionEntry {
+    llvm::Function *func = nullptr;
+    vector<Symbol> parameter_names;
+};
+static std::vector<FunctionEntry> Functions;
+
+// FPMode of functions without an annotation
+static FPMode DefaultFPMode = FPMode::STRICT;
 
 /**
  * Interesting aspects of the LLVM's approach (not 'eating the last token'
@@ -50,409 +69,739 @@ static std::map<utf8::string, llvm::Value *> NamedValues;
  * part of the grammar production, ready to go Fairly a standard way to
  * implement recursive descent parsers
  *
- * Look Ahead: having the next token (by calling get_next_token), but still
+ * Look Ahead: having the next token (by calling lexer.advance()), but still
  * processing/working on the current token, then that next token is the
  * lookahead. For eg. currently read "factorial", then store this token/name
- * in a variable/string, then call get_next_token(), we get either '=' or
+ * in a variable/string, then call lexer.advance(), we get either '=' or
  * '(', that is the lookahead, now we can decide better, how to parse it,
  * for eg. in first case it is normal variable name, in second case it is
  * 'likely' a function call
  */
 
-/** @expects: CurrentToken is TOK_NUMBER
+/** @expects: lexer.current() is TOK_NUMBER
  *
  * @matches:
  * numexpr
  *   => any constant number
+ *   => any constant number, directly followed by a type, eg. 1i64
  */
-Ptr<NumberAST> parseNumberExpr() {
-    debug_assert<__LINE__>(holds_alternative<TOK_NUMBER>(CurrentToken));
-
-    auto expr = make_unique<NumberAST>(std::get<TOK_NUMBER>(CurrentToken).val);
-
-    CurrentToken = get_next_token();
+NumberAST *parseNumberExpr(Lexer &lexer, Arena &arena) {
+    debug_assert<__LINE__>(lexer, holds_alternative<TOK_NUMBER>(lexer.current()));
+
+    auto number = std::get<TOK_NUMBER>(lexer.current());
+
+    // For eg. 2.0 or 1e3, in hex the exponent is after a 'p', 'e' is a digit
+    auto text = lexer.text(lexer.current());
+    bool hex = text.size() > 1 && (text[1] == 'x' || text[1] == 'X');
+    bool fraction = text.find_first_of(hex ? ".pP" : ".eE") != text.npos;
+    lexer.advance();
+
+    // The lexer allows only a type suffix as an identifier right after a
+    // number, without any space
+    auto type = ValueType::ANY;
+    if (holds_alternative<TOK_IDENTIFIER>(lexer.current()) &&
+        get_span(lexer.current()).offset ==
+            number.span.offset + number.span.length) {
+        if (auto suffix = type_named(lexer.text(lexer.current())))
+            type = *suffix;
+        lexer.advance();
+    }
 
-    return expr;
+    return arena.make<NumberAST>(number.val, type,
+                                 fraction && type == ValueType::ANY);
 }
 
-/** @expects: CurrentToken is TOK_IDENTIFIER
+namespace {
+/**
+ * Parser for expressions (and blocks), which has the recursive part of the
+ * grammar, ie. parentheses, operands, arguments and if/then/else
  *
  * @matches:
- * idexpr
+ * expr
+ *   => unaryexpr (binary_operator unaryexpr)*
+ * unaryexpr
+ *   => unary_operator unaryexpr (binary_operator unaryexpr)*
+ *   => primary
+ * primary
+ *   => number
  *   => identifier
- *   => func( exp1, exp2,... )
+ *   => identifier ( expr, expr, ... )
+ *   => identifier = expr
+ *   => ( expr )
+ *   => if expr then block else block
+ *   => while expr block
+ *   => for identifier = expr, expr (, expr)? block
+ * block
+ *   => { expr; expr; ... }
+ *   => expr
+ *
+ * "for i = start, condition, step body" is "i = start" followed by
+ * "while condition { body; i = i + step }", the step being 1 if not given
+ *
+ * It doesn't recurse though, a rule that needs a sub-expression pushes a
+ * Frame, and continues once the sub-expression is parsed. So nesting depth
+ * is only limited by memory, not by the native stack
+ *
+ * Binary operators are parsed by precedence climbing (Pratt parser): a
+ * BINARY frame keeps folding "lhs op rhs" into lhs while the operator binds
+ * at least as tight as its min_precedence. The rhs gets its own frame only
+ * to take operators binding tighter than 'op' (or same, for right
+ * associative ones), so a chain of same precedence operators is a loop, and
+ * each token is looked at once, ie. linear time. A unary operator's operand
+ * only takes the binary operators binding tighter than it, so "-a*b" is
+ * "(-a)*b"
  */
-Ptr<ExprAST> parseIdentifierAndCalls() {
-    debug_assert<__LINE__>(holds_alternative<TOK_IDENTIFIER>(CurrentToken));
-
-    auto identifier = CurrentToken;
-
-    // MUST update CurrentToken, since if it's not '(', then next function calls
-    // expect the next tokens, in the other case (=='('), it will basically be
-    // eaten/forgotten
-    CurrentToken = get_next_token(); /* Since while working on identifier, we
-                                        asked for next token, AND ALSO
-                                        using/comparing it, that is lookahead*/
-    if (CurrentToken /*lookahead*/ != '(')
-        return make_unique<VariableAST>(
-            std::get<TOK_IDENTIFIER>(identifier).identifier_str);
-
-    CurrentToken = get_next_token(); // eats '(' (eat means to 'forget'
-                                     // about the last token)
-    std::vector<Ptr<ExprAST>> args;
-
-    while (CurrentToken != ')') {
-        args.push_back(parseExpression());
-
-        // the above call will have moved the lexer to next token, so
-        // CurrentToken is likely ','
-        if (CurrentToken == ')')
-            break;
+class ExpressionParser {
+    struct Frame {
+        enum Rule : uint8_t {
+            BINARY,
+            PAREN,
+            CALL,
+            IF,
+            BLOCK,
+            ASSIGN,
+            WHILE,
+            FOR
+        } rule;
+        uint8_t step = 0; // IF, WHILE, FOR: parts done, BLOCK: 1 if in { }
+
+        char opr = 0;   // BINARY: operator waiting for its rhs
+        char unary = 0; // BINARY: unary operator applied to the result
+        int min_precedence = 0;
+
+        ExprAST *lhs = nullptr;    // BINARY: lhs, IF, WHILE: condition
+        BlockAST *then_ = nullptr; // IF
+
+        // CALL: the callee, ASSIGN, FOR: the variable
+        Symbol name = Symbol::EMPTY;
+
+        // Size of 'items' when it was pushed, so for CALL, BLOCK, FOR, their
+        // expressions parsed till now are items[first..]
+        size_t first = 0;
+    };
 
-        if (CurrentToken != ',') {
-            return LogError("Expected ',' in argument list\n\t\tProbably you "
-                            "typed something like: \"func(a b\" and "
-                            "forgot the ',' between a and b ?");
-        } else {
-            // eat ','
-            CurrentToken = get_next_token();
-        }
+    // What to do next, parse a sub-expression (or block) for the top frame,
+    // or give it the 'result' of one that is done
+    enum class Next { EXPRESSION, BLOCK, RESULT };
+
+    Lexer &lexer;
+    Arena &arena;
+    llvm::SmallVector<Frame, 16> frames;
+    llvm::SmallVector<ExprAST *, 16> items;
+    ExprAST *result = nullptr;
+
+    Next start_expression();
+    Next start_unary();
+    Next start_primary();
+    Next start_block();
+    Next start_for();
+
+    Next resume_binary();
+    Next resume_paren();
+    Next next_argument();
+    Next resume_if();
+    Next next_in_block();
+    Next resume_block();
+    Next resume_assign();
+    Next resume_while();
+    Next resume_for();
+
+    Next done(ExprAST *expr) {
+        result = expr;
+        return Next::RESULT;
     }
 
-    CurrentToken = get_next_token(); // eat ')', ie. forget it
+    void push(Frame frame) {
+        frame.first = items.size();
+        frames.push_back(frame);
+    }
 
-    return make_unique<FunctionCallAST>(
-        std::get<TOK_IDENTIFIER>(identifier).identifier_str, std::move(args));
-}
+    // Pop top frame (and its items), with 'expr' as its result
+    Next pop(ExprAST *expr) {
+        items.resize(frames.back().first);
+        frames.pop_back();
+        return done(expr);
+    }
+
+  public:
+    ExpressionParser(Lexer &lexer, Arena &arena)
+        : lexer(lexer), arena(arena) {}
+
+    ExprAST *parse(Next next) {
+        while (true) {
+            switch (next) {
+            case Next::EXPRESSION:
+                next = start_expression();
+                break;
+            case Next::BLOCK:
+                next = start_block();
+                break;
+            case Next::RESULT:
+                if (frames.empty())
+                    return result;
+
+                switch (frames.back().rule) {
+                case Frame::BINARY:
+                    next = resume_binary();
+                    break;
+                case Frame::PAREN:
+                    next = resume_paren();
+                    break;
+                case Frame::CALL:
+                    items.push_back(result);
+                    next = next_argument();
+                    break;
+                case Frame::IF:
+                    next = resume_if();
+                    break;
+                case Frame::BLOCK:
+                    next = resume_block();
+                    break;
+                case Frame::ASSIGN:
+                    next = resume_assign();
+                    break;
+                case Frame::WHILE:
+                    next = resume_while();
+                    break;
+                case Frame::FOR:
+                    next = resume_for();
+                    break;
+                }
+            }
+        }
+    }
+
+    ExprAST *expression() { return parse(Next::EXPRESSION); }
+    BlockAST *block() { return static_cast<BlockAST *>(parse(Next::BLOCK)); }
+};
 
 /**
- * @expects: CurrentToken is '('
- *
- * @matches:
- * parenexp
- *   => ( expr )
+ * @expects: lexer.current() is Primary Token(TOK_IDENTIFIER or TOK_NUMBER or
+ * '(') or a unary operator, ie. an expression can be parsed
  */
-Ptr<ExprAST> parseParenExpr() {
-    debug_assert<__LINE__>(CurrentToken == '(');
+ExpressionParser::Next ExpressionParser::start_expression() {
+    push({Frame::BINARY});
+    return start_unary();
+}
 
-    CurrentToken = get_next_token();
+ExpressionParser::Next ExpressionParser::start_unary() {
+    while (holds_alternative<TOK_OTHER>(lexer.current())) {
+        auto opr = std::get<TOK_OTHER>(lexer.current()).c;
+        auto &info = operator_info(opr);
+        if (!info.is_unary())
+            break;
 
-    auto expr = parseExpression();
+        lexer.advance(); // eat unary operator
 
-    // Right now, CurrentToken should be at ')'
-    if (CurrentToken != ')') {
-        return LogError(
-            "Expected a matching ')'\n\t\tProbably you wrote something like "
-            "\"(x+(y+2)\" and forgot a matching closing parenthesis");
+        Frame operand = {Frame::BINARY};
+        operand.unary = opr;
+        operand.min_precedence = info.unary_precedence;
+        push(operand);
     }
 
-    CurrentToken = get_next_token(); // 'eat' the ')'
-    return expr;
+    return start_primary();
 }
 
 /**
- * @expects: CurrentToken is TOK_IDENTIFIER, TOK_KEYWORDS, TOK_NUMBER or '('
+ * @expects: lexer.current() is TOK_IDENTIFIER, TOK_KEYWORDS, TOK_NUMBER or '('
  */
-Ptr<ExprAST> parsePrimaryExpression() {
-    debug_assert<__LINE__>(CurrentToken == '(' ||
-                           holds_alternative<TOK_IDENTIFIER>(CurrentToken) ||
-                           holds_alternative<TOK_NUMBER>(CurrentToken) ||
-                           holds_alternative<TOK_KEYWORDS>(CurrentToken));
-
-    if (CurrentToken == ';')
-        return nullptr; // ignore ';'
-
-    if (CurrentToken == '(') {
-        return parseParenExpr();
-    } else if (holds_alternative<TOK_NUMBER>(CurrentToken)) {
-        return parseNumberExpr();
-    } else if (holds_alternative<TOK_IDENTIFIER>(CurrentToken)) {
-        return parseIdentifierAndCalls();
-    } else if (holds_alternative<TOK_KEYWORDS>(CurrentToken)) {
-        auto &keyword = std::get<TOK_KEYWORDS>(CurrentToken).str;
-
-        if (keyword == "if" || keyword == "यदि" || keyword == "ఉంటే") {
-            return parseIfExpr();
+ExpressionParser::Next ExpressionParser::start_primary() {
+    debug_assert<__LINE__>(lexer, lexer.current() == '(' ||
+                           holds_alternative<TOK_IDENTIFIER>(lexer.current()) ||
+                           holds_alternative<TOK_NUMBER>(lexer.current()) ||
+                           holds_alternative<TOK_KEYWORDS>(lexer.current()));
+
+    if (lexer.current() == ';')
+        return done(nullptr); // ignore ';'
+
+    if (lexer.current() == '(') {
+        lexer.advance(); // eat '('
+        push({Frame::PAREN});
+        return Next::EXPRESSION;
+    } else if (holds_alternative<TOK_NUMBER>(lexer.current())) {
+        return done(parseNumberExpr(lexer, arena));
+    } else if (holds_alternative<TOK_IDENTIFIER>(lexer.current())) {
+        auto name = std::get<TOK_IDENTIFIER>(lexer.current()).name;
+
+        // lookahead, if it's not '(' or '=', then it's a variable
+        lexer.advance();
+        if (lexer.current() == '=') {
+            lexer.advance(); // eat '='
+
+            Frame assign = {Frame::ASSIGN};
+            assign.name = name;
+            push(assign);
+            return Next::EXPRESSION;
         }
+        if (lexer.current() != '(')
+            return done(arena.make<VariableAST>(name));
+
+        lexer.advance(); // eat '('
+
+        Frame call = {Frame::CALL};
+        call.name = name;
+        push(call);
+        return next_argument();
+    } else if (lexer.current() == Keyword::IF) {
+        lexer.advance(); // eat 'if' token
+
+        // condition can be with or without parenthesis
+        push({Frame::IF});
+        return Next::EXPRESSION;
+    } else if (lexer.current() == Keyword::WHILE) {
+        lexer.advance(); // eat 'while' token
+
+        push({Frame::WHILE});
+        return Next::EXPRESSION;
+    } else if (lexer.current() == Keyword::FOR) {
+        return start_for();
     }
-    return LogError("Wrong token passed that can't be handled by "
-                    "parsePrimaryExpression()");
+    return done(LogError("Wrong token passed that can't be handled by "
+                         "parsePrimaryExpression(lexer)"));
 }
 
 /**
- * @expects: CurrentToken is Primary Token(TOK_IDENTIFIER or TOK_NUMBER or '(')
- *           ie. an expression can be parsed
- *
- * @matches:
- * expr
- *   => expr
- *   => expr (binary_operator, expr)*
- **/
-Ptr<ExprAST> parseExpression() {
-    /* First try parsing a primary expression
-     * Then, we can simply pass it as LHS to ParseBinaryHelperFn, since it will
-     * simply return the LHS when the next token isn't found to be an operator*/
-    return parseBinaryHelperFn(parsePrimaryExpression(), 0);
-}
+ * @expects: lexer.current() == '{', or at start of an expression */
+ExpressionParser::Next ExpressionParser::start_block() {
+    Frame block = {Frame::BLOCK};
+
+    if (lexer.current() != '{') {
+        // Simply the next expression
+        push(block);
+        return Next::EXPRESSION;
+    }
 
-int GetPrecedence(utf8::_char c) {
-    auto p = OPERATOR_PRECENDENCE_TABLE.find(c);
-    if (p == OPERATOR_PRECENDENCE_TABLE.cend())
-        return -1;
-    return p->second;
+    lexer.advance(); // eat '{'
+    block.step = 1;
+    push(block);
+    return next_in_block();
 }
 
 /**
- * @expects: Called by parseExpression()
- *
- * @returns Returns computed expression as LHS once a token has precendence of
- * < min_precedence
- *
- * @note: Only 'a' is also acceptable (the 'binaryexpr => expr' case)
- **/
-Ptr<ExprAST> parseBinaryHelperFn(Ptr<ExprAST> lhs, int min_precedence) {
-    auto lookahead = CurrentToken; // should be operator
-
-    // Operators exist ONLY when CurrentToken is TOK_OTHER
-    // return LHS itself, if current token isn't an operator
-    if (!holds_alternative<TOK_OTHER>(lookahead)) {
-        // if CurrentToken isn't an operator, then return lhs
-        // the 'binaryexpr => expr' case
-        return lhs;
-    }
-    if (!lhs) {
-        return lhs;
-    }
-
-    auto binary_opr = std::get<TOK_OTHER>(CurrentToken).c; // = lookahead
-    while (GetPrecedence(binary_opr) >= min_precedence) {
-        // At the end of this while loop, we do a parseBinaryHelperFn, which
-        // advances to next token, which maybe EOF etc., so break (this
-        // condition may have also been added to the above while loop)
-        if (!holds_alternative<TOK_OTHER>(CurrentToken))
-            break;
+ * @expects: lexer.current() is Keyword::FOR */
+ExpressionParser::Next ExpressionParser::start_for() {
+    lexer.advance(); // eat 'for' token
+
+    auto expected = [&] {
+        return done(LogError("Expected \"for variable = start, condition, "
+                             "step\"\n\t\tFor eg. \"for i = 0, i < n, 1 "
+                             "{ ... }\""));
+    };
+    if (!holds_alternative<TOK_IDENTIFIER>(lexer.current()))
+        return expected();
+
+    Frame loop = {Frame::FOR};
+    loop.name = std::get<TOK_IDENTIFIER>(lexer.current()).name;
+
+    lexer.advance();
+    if (lexer.current() != '=')
+        return expected();
 
-        binary_opr = std::get<TOK_OTHER>(CurrentToken).c; // = lookahead
-        auto opr_precedence = GetPrecedence(binary_opr);
-
-        CurrentToken = get_next_token(); // eat binary operator
-        auto rhs = parsePrimaryExpression();
-
-        // parsePrimary reads the next token, so CurrentToken is updated
-        lookahead = CurrentToken;
-
-        // while (GetPrecedence(std::get<TOK_OTHER>(lookahead).c) >=
-        //        opr_precedence) {
-        //     rhs = parseBinaryHelperFn(std::move(rhs), opr_precedence + 1);
-        //     lookahead; parsePrimary reads the next token, so CurrentToken is
-        //     updated
-        // }
-        /* Why the additional check ? Because it may be ';', or EOF */
-        if (holds_alternative<TOK_OTHER>(lookahead) &&
-            GetPrecedence(std::get<TOK_OTHER>(lookahead).c) > opr_precedence) {
-            rhs = parseBinaryHelperFn(std::move(rhs), opr_precedence + 1);
-            // parsePrimary reads the next token, so CurrentToken is updated
-            lookahead = CurrentToken; // lookahead
+    lexer.advance(); // eat '='
+    push(loop);
+    return Next::EXPRESSION;
+}
+
+// 'result' is lhs, or rhs of the pending operator
+ExpressionParser::Next ExpressionParser::resume_binary() {
+    auto &frame = frames.back();
+    if (frame.opr) {
+        if (!result)
+            return pop(nullptr);
+
+        frame.lhs = arena.make<BinaryExprAST>(frame.lhs, frame.opr, result);
+        frame.opr = 0;
+    } else {
+        frame.lhs = result;
+    }
+
+    // Operators exist ONLY when lexer.current() is TOK_OTHER, lhs is done
+    // once current token isn't a binary operator, for eg. ';' or EOF
+    if (frame.lhs && holds_alternative<TOK_OTHER>(lexer.current())) {
+        auto binary_opr = std::get<TOK_OTHER>(lexer.current()).c;
+        auto &info = operator_info(binary_opr);
+        if (info.is_binary() && info.binary_precedence >= frame.min_precedence) {
+            lexer.advance(); // eat binary operator
+            frame.opr = binary_opr;
+
+            Frame rhs = {Frame::BINARY};
+            rhs.min_precedence = info.associativity == Associativity::LEFT
+                                     ? info.binary_precedence + 1
+                                     : info.binary_precedence;
+            push(rhs);
+            return start_unary();
         }
+    }
 
-        if (!rhs)
-            return nullptr;
+    auto lhs = frame.lhs;
+    auto unary = frame.unary;
+    frames.pop_back();
 
-        lhs = make_unique<BinaryExprAST>(std::move(lhs), binary_opr,
-                                         std::move(rhs));
-        if (holds_alternative<TOK_OTHER>(lookahead)) {
-            // modify binary_opr to current token's character value, else it
-            // will become an infinite loop
-            binary_opr = std::get<TOK_OTHER>(lookahead).c;
-        } else {
-            binary_opr = '\0';
+    if (!unary)
+        return done(lhs);
+    return done(lhs ? arena.make<UnaryExprAST>(unary, lhs) : nullptr);
+}
+
+ExpressionParser::Next ExpressionParser::resume_paren() {
+    frames.pop_back();
+
+    // Right now, lexer.current() should be at ')'
+    if (lexer.current() != ')') {
+        return done(LogError(
+            "Expected a matching ')'\n\t\tProbably you wrote something like "
+            "\"(x+(y+2)\" and forgot a matching closing parenthesis"));
+    }
+
+    lexer.advance(); // 'eat' the ')'
+    return Next::RESULT; // the expression within
+}
+
+// After '(' or an argument, the argument is already in 'items'
+ExpressionParser::Next ExpressionParser::next_argument() {
+    auto &call = frames.back();
+
+    if (items.size() > call.first) {
+        // the argument will have moved the lexer to next token, so
+        // lexer.current() is likely ','
+        if (lexer.current() != ')' && lexer.current() != ',') {
+            return pop(LogError("Expected ',' in argument list\n\t\tProbably "
+                                "you typed something like: \"func(a b\" and "
+                                "forgot the ',' between a and b ?"));
         }
+
+        if (lexer.current() == ',')
+            lexer.advance(); // eat ','
     }
 
-    return lhs;
+    if (lexer.current() != ')')
+        return Next::EXPRESSION;
+
+    lexer.advance(); // eat ')', ie. forget it
+
+    auto args = arena.copy<ExprAST *>(
+        llvm::ArrayRef<ExprAST *>(items).drop_front(call.first));
+    return pop(arena.make<FunctionCallAST>(call.name, args));
 }
 
-/**
- * @expects: CurrentToken == "if"
- **/
-Ptr<ExprAST> parseIfExpr() {
-    debug_assert<__LINE__>(holds_alternative<TOK_KEYWORDS>(CurrentToken));
-
-    auto is_tok_if = []() {
-        return holds_alternative<TOK_KEYWORDS>(CurrentToken) &&
-               (std::get<TOK_KEYWORDS>(CurrentToken).str == "if" ||
-                std::get<TOK_KEYWORDS>(CurrentToken).str == "यदि" ||
-                std::get<TOK_KEYWORDS>(CurrentToken).str == "ఉంటే");
-    };
-    auto is_tok_then = []() {
-        return holds_alternative<TOK_KEYWORDS>(CurrentToken) &&
-               (std::get<TOK_KEYWORDS>(CurrentToken).str == "then" ||
-                std::get<TOK_KEYWORDS>(CurrentToken).str == "तब" ||
-                std::get<TOK_KEYWORDS>(CurrentToken).str == "అప్పుడు");
-    };
-    auto is_tok_else = []() {
-        return holds_alternative<TOK_KEYWORDS>(CurrentToken) &&
-               (std::get<TOK_KEYWORDS>(CurrentToken).str == "else" ||
-                std::get<TOK_KEYWORDS>(CurrentToken).str == "अथवा" ||
-                std::get<TOK_KEYWORDS>(CurrentToken).str == "లేకపోతే");
-    };
+ExpressionParser::Next ExpressionParser::resume_if() {
+    auto &frame = frames.back();
+
+    switch (frame.step++) {
+    case 0:
+        if (!result)
+            return pop(nullptr);
+        frame.lhs = result;
+
+        if (lexer.current() != Keyword::THEN)
+            return pop(LogError("Expected \"then\" or equivalent keyword"));
 
-    if (!is_tok_if()) {
-        return LogError(
-            "Expected \"if\" (or equivalent keyword in hindi/telugu) expression");
+        lexer.advance(); // eat 'then'
+        return Next::BLOCK;
+
+    case 1:
+        frame.then_ = static_cast<BlockAST *>(result);
+
+        if (lexer.current() != Keyword::ELSE)
+            return pop(LogError("Expected \"else\" or equivalent keyword"));
+
+        lexer.advance(); // eat 'else'
+        return Next::BLOCK;
+
+    default:
+        if (!frame.then_ || !result)
+            return pop(nullptr);
+
+        return pop(arena.make<IfExprAST>(frame.lhs, frame.then_, result));
     }
+}
 
-    CurrentToken = get_next_token(); // eat 'if' token
+// Within { }, after '{' or an expression
+ExpressionParser::Next ExpressionParser::next_in_block() {
+    if (lexer.current() != '}')
+        return Next::EXPRESSION;
 
-    auto condition = parseExpression(); // can also parse with or without
-                                        // parenthesis (primary expr)
+    lexer.advance(); // eat '}'
 
-    if (!condition)
-        return nullptr;
+    // An empty block is 0, for eg. body of "while f(x) {}"
+    auto &block = frames.back();
+    if (items.size() == block.first)
+        items.push_back(arena.make<NumberAST>(0.0));
+
+    auto expressions = arena.copy<ExprAST *>(
+        llvm::ArrayRef<ExprAST *>(items).drop_front(block.first));
+    return pop(arena.make<BlockAST>(expressions));
+}
 
-    if (!is_tok_then())
-        return LogError("Expected \"then\" or equivalent keyword");
+ExpressionParser::Next ExpressionParser::resume_block() {
+    if (!result)
+        return pop(nullptr);
+
+    items.push_back(result);
+    if (frames.back().step == 0)
+        return pop(arena.make<BlockAST>(arena.copy<ExprAST *>(
+            llvm::ArrayRef<ExprAST *>(items).drop_front(frames.back().first))));
+
+    // ';' after the last expression is optional, so a nested block (for eg.
+    // body of a loop) can end with '}'
+    if (lexer.current() == ';')
+        lexer.advance(); // eat ';'
+    if (holds_alternative<TOK_EOF>(lexer.current())) {
+        LogErrorP("Expected closing '}' for code block\n\t\tProbably you "
+                  "missed a '}' corresponding to a previous '}");
+        return pop(nullptr);
+    }
 
-    CurrentToken = get_next_token(); // eat 'then'
+    return next_in_block();
+}
 
-    auto then_block = parseBlock();
+ExpressionParser::Next ExpressionParser::resume_assign() {
+    auto variable = frames.back().name;
+    frames.pop_back();
+    return done(result ? arena.make<AssignAST>(variable, result) : nullptr);
+}
 
-    if (!is_tok_else())
-        return LogError("Expected \"else\" or equivalent keyword");
+ExpressionParser::Next ExpressionParser::resume_while() {
+    auto &frame = frames.back();
+    if (!result)
+        return pop(nullptr);
 
-    CurrentToken = get_next_token(); // eat 'else'
+    if (frame.step++ == 0) {
+        frame.lhs = result;
+        return Next::BLOCK;
+    }
+    return pop(arena.make<WhileAST>(frame.lhs, result));
+}
 
-    auto else_block = parseBlock();
+// After start, condition, step and body, each is pushed on 'items'
+ExpressionParser::Next ExpressionParser::resume_for() {
+    auto &frame = frames.back();
+    if (!result)
+        return pop(nullptr);
+    items.push_back(result);
+
+    switch (frame.step++) {
+    case 0:
+        if (lexer.current() != ',')
+            return pop(LogError("Expected ',' after start of the 'for' loop"));
+        lexer.advance(); // eat ','
+        return Next::EXPRESSION;
+    case 1:
+        if (lexer.current() != ',') {
+            ++frame.step;
+            items.push_back(arena.make<NumberAST>(1.0));
+            return Next::BLOCK;
+        }
+        lexer.advance(); // eat ','
+        return Next::EXPRESSION;
+    case 2:
+        return Next::BLOCK;
+    }
 
-    if (!then_block || !else_block)
-        return nullptr;
+    auto parts = llvm::ArrayRef<ExprAST *>(items).drop_front(frame.first);
+    auto *start = parts[0], *condition = parts[1], *step = parts[2],
+         *body = parts[3];
+    auto *next = arena.make<AssignAST>(
+        frame.name,
+        arena.make<BinaryExprAST>(arena.make<VariableAST>(frame.name), '+',
+                                  step));
+
+    std::array<ExprAST *, 2> loop_body = {body, next};
+    std::array<ExprAST *, 2> loop = {
+        arena.make<AssignAST>(frame.name, start),
+        arena.make<WhileAST>(condition, arena.make<BlockAST>(
+                                            arena.copy<ExprAST *>(loop_body)))};
+    return pop(arena.make<BlockAST>(arena.copy<ExprAST *>(loop)));
+}
+} // namespace
 
-    return make_unique<IfExprAST>(std::move(condition), std::move(then_block),
-                                  std::move(else_block));
+ExprAST *parseExpression(Lexer &lexer, Arena &arena) {
+    return ExpressionParser(lexer, arena).expression();
+}
+
+BlockAST *parseBlock(Lexer &lexer, Arena &arena) {
+    return ExpressionParser(lexer, arena).block();
 }
 
 /**
- * @expects: CurrentToken is TOK_IDENTIFIER (ie. name of function)
+ * @expects: lexer.current() is ':'
+ *
+ * @matches:
+ *   type => ':' ('i64' | 'f32' | 'f64')
+ *
+ * @returns nullopt on error
+ */
+static std::optional<ValueType> parseType(Lexer &lexer) {
+    lexer.advance(); // eat ':'
+
+    std::optional<ValueType> type;
+    if (holds_alternative<TOK_IDENTIFIER>(lexer.current()))
+        type = type_named(lexer.text(lexer.current()));
+
+    if (!type) {
+        LogErrorP("Expected a type (i64, f32 or f64) after ':'\n\t\tFor eg. "
+                  "\"fn func(n: i64, x: f32): f64\"");
+        return std::nullopt;
+    }
+    lexer.advance();
+    return type;
+}
+
+/**
+ * @expects: lexer.current() is TOK_IDENTIFIER (ie. name of function)
  *
  * @matches:
  *   expr
- *     => id '(' id, id, ... ')'
+ *     => id '(' id type?, id type?, ... ')' type?
  **/
-Ptr<FunctionPrototypeAST> parsePrototypeExpr() {
-    debug_assert<__LINE__>(holds_alternative<TOK_IDENTIFIER>(CurrentToken));
+FunctionPrototypeAST *parsePrototypeExpr(Lexer &lexer, Arena &arena) {
+    debug_assert<__LINE__>(lexer, holds_alternative<TOK_IDENTIFIER>(lexer.current()));
 
-    auto function_name = CurrentToken;
+    auto function_name = lexer.current();
 
-    if (!holds_alternative<TOK_IDENTIFIER>(CurrentToken)) {
+    if (!holds_alternative<TOK_IDENTIFIER>(lexer.current())) {
         return LogErrorP("Expected function name in prototype");
     }
 
-    CurrentToken = get_next_token();
+    // i64(x) etc. are conversions, see types.hpp
+    if (type_named(lexer.text(function_name))) {
+        return LogErrorP(utf8::string(lexer.text(function_name)) +
+                         " is a type, it can't be name of a function");
+    }
+
+    lexer.advance();
 
-    if (CurrentToken != '(') {
+    if (lexer.current() != '(') {
         return LogErrorP(
             "Expected '(' after function name in prototype\n\t\tProbably you "
             "forgot '(' after func in \"fn func\" ?");
     }
 
-    CurrentToken = get_next_token(); // eat '('
+    lexer.advance(); // eat '('
+
+    llvm::SmallVector<Symbol, 8> arg_names;
+    llvm::SmallVector<ValueType, 8> arg_types;
 
-    std::vector<utf8::string> arg_names;
+    while (holds_alternative<TOK_IDENTIFIER>(lexer.current())) {
+        arg_names.push_back(std::get<TOK_IDENTIFIER>(lexer.current()).name);
 
-    while (holds_alternative<TOK_IDENTIFIER>(CurrentToken)) {
-        arg_names.push_back(
-            std::get<TOK_IDENTIFIER>(CurrentToken).identifier_str);
+        lexer.advance();
+
+        auto type = ValueType::ANY;
+        if (lexer.current() == ':') {
+            auto annotated = parseType(lexer);
+            if (!annotated)
+                return nullptr;
+            type = *annotated;
+        }
+        arg_types.push_back(type);
 
-        CurrentToken = get_next_token();
-        if (CurrentToken == ')')
+        if (lexer.current() == ')')
             break;
 
-        if (CurrentToken != ',') {
+        if (lexer.current() != ',') {
             return LogErrorP(
                 "Expected ',' or ')' in function arguments portion of the "
                 "prototype\n\t\tProbably you forgot a comma in between two "
                 "argument names, for eg, this will error: \"fn func(a b)\"");
         }
 
-        CurrentToken = get_next_token(); // eat ','
+        lexer.advance(); // eat ','
     }
 
-    CurrentToken = get_next_token(); // eat ')'
-    return make_unique<FunctionPrototypeAST>(
-        std::get<TOK_IDENTIFIER>(function_name).identifier_str, arg_names);
-}
+    lexer.advance(); // eat ')'
 
-/**
- * @expects: CurrentToken == '{', or at start of an expression */
-Ptr<BlockAST> parseBlock() {
-    std::vector<Ptr<ExprAST>> expressions;
-    if (CurrentToken == '{') {
-        CurrentToken = get_next_token(); // eat '{'
-
-        while (CurrentToken != '}') {
-            // TODO: Decide whether to eat ';' in parseExpression()
-            auto expr = parseExpression();
+    auto return_type = ValueType::ANY;
+    if (lexer.current() == ':') {
+        auto annotated = parseType(lexer);
+        if (!annotated)
+            return nullptr;
+        return_type = *annotated;
+    }
 
-            if (!expr) {
-                return nullptr;
-            }
-            expressions.push_back(std::move(expr));
+    return arena.make<FunctionPrototypeAST>(
+        std::get<TOK_IDENTIFIER>(function_name).name,
+        arena.copy<Symbol>(arg_names), arena.copy<ValueType>(arg_types),
+        return_type);
+}
 
-            CurrentToken = get_next_token();
-            if (holds_alternative<TOK_EOF>(CurrentToken)) {
-                LogErrorP(
-                    "Expected closing '}' for code block\n\t\tProbably you "
-                    "missed a '}' corresponding to a previous '}");
-                return nullptr;
-            } else if (CurrentToken == ';') {
-                CurrentToken = get_next_token(); // eat ';'
-            }
-        }
+/**
+ * @expects: lexer.current() is '['
+ *
+ * @matches:
+ *   annotation => '[' ('fast' | 'contract' | 'strict') ']'
+ *
+ * @returns FPMode::DEFAULT on error
+ */
+static FPMode parseAnnotation(Lexer &lexer) {
+    lexer.advance(); // eat '['
+
+    auto mode = FPMode::DEFAULT;
+    if (holds_alternative<TOK_IDENTIFIER>(lexer.current())) {
+        auto name = lexer.text(lexer.current());
+        if (name == "fast")
+            mode = FPMode::FAST;
+        else if (name == "contract")
+            mode = FPMode::CONTRACT;
+        else if (name == "strict")
+            mode = FPMode::STRICT;
+    }
 
-        CurrentToken = get_next_token(); // eat '}'
-    } else {
-        // Simply return the next expression
-        auto expr = parseExpression();
-        if (!expr)
-            return nullptr;
+    if (mode == FPMode::DEFAULT) {
+        LogErrorP("Expected 'fast', 'contract' or 'strict' in annotation, "
+                  "for eg. \"fn [fast] func(a)\"");
+        return mode;
+    }
+    lexer.advance();
 
-        expressions.push_back(std::move(expr));
+    if (lexer.current() != ']') {
+        LogErrorP("Expected ']' to end annotation, for eg. \"fn [fast] "
+                  "func(a)\"");
+        return FPMode::DEFAULT;
     }
-    return make_unique<BlockAST>(std::move(expressions));
+    lexer.advance(); // eat ']'
+    return mode;
 }
 
 /**
- * @expects: CurrentToken is TOK_FN, ie. holding the function's name
+ * @expects: lexer.current() is TOK_FN, ie. holding the function's name
  *
  * @matches:
- *   expr => 'fn' prototype expression
+ *   expr => 'fn' annotation? prototype expression
  *
  * @note - The expression field is the body, currently single expression
  */
-Ptr<FunctionAST> parseFunctionExpr() {
-    debug_assert<__LINE__>(holds_alternative<TOK_FN>(CurrentToken));
+FunctionAST *parseFunctionExpr(Lexer &lexer, Arena &arena) {
+    debug_assert<__LINE__>(lexer, holds_alternative<TOK_FN>(lexer.current()));
 
-    CurrentToken = get_next_token(); // eat 'fn' keyword
-    auto prototype = parsePrototypeExpr();
-    auto body = parseBlock();
+    lexer.advance(); // eat 'fn' keyword
+
+    auto fp_mode = FPMode::DEFAULT;
+    if (lexer.current() == '[') {
+        fp_mode = parseAnnotation(lexer);
+        if (fp_mode == FPMode::DEFAULT)
+            return nullptr;
+    }
+
+    auto prototype = parsePrototypeExpr(lexer, arena);
+    auto body = parseBlock(lexer, arena);
 
     if (!prototype || !body)
         return nullptr;
 
-    return make_unique<FunctionAST>(std::move(prototype), std::move(body));
+    return arena.make<FunctionAST>(prototype, body, fp_mode);
 }
 
 /**
- * @expects: CurrentToken is TOK_EXTERN
+ * @expects: lexer.current() is TOK_EXTERN
  *
  * @matches:
  *   expr => extern fn_prototype
  */
-Ptr<FunctionPrototypeAST> parseExternPrototypeExpr() {
-    debug_assert<__LINE__>(holds_alternative<TOK_EXTERN>(CurrentToken));
+FunctionPrototypeAST *parseExternPrototypeExpr(Lexer &lexer, Arena &arena) {
+    debug_assert<__LINE__>(lexer, holds_alternative<TOK_EXTERN>(lexer.current()));
 
-    CurrentToken = get_next_token(); // eat 'extern' keyword
-    return parsePrototypeExpr();
+    lexer.advance(); // eat 'extern' keyword
+    return parsePrototypeExpr(lexer, arena);
 }
 
 /**
@@ -471,250 +820,785 @@ Ptr<FunctionPrototypeAST> parseExternPrototypeExpr() {
  * @matches:
  * toplevelexpr => expression
  */
-Ptr<FunctionAST> parseTopLevelExpr() {
-    auto expr = parseBlock();
+FunctionAST *parseTopLevelExpr(Lexer &lexer, Arena &arena) {
+    auto expr = parseBlock(lexer, arena);
     if (!expr)
         return nullptr;
 
-    return make_unique<FunctionAST>(
-        make_unique<FunctionPrototypeAST>("", std::vector<utf8::string>()),
-        std::move(expr));
+    return arena.make<FunctionAST>(
+        arena.make<FunctionPrototypeAST>(Symbol::EMPTY, ArenaSpan<Symbol>()),
+        expr);
 }
 
-// codegen implementations
-llvm::Value *NumberAST::codegen() {
+// codegen implementations, they work on the flattened AST, for node 'n' of
+// function 'f'
+
+/**
+ * Codegen of a node having children is done in steps, and its children are
+ * codegen-ed in between, by run(), which keeps these frames on an explicit
+ * stack, instead of recursing
+ *
+ * Each step (the visit_* for the node's kind) gets the value of the child done
+ * before it (or nullptr for the first step), and returns next child to
+ * codegen, or NO_NODE once the node is done, with its value in 'value'
+ */
+namespace {
+struct CodegenFrame {
+    NodeIndex node;
+    uint32_t step = 0;
+
+    llvm::Value *saved = nullptr; // BINARY: lhs, IF: value of 'then'
+    llvm::BasicBlock *then_bb = nullptr, *else_bb = nullptr,
+                     *cont_bb = nullptr; // IF, WHILE: condition, -, after
+
+    // CALL: values of the arguments done till now are values[first_value..]
+    size_t first_value = 0;
+
+    // IF, WHILE: number of values known before its branches (or body), the
+    // ones known after that are forgotten when leaving a branch
+    size_t scope = SIZE_MAX;
+};
+
+// Value of the literal 'value' as an i64, if it's a whole number in range
+std::optional<int64_t> whole_number(double value) {
+    // -2^63 and 2^63 are exact doubles, and NaN fails the first check
+    if (std::trunc(value) != value || value < -0x1p63 || value >= 0x1p63)
+        return std::nullopt;
+    return static_cast<int64_t>(value);
+}
+
+llvm::Value *not_whole_number(double value) {
+    llvm::SmallString<16> text;
+    llvm::APFloat(value).toString(text);
+    return LogErrorV(std::string(text) +
+                     " isn't a whole number, so it can't be an i64");
+}
+
+/**
+ * 'value' as 'type', converting as infer_types() allows implicitly, ie. to a
+ * wider type, or a literal (folded to an f64 constant) to any type
+ *
+ * @returns nullptr, after reporting, if the literal isn't a whole number when
+ * an i64 is needed
+ */
+llvm::Value *convert(llvm::Value *value, llvm::Type *type) {
+    auto *from = value->getType();
+    if (from == type)
+        return value;
+    if (from->isIntegerTy())
+        return LBuilder->CreateSIToFP(value, type, "convtmp");
+    if (type->isFloatingPointTy())
+        return LBuilder->CreateFPCast(value, type, "convtmp");
+
+    auto *literal = llvm::dyn_cast<llvm::ConstantFP>(value);
+    auto number = literal ? literal->getValueAPF().convertToDouble() : NAN;
+    auto whole = whole_number(number);
+    if (!whole)
+        return not_whole_number(number);
+    return llvm::ConstantInt::get(type, *whole, /*isSigned*/ true);
+}
+
+// 'value' as 'type', for a conversion like i64(x)
+llvm::Value *convert_explicitly(llvm::Value *value, llvm::Type *type) {
+    if (!value->getType()->isFloatingPointTy() || !type->isIntegerTy())
+        return convert(value, type);
+
+    // Towards zero, saturating at the limits, and NaN is 0, unlike 'fptosi'
+    // which is poison for those
+    return LBuilder->CreateIntrinsic(llvm::Intrinsic::fptosi_sat,
+                                     {type, value->getType()}, {value},
+                                     nullptr, "convtmp");
+}
+
+/**
+ * 'value' as the i1 to branch on, ie. true if it isn't 0 ('fcmp one' for
+ * doubles, so NaN is false)
+ */
+llvm::Value *codegen_condition(llvm::Value *value) {
+    if (auto *cast = llvm::dyn_cast<llvm::CastInst>(value);
+        cast && cast->getSrcTy()->isIntegerTy(1)) {
+        // A comparison, branch on its result, instead of its 1 or 0 (the
+        // cast is erased later if unused, see erase_unused_condition_casts())
+        return cast->getOperand(0);
+    } else if (value->getType()->isIntegerTy()) {
+        return LBuilder->CreateICmpNE(
+            value, llvm::ConstantInt::get(value->getType(), 0), "if_condn");
+    }
+
+    // COME HERE
+    // "ONE" -> Ordered and not equal
+    // Create a (condition != 0.0) instruction, ie. true for not zero,
+    // ie. true for 1, ie. true for true ;D
+    return LBuilder->CreateFCmpONE(
+        /*lhs*/ value,
+        /*rhs*/ llvm::ConstantFP::get(value->getType(), 0.0), "if_condn");
+}
+
+/**
+ * Erase the 1 or 0 casts of comparisons that were only branched on (see
+ * codegen_condition()). Not done as the branch is made, since the cast is
+ * still the comparison's value if its node is shared (see optimise())
+ */
+void erase_unused_condition_casts(llvm::Function &func) {
+    llvm::SmallVector<llvm::Instruction *, 8> unused;
+    for (auto &inst : llvm::instructions(func)) {
+        if (auto *cast = llvm::dyn_cast<llvm::CastInst>(&inst);
+            cast && cast->getSrcTy()->isIntegerTy(1) && cast->use_empty())
+            unused.push_back(cast);
+    }
+    for (auto *cast : unused)
+        cast->eraseFromParent();
+}
+
+class ExprCodegen : public FlatVisitor<ExprCodegen, NodeIndex> {
+    llvm::SmallVector<CodegenFrame, 16> frames;
+    llvm::SmallVector<llvm::Value *, 16> values; // CALL: arguments
+
+    // Value of each node done, while the block it's in dominates the code
+    // being generated, so a node shared by many parents (see optimise()) is
+    // emitted once, instead of for each of them
+    std::vector<llvm::Value *> known;
+    std::vector<NodeIndex> known_order; // nodes having a known value
+
+    const std::vector<ValueType> &types; // of each node, see infer_types()
+
+    void forget_since(size_t count);
+
+    llvm::Type *type_of(NodeIndex n) const {
+        return llvm_type(types[n], *LContext);
+    }
+
+  public:
+    // For the expressions of 'f', values are shared among all of them
+    ExprCodegen(const FlatFunction &f, const std::vector<ValueType> &types)
+        : known(f.size()), types(types) {}
+
+    llvm::Value *run(const FlatFunction &f, NodeIndex root);
+
+    NodeIndex visit_number(const FlatFunction &f, NodeIndex n,
+                           CodegenFrame &frame, llvm::Value *child,
+                           llvm::Value *&value);
+    NodeIndex visit_variable(const FlatFunction &f, NodeIndex n,
+                             CodegenFrame &frame, llvm::Value *child,
+                             llvm::Value *&value);
+    NodeIndex visit_unary(const FlatFunction &f, NodeIndex n,
+                          CodegenFrame &frame, llvm::Value *operand,
+                          llvm::Value *&value);
+    NodeIndex visit_binary(const FlatFunction &f, NodeIndex n,
+                           CodegenFrame &frame, llvm::Value *child,
+                           llvm::Value *&value);
+    NodeIndex visit_if(const FlatFunction &f, NodeIndex n, CodegenFrame &frame,
+                       llvm::Value *child, llvm::Value *&value);
+    NodeIndex visit_block(const FlatFunction &f, NodeIndex n,
+                          CodegenFrame &frame, llvm::Value *child,
+                          llvm::Value *&value);
+    NodeIndex visit_call(const FlatFunction &f, NodeIndex n,
+                         CodegenFrame &frame, llvm::Value *arg,
+                         llvm::Value *&value);
+    NodeIndex visit_assign(const FlatFunction &f, NodeIndex n,
+                           CodegenFrame &frame, llvm::Value *child,
+                           llvm::Value *&value);
+    NodeIndex visit_while(const FlatFunction &f, NodeIndex n,
+                          CodegenFrame &frame, llvm::Value *child,
+                          llvm::Value *&value);
+};
+} // namespace
+
+NodeIndex ExprCodegen::visit_number(const FlatFunction &f, NodeIndex n,
+                                    CodegenFrame &, llvm::Value *,
+                                    llvm::Value *&value) {
     // in the LLVM IR that constants are all uniqued together and shared. For
     // this reason, the API uses the “foo::get(…)” idiom instead of “new
     // foo(..)” or “foo::Create(..)”
-    return llvm::ConstantFP::get(*LContext, llvm::APFloat(value));
+    auto number = f.number(n);
+    switch (types[n]) {
+    case ValueType::I64:
+        if (auto whole = whole_number(number))
+            value = llvm::ConstantInt::get(type_of(n), *whole, true);
+        else
+            value = not_whole_number(number);
+        break;
+    case ValueType::F32:
+        value = llvm::ConstantFP::get(type_of(n), number);
+        break;
+    default:
+        value = llvm::ConstantFP::get(*LContext, llvm::APFloat(number));
+    }
+    return NO_NODE;
+}
+
+NodeIndex ExprCodegen::visit_variable(const FlatFunction &f, NodeIndex n,
+                                      CodegenFrame &, llvm::Value *,
+                                      llvm::Value *&value) {
+    auto var_name = f.symbol(n);
+    value = symbol_slot(NamedValues, var_name);
+    if (!value)
+        LogErrorV("Unknown variable: " + utf8::string(Symbols.name(var_name)));
+
+    // A variable assigned to is in memory, see declare_variables()
+    if (auto *variable = llvm::dyn_cast_or_null<llvm::AllocaInst>(value))
+        value = LBuilder->CreateLoad(variable->getAllocatedType(), variable,
+                                     Symbols.name(var_name));
+    return NO_NODE;
+}
+
+NodeIndex ExprCodegen::visit_unary(const FlatFunction &f, NodeIndex n,
+                                   CodegenFrame &frame, llvm::Value *operand,
+                                   llvm::Value *&value) {
+    if (frame.step++ == 0)
+        return f.children_of(n)[0];
+
+    value = nullptr;
+    if (!operand || !(operand = convert(operand, type_of(n))))
+        return NO_NODE;
+
+    auto opr = f.opr(n);
+    if (opr == '-' && operand->getType()->isIntegerTy()) {
+        value = LBuilder->CreateNeg(operand, "negtmp");
+    } else if (opr == '-') {
+        value = LBuilder->CreateFNeg(operand, "negtmp");
+    } else {
+        throw std::logic_error(
+            "An operator not handled: '" + std::string(1, opr) +
+            "', IMPLEMENT IT. Line: " + std::to_string(__LINE__));
+    }
+    return NO_NODE;
 }
 
-llvm::Value *VariableAST::codegen() {
-    auto V = NamedValues[var_name];
-    if (!V)
-        LogErrorV("Unknown variable: " + var_name);
-    return V;
+// 'lhs opr rhs' for i64s, wrapping around on overflow, division by 0 is
+// undefined, same as C
+/**
+ * lhs / rhs, rounding towards zero, without the UB (and SIGFPE) a plain
+ * 'sdiv' has: by 0 it saturates like i64(inf) or i64(NaN) would, and
+ * INT64_MIN / -1 wraps to INT64_MIN, same as -INT64_MIN (see types.hpp)
+ */
+static llvm::Value *codegen_integer_division(llvm::Value *lhs,
+                                             llvm::Value *rhs) {
+    if (auto *constant = llvm::dyn_cast<llvm::ConstantInt>(rhs);
+        constant && !constant->isZero()) {
+        if (constant->isMinusOne())
+            return LBuilder->CreateNeg(lhs, "divtmp");
+        return LBuilder->CreateSDiv(lhs, rhs, "divtmp");
+    }
+
+    auto *type = llvm::cast<llvm::IntegerType>(lhs->getType());
+    auto *max = llvm::ConstantInt::get(type, llvm::APInt::getSignedMaxValue(
+                                                 type->getBitWidth()));
+    auto *min = llvm::ConstantInt::get(type, llvm::APInt::getSignedMinValue(
+                                                 type->getBitWidth()));
+    auto *zero = llvm::ConstantInt::get(type, 0);
+    auto *one = llvm::ConstantInt::get(type, 1);
+
+    auto *by_zero = LBuilder->CreateICmpEQ(rhs, zero, "div_by_zero");
+    auto *overflow = LBuilder->CreateAnd(
+        LBuilder->CreateICmpEQ(lhs, min),
+        LBuilder->CreateICmpEQ(rhs, llvm::ConstantInt::getSigned(type, -1)),
+        "div_overflow");
+    auto *divisor = LBuilder->CreateSelect(
+        LBuilder->CreateOr(by_zero, overflow), one, rhs, "divisor");
+    auto *quotient = LBuilder->CreateSDiv(lhs, divisor, "divtmp");
+
+    // Divided by 1 on overflow, so it's INT64_MIN. By 0, of the sign of lhs,
+    // as inf would be, and 0/0 is NaN, ie. 0
+    auto *infinite = LBuilder->CreateSelect(
+        LBuilder->CreateICmpSGT(lhs, zero), max,
+        LBuilder->CreateSelect(LBuilder->CreateICmpSLT(lhs, zero), min, zero));
+    return LBuilder->CreateSelect(by_zero, infinite, quotient, "divtmp");
+}
+
+static llvm::Value *codegen_integer_binary(char opr, llvm::Value *lhs,
+                                           llvm::Value *rhs) {
+    switch (opr) {
+    case '+':
+        return LBuilder->CreateAdd(lhs, rhs, "addtmp");
+    case '-':
+        return LBuilder->CreateSub(lhs, rhs, "subtmp");
+    case '*':
+        return LBuilder->CreateMul(lhs, rhs, "multmp");
+    case '/':
+        return codegen_integer_division(lhs, rhs);
+    case '<':
+        return LBuilder->CreateZExt(
+            LBuilder->CreateICmpSLT(lhs, rhs, "cmplttmp"), lhs->getType());
+    case '>':
+        return LBuilder->CreateZExt(
+            LBuilder->CreateICmpSGT(lhs, rhs, "cmpgttmp"), lhs->getType());
+    }
+    throw std::logic_error("An operator not handled: '" + std::string(1, opr) +
+                           "', IMPLEMENT IT. Line: " + std::to_string(__LINE__));
 }
 
-llvm::Value *BinaryExprAST::codegen() {
-    llvm::Value *lhs_codegen = lhs->codegen();
-    llvm::Value *rhs_codegen = rhs->codegen();
+NodeIndex ExprCodegen::visit_binary(const FlatFunction &f, NodeIndex n,
+                                    CodegenFrame &frame, llvm::Value *child,
+                                    llvm::Value *&value) {
+    auto operands = f.children_of(n);
+
+    switch (frame.step++) {
+    case 0:
+        return operands[0];
+    case 1:
+        frame.saved = child;
+        return operands[1];
+    }
+
+    llvm::Value *lhs_codegen = frame.saved;
+    llvm::Value *rhs_codegen = child;
 
+    value = nullptr;
     if (!lhs_codegen || !rhs_codegen) {
         LogError(
             "Invalid LHS or RHS of binary expression\n\t\tMaybe you used an "
             "not-yet-defined variable ?");
-        return nullptr;
+        return NO_NODE;
     }
 
-    if (opr == '+') {
-        return LBuilder->CreateFAdd(lhs_codegen, rhs_codegen, "addtmp");
+    // Operands are converted to the wider type, which the result is of, 1
+    // or 0 for a comparison
+    auto *type = type_of(n);
+    lhs_codegen = convert(lhs_codegen, type);
+    rhs_codegen = lhs_codegen ? convert(rhs_codegen, type) : nullptr;
+    if (!rhs_codegen)
+        return NO_NODE;
+
+    auto opr = f.opr(n);
+    if (type->isIntegerTy()) {
+        value = codegen_integer_binary(opr, lhs_codegen, rhs_codegen);
+    } else if (opr == '+') {
+        value = LBuilder->CreateFAdd(lhs_codegen, rhs_codegen, "addtmp");
     } else if (opr == '-') {
-        return LBuilder->CreateFSub(lhs_codegen, rhs_codegen, "subtmp");
+        value = LBuilder->CreateFSub(lhs_codegen, rhs_codegen, "subtmp");
     } else if (opr == '*') {
-        return LBuilder->CreateFMul(lhs_codegen, rhs_codegen, "multmp");
+        value = LBuilder->CreateFMul(lhs_codegen, rhs_codegen, "multmp");
     } else if (opr == '/') {
-        return LBuilder->CreateFDiv(lhs_codegen, rhs_codegen, "divtmp");
+        value = LBuilder->CreateFDiv(lhs_codegen, rhs_codegen, "divtmp");
     } else if (opr == '<') {
         // My way:
         auto L = LBuilder->CreateFCmpULT(lhs_codegen, rhs_codegen, "cmplttmp");
         // converting 0/1 (bool treated as int), to double
-        return LBuilder->CreateUIToFP(L, llvm::Type::getDoubleTy(*LContext));
+        value = LBuilder->CreateUIToFP(L, type);
     } else if (opr == '>') {
         auto L = LBuilder->CreateFCmpUGT(lhs_codegen, rhs_codegen, "cmpgttmp");
-        return LBuilder->CreateUIToFP(L, llvm::Type::getDoubleTy(*LContext));
+        value = LBuilder->CreateUIToFP(L, type);
     } else {
         throw std::logic_error(
-            "An operator not handled: '" + utf8::to_string(opr) +
+            "An operator not handled: '" + std::string(1, opr) +
             "', IMPLEMENT IT. Line: " + std::to_string(__LINE__));
     }
+    return NO_NODE;
 }
 
-llvm::Value *IfExprAST::codegen() {
-    auto cond_ir = condition->codegen();
-    if (!cond_ir)
-        return nullptr;
-    // COME HERE
-    // "ONE" -> Ordered and not equal
-    // Create a (condition != 0.0) instruction, ie. true for not zero, ie. true
-    // for 1, ie. true for true ;D
-    cond_ir = LBuilder->CreateFCmpONE(
-        /*lhs*/ cond_ir,
-        /*rcond_ir*/ llvm::ConstantFP::get(*LContext, llvm::APFloat(0.0)),
-        "if_condn");
-
-    // gets the current Function object that is being built. It gets this by
-    // asking the builder for the current BasicBlock, and asking that block for
-    // its “parent” (the function it is currently embedded into)
-    auto parent_func = LBuilder->GetInsertBlock()->getParent();
-
-    /** If the Parent parameter (3rd param) is specified, the basic block is
-     *automatically inserted at either the end of the function (if InsertBefore
-     *is 0), or before the specified basic block. */
-    auto then_bb = BasicBlock::Create(*LContext, "then_bb", parent_func);
-    auto else_bb = BasicBlock::Create(*LContext, "else_bb");
-    auto cont_bb = BasicBlock::Create(*LContext, "continued_bb");
-
-    // create 'conditional' br, ie. jump to then block if condition true, or
-    // else block
-    LBuilder->CreateCondBr(cond_ir, then_bb, else_bb);
-
-    // add code to the end of then_bb, ie. add the return
-    LBuilder->SetInsertPoint(then_bb);
-
-    // Now actual add the IR for then and else blocks
-    auto then_ir = then_->codegen();
-
-    if (!then_ir)
-        return nullptr;
-
-    // creates uncondition 'br' label
-    LBuilder->CreateBr(cont_bb);
+NodeIndex ExprCodegen::visit_if(const FlatFunction &f, NodeIndex n,
+                                CodegenFrame &frame, llvm::Value *child,
+                                llvm::Value *&value) {
+    auto parts = f.children_of(n);
+    auto condition = parts[0], then_ = parts[1], else_ = parts[2];
+
+    value = nullptr;
+    switch (frame.step++) {
+    case 0:
+        return condition;
+
+    case 1: {
+        if (!child)
+            return NO_NODE;
+        auto cond_ir = codegen_condition(child);
+
+        // gets the current Function object that is being built. It gets this
+        // by asking the builder for the current BasicBlock, and asking that
+        // block for its “parent” (the function it is currently embedded into)
+        auto parent_func = LBuilder->GetInsertBlock()->getParent();
+
+        /** If the Parent parameter (3rd param) is specified, the basic block
+         *is automatically inserted at either the end of the function (if
+         *InsertBefore is 0), or before the specified basic block. */
+        frame.then_bb = BasicBlock::Create(*LContext, "then_bb", parent_func);
+        frame.else_bb = BasicBlock::Create(*LContext, "else_bb");
+        frame.cont_bb = BasicBlock::Create(*LContext, "continued_bb");
+
+        // create 'conditional' br, ie. jump to then block if condition true,
+        // or else block
+        LBuilder->CreateCondBr(cond_ir, frame.then_bb, frame.else_bb);
+
+        // add code to the end of then_bb, ie. add the return
+        LBuilder->SetInsertPoint(frame.then_bb);
+        frame.scope = known_order.size();
+
+        // Now actual add the IR for then and else blocks
+        return then_;
+    }
 
-    /**
-     * Why then, are we getting the current block when we just set it to ThenBB
-     * 5 lines above? The problem is that the “Then” expression may actually
-     * itself change the block that the Builder is emitting into if, for
-     * example, it contains a nested “if/then/else” expression. Because calling
-     * codegen() recursively could arbitrarily change the notion of the current
-     * block, we are required to get an up-to-date value for code that will set
-     * up the Phi node.
-     */
-    then_bb =
-        LBuilder->GetInsertBlock(); // codegen of 'Then' can change the current
-                                    // block, update ThenBB for the PHI.
-
-    // push else block to parent function
+    case 2: {
+        auto then_ir = child ? convert(child, type_of(n)) : nullptr;
+        if (!then_ir)
+            return NO_NODE;
+
+        // creates uncondition 'br' label
+        LBuilder->CreateBr(frame.cont_bb);
+
+        /**
+         * Why then, are we getting the current block when we just set it to
+         * ThenBB above? The problem is that the “Then” expression may actually
+         * itself change the block that the Builder is emitting into if, for
+         * example, it contains a nested “if/then/else” expression. Because
+         * codegen of the children could arbitrarily change the notion of the
+         * current block, we are required to get an up-to-date value for code
+         * that will set up the Phi node.
+         */
+        frame.then_bb =
+            LBuilder->GetInsertBlock(); // codegen of 'Then' can change the
+                                        // current block, update ThenBB for
+                                        // the PHI.
+        frame.saved = then_ir;
+
+        // push else block to parent function
+        auto parent_func = LBuilder->GetInsertBlock()->getParent();
 #if (LLVM_VERSION_MAJOR < 17) || \
     (LLVM_VERSION_MAJOR == 17 && LLVM_VERSION_MINOR == 0 && LLVM_VERSION_PATCH < 6)
-    parent_func->getBasicBlockList().push_back(else_bb);
+        parent_func->getBasicBlockList().push_back(frame.else_bb);
 #else
-    parent_func->insert(parent_func->end(), else_bb);
+        parent_func->insert(parent_func->end(), frame.else_bb);
 #endif
-    LBuilder->SetInsertPoint(else_bb);
+        LBuilder->SetInsertPoint(frame.else_bb);
+        forget_since(frame.scope); // 'then' doesn't dominate 'else'
 
-    auto else_ir = else_->codegen();
+        return else_;
+    }
+    }
+
+    auto else_ir = child ? convert(child, type_of(n)) : nullptr;
     if (!else_ir)
-        return nullptr;
+        return NO_NODE;
 
-    LBuilder->CreateBr(cont_bb);
+    LBuilder->CreateBr(frame.cont_bb);
 
-    // codegen of 'Else' could have changed the current block, update ElseBB for
-    // the PHI.
-    else_bb = LBuilder->GetInsertBlock();
+    // codegen of 'Else' could have changed the current block, update ElseBB
+    // for the PHI.
+    frame.else_bb = LBuilder->GetInsertBlock();
 
+    auto parent_func = LBuilder->GetInsertBlock()->getParent();
 #if (LLVM_VERSION_MAJOR < 17) || \
     (LLVM_VERSION_MAJOR == 17 && LLVM_VERSION_MINOR == 0 && LLVM_VERSION_PATCH < 6)
-    parent_func->getBasicBlockList().push_back(cont_bb);
+    parent_func->getBasicBlockList().push_back(frame.cont_bb);
 #else
-    parent_func->insert(parent_func->end(), cont_bb);
+    parent_func->insert(parent_func->end(), frame.cont_bb);
 #endif
-    LBuilder->SetInsertPoint(cont_bb);
-    llvm::PHINode *phi_node =
-        LBuilder->CreatePHI(llvm::Type::getDoubleTy(*LContext), 2, "cont_phi");
+    LBuilder->SetInsertPoint(frame.cont_bb);
+    llvm::PHINode *phi_node = LBuilder->CreatePHI(type_of(n), 2, "cont_phi");
 
-    phi_node->addIncoming(then_ir, then_bb);
-    phi_node->addIncoming(else_ir, else_bb);
+    phi_node->addIncoming(frame.saved, frame.then_bb);
+    phi_node->addIncoming(else_ir, frame.else_bb);
 
-    return phi_node;
+    value = phi_node;
+    return NO_NODE;
 }
 
-llvm::Value *BlockAST::codegen() {
-    auto *block = LBuilder->GetInsertBlock();
-
-    if (!block) {
-        LogErrorP(
-            "BlockAST::codegen requires a function, failed to autodetect");
-        return nullptr;
+// Block nested in an expression, ie. then/else of an if, or a loop's body,
+// its value is of the last expression
+NodeIndex ExprCodegen::visit_block(const FlatFunction &f, NodeIndex n,
+                                   CodegenFrame &frame, llvm::Value *child,
+                                   llvm::Value *&value) {
+    auto expressions = f.children_of(n);
+
+    value = nullptr;
+    if (frame.step == 0) {
+        auto *block = LBuilder->GetInsertBlock();
+        if (!block || !block->getParent()) {
+            LogErrorP(
+                "BlockAST::codegen requires a function, failed to autodetect");
+            return NO_NODE;
+        }
+    } else if (!child) {
+        return NO_NODE;
     }
 
-    auto *func = block->getParent();
+    if (frame.step < expressions.size())
+        return expressions[frame.step++];
 
-    if (func != nullptr)
-        return codegen(func, /*is_if_else*/ true);
-
-    LogErrorP("BlockAST::codegen requires a function, failed to autodetect");
-    return nullptr;
+    value = convert(child, type_of(n));
+    return NO_NODE;
 }
 
-llvm::Value *BlockAST::codegen(llvm::Function *func, bool is_if_else) {
-    // NOTE: @adi Temporary Solution, try to implement multi expression if
-    // blocks
-    if (!is_if_else) {
-        // Create a basic block to start insertion into
-        // > Basic blocks in LLVM are an important part of functions that define
-        // the Control Flow Graph
-        auto *block = BasicBlock::Create(*LContext, "entry", func);
+NodeIndex ExprCodegen::visit_call(const FlatFunction &f, NodeIndex n,
+                                  CodegenFrame &frame, llvm::Value *arg,
+                                  llvm::Value *&value) {
+    auto callee = f.symbol(n);
+    auto args = f.children_of(n);
+
+    // A conversion, for eg. i64(x), else look name in global function table
+    auto conversion = type_named(Symbols.name(callee));
+    llvm::Function *CalleeFunction =
+        conversion ? nullptr : symbol_slot(Functions, callee).func;
+
+    value = nullptr;
+    if (frame.step == 0 && conversion) {
+        frame.first_value = values.size();
+    } else if (frame.step == 0) {
+        if (!CalleeFunction) {
+            LogErrorV("Unknown function referenced: " +
+                      utf8::string(Symbols.name(callee)));
+            return NO_NODE;
+        }
 
-        LBuilder->SetInsertPoint(block);
+        // Verify number of arguments is same (Type is double always
+        // neverthless)
+        if (CalleeFunction->arg_size() != args.size()) {
+            LogErrorV("Wrong number of arguments passed: Expected: " +
+                      std::to_string(CalleeFunction->arg_size()) +
+                      ", Actual Passed: " + std::to_string(args.size()));
+            return NO_NODE;
+        }
 
-        if (expressions.size() > 1) {
-            // tells the builder that new instructions should be inserted into
-            // the end of the new basic block
-            for (auto i = 0; i < (expressions.size() - 1); ++i) {
-                expressions[i]->codegen();
-            }
+        frame.first_value = values.size();
+    } else {
+        values.push_back(arg);
+    }
+
+    if (frame.step < args.size())
+        return args[frame.step++];
+
+    auto PassedArgs = llvm::MutableArrayRef<llvm::Value *>(values).drop_front(
+        frame.first_value);
+    if (conversion) {
+        // infer_types() checked that there's one argument
+        if (PassedArgs[0])
+            value = convert_explicitly(PassedArgs[0],
+                                       llvm_type(*conversion, *LContext));
+    } else if (std::none_of(PassedArgs.begin(), PassedArgs.end(),
+                            [](const auto *e) { return e == nullptr; })) {
+        // To the types of the parameters, if they are wider
+        bool converted = true;
+        for (unsigned i = 0; i < PassedArgs.size() && converted; ++i) {
+            PassedArgs[i] = convert(PassedArgs[i],
+                                    CalleeFunction->getArg(i)->getType());
+            converted = PassedArgs[i] != nullptr;
         }
+        if (converted)
+            value = LBuilder->CreateCall(CalleeFunction, PassedArgs,
+                                         Symbols.name(callee));
     }
 
-    // Returning return value, ie. of last expression
-    return expressions.back()->codegen();
+    values.resize(frame.first_value);
+    return NO_NODE;
 }
 
-llvm::Value *FunctionCallAST::codegen() {
-    // Look name in global module table
-    llvm::Function *CalleeFunction = LModule->getFunction(callee);
+NodeIndex ExprCodegen::visit_assign(const FlatFunction &f, NodeIndex n,
+                                    CodegenFrame &frame, llvm::Value *child,
+                                    llvm::Value *&value) {
+    if (frame.step++ == 0)
+        return f.children_of(n)[0];
+
+    // declare_variables() made it, for each variable assigned to
+    auto *variable =
+        llvm::cast<llvm::AllocaInst>(symbol_slot(NamedValues, f.symbol(n)));
+
+    value = child ? convert(child, variable->getAllocatedType()) : nullptr;
+    if (value)
+        LBuilder->CreateStore(value, variable);
+    return NO_NODE;
+}
 
-    if (!CalleeFunction) {
-        return LogErrorV("Unknown function referenced: " + callee);
+/**
+ * The condition is checked in its own block, which the body branches back
+ * to, and is left once it's 0
+ */
+NodeIndex ExprCodegen::visit_while(const FlatFunction &f, NodeIndex n,
+                                   CodegenFrame &frame, llvm::Value *child,
+                                   llvm::Value *&value) {
+    auto parts = f.children_of(n);
+    auto *parent_func = LBuilder->GetInsertBlock()->getParent();
+
+    value = nullptr;
+    switch (frame.step++) {
+    case 0:
+        frame.then_bb = BasicBlock::Create(*LContext, "loop_condn", parent_func);
+        LBuilder->CreateBr(frame.then_bb);
+        LBuilder->SetInsertPoint(frame.then_bb);
+        return parts[0];
+
+    case 1: {
+        if (!child)
+            return NO_NODE;
+
+        auto *body_bb = BasicBlock::Create(*LContext, "loop_bb", parent_func);
+        frame.cont_bb = BasicBlock::Create(*LContext, "after_loop_bb");
+        LBuilder->CreateCondBr(codegen_condition(child), body_bb,
+                               frame.cont_bb);
+
+        // The condition's block dominates the body and what's after, but
+        // values in the body are only known in it
+        LBuilder->SetInsertPoint(body_bb);
+        frame.scope = known_order.size();
+        return parts[1];
     }
+    }
+
+    if (!child)
+        return NO_NODE;
+    LBuilder->CreateBr(frame.then_bb);
 
-    // Verify number of arguments is same (Type is double always neverthless)
-    if (CalleeFunction->arg_size() != args.size()) {
-        return LogErrorV("Wrong number of arguments passed: Expected: " +
-                         std::to_string(CalleeFunction->arg_size()) +
-                         ", Actual Passed: " + std::to_string(args.size()));
+#if (LLVM_VERSION_MAJOR < 17) || \
+    (LLVM_VERSION_MAJOR == 17 && LLVM_VERSION_MINOR == 0 && LLVM_VERSION_PATCH < 6)
+    parent_func->getBasicBlockList().push_back(frame.cont_bb);
+#else
+    parent_func->insert(parent_func->end(), frame.cont_bb);
+#endif
+    LBuilder->SetInsertPoint(frame.cont_bb);
+
+    value = llvm::Constant::getNullValue(type_of(n));
+    return NO_NODE;
+}
+
+/**
+ * Codegen of the expression at 'root', its nodes are visited in the same
+ * order as a recursive codegen would, but pending nodes are on 'frames'
+ * instead of the native stack, so depth of the expression is only limited
+ * by memory
+ */
+llvm::Value *ExprCodegen::run(const FlatFunction &f, NodeIndex root) {
+    frames.clear();
+    values.clear();
+
+    // Value of the node done last, ie. given to the next step of its parent
+    llvm::Value *value = nullptr;
+    NodeIndex next = root;
+
+    while (true) {
+        if (next != NO_NODE) {
+            value = known[next];
+            if (!value)
+                frames.push_back({next});
+        }
+
+        if (frames.empty())
+            return value;
+
+        auto &frame = frames.back();
+        auto child = value;
+        next = visit(f, frame.node, frame, child, value);
+        if (next != NO_NODE)
+            continue;
+
+        // Values from inside the branches of an 'if' aren't usable after it
+        if (frame.scope != SIZE_MAX)
+            forget_since(frame.scope);
+        if (value) {
+            known[frame.node] = value;
+            known_order.push_back(frame.node);
+        }
+        frames.pop_back();
     }
+}
 
-    std::vector<llvm::Value *> PassedArgs(args.size());
-    std::transform(args.cbegin(), args.cend(), PassedArgs.begin(),
-                   [](const auto &a) { return a->codegen(); });
+void ExprCodegen::forget_since(size_t count) {
+    for (auto i = count; i < known_order.size(); ++i)
+        known[known_order[i]] = nullptr;
+    known_order.resize(count);
+}
 
-    if (std::any_of(PassedArgs.cbegin(), PassedArgs.cend(),
-                    [](const auto *e) { return e == nullptr; }))
-        return nullptr;
+/**
+ * Each variable assigned to (by an ASSIGN node) lives in an alloca at start
+ * of the function, which NamedValues then has for it, so it can be loaded
+ * and stored anywhere in the loops and branches. A parameter's is set to its
+ * argument, and a local's to 0, of the type it's first assigned (see
+ * infer_types()), they are made SSA values again by mem2reg, once the
+ * function is done
+ */
+static void declare_variables(const FlatFunction &f,
+                              const std::vector<ValueType> &types,
+                              llvm::SmallVectorImpl<llvm::AllocaInst *> &out) {
+    for (NodeIndex n = 0; n < f.size(); ++n) {
+        if (f.kinds[n] != NodeKind::ASSIGN)
+            continue;
+
+        auto name = f.symbol(n);
+        auto &slot = symbol_slot(NamedValues, name);
+        if (slot && llvm::isa<llvm::AllocaInst>(slot))
+            continue;
+
+        auto *initial = slot ? slot
+                             : llvm::Constant::getNullValue(
+                                   llvm_type(types[n], *LContext));
+        auto *variable =
+            LBuilder->CreateAlloca(initial->getType(), nullptr,
+                                   std::string(Symbols.name(name)) + ".addr");
+        LBuilder->CreateStore(initial, variable);
+        slot = variable;
+        out.push_back(variable);
+    }
+}
+
+// Body of a function, ie. all its expressions in a new "entry" block, and its
+// value is of the last expression
+static llvm::Value *
+codegen_body(const FlatFunction &f, NodeIndex n, llvm::Function *func,
+             const std::vector<ValueType> &types,
+             llvm::SmallVectorImpl<llvm::AllocaInst *> &variables) {
+    auto expressions = f.children_of(n);
+
+    // Create a basic block to start insertion into
+    // > Basic blocks in LLVM are an important part of functions that define
+    // the Control Flow Graph
+    auto *block = BasicBlock::Create(*LContext, "entry", func);
+
+    // tells the builder that new instructions should be inserted into the
+    // end of the new basic block
+    LBuilder->SetInsertPoint(block);
+    declare_variables(f, types, variables);
+
+    ExprCodegen codegen(f, types);
+    for (size_t i = 0; i + 1 < expressions.size(); ++i) {
+        codegen.run(f, expressions[i]);
+    }
 
-    return LBuilder->CreateCall(CalleeFunction, PassedArgs, callee);
+    // Returning return value, ie. of last expression
+    auto *retval = codegen.run(f, expressions.back());
+    return retval ? convert(retval, func->getReturnType()) : nullptr;
 }
 
-llvm::Function *FunctionPrototypeAST::codegen() {
-    std::vector<llvm::Type *> ParameterTypes(parameter_names.size());
+// Parameters and return are as annotated, f64 if not
+static llvm::FunctionType *function_type(const FlatFunction &f) {
+    std::vector<llvm::Type *> parameter_types;
+    for (auto type : f.parameter_types)
+        parameter_types.push_back(llvm_type(type, *LContext));
+
+    return llvm::FunctionType::get(llvm_type(f.return_type, *LContext),
+                                   parameter_types, false);
+}
 
-    // there are N doubles
-    std::fill(ParameterTypes.begin(), ParameterTypes.end(),
-              llvm::Type::getDoubleTy(*LContext));
+static llvm::Function *codegen_prototype(const FlatFunction &f) {
+    auto function_name = f.name;
+    const auto &parameter_names = f.parameters;
 
-    auto *func_type = llvm::FunctionType::get(
-        llvm::Type::getDoubleTy(*LContext), ParameterTypes, false);
     auto *func =
-        llvm::Function::Create(func_type, llvm::Function::ExternalLinkage,
-                               function_name, LModule.get());
+        llvm::Function::Create(function_type(f), llvm::Function::ExternalLinkage,
+                               Symbols.name(function_name), LModule.get());
 
     unsigned idx = 0;
     for (auto &param : func->args()) {
-        param.setName(parameter_names[idx++]);
+        param.setName(Symbols.name(parameter_names[idx++]));
+    }
+
+    // If the name is already taken, LLVM renames this one (eg. "foo.1"), and
+    // calls keep going to the first one
+    if (function_name != Symbol::EMPTY) {
+        auto &entry = symbol_slot(Functions, function_name);
+        if (!entry.func)
+            entry = {func, parameter_names};
     }
 
     return func;
 }
 
-llvm::Function *FunctionAST::codegen() {
+// 'types' of the nodes, or nullptr to infer them (see infer_types())
+static llvm::Function *codegen_function(const FlatFunction &f,
+                                        const std::vector<ValueType> *types) {
     // Check, if the function name has already been declared (due to a previous
     // "extern")
-    auto *func = LModule->getFunction(this->prototype->function_name);
+    auto *func = f.name == Symbol::EMPTY ? nullptr
+                                         : symbol_slot(Functions, f.name).func;
 
     if (!func) {
-        func = prototype->codegen();
+        func = codegen_prototype(f);
     }
 
     if (!func) {
@@ -722,7 +1606,7 @@ llvm::Function *FunctionAST::codegen() {
     }
 
     /**
-     * @bug: This code does have a bug, though: If the FunctionAST::codegen()
+     * @bug: This code does have a bug, though: If the codegen_function()
      * method finds an existing IR Function, it does not validate its signature
      * against the definition’s own prototype. This means that an earlier
      * ‘extern’ declaration will take precedence over the function definition’s
@@ -739,37 +1623,138 @@ llvm::Function *FunctionAST::codegen() {
 
     // Check if function is NOT empty, ie. it has a function definition
     if (func->empty() == false) {
-        LogErrorV("Cannot redefine function: " + prototype->function_name);
+        LogErrorV("Cannot redefine function: " +
+                  utf8::string(Symbols.name(f.name)));
         return nullptr;
     }
-    // add the function arguments to the NamedValues map (after first clearing
-    // it out) so that they’re accessible to VariableExprAST nodes.
-    NamedValues.clear();
+
+    // Calls to an earlier declaration already pass and expect its types
+    if (func->getFunctionType() != function_type(f)) {
+        LogErrorV("Types of " + utf8::string(Symbols.name(f.name)) +
+                  " differ from its declaration");
+        return nullptr;
+    }
+
+    // Parameter names are the ones func was first declared with (for eg. by
+    // an 'extern'), see the @bug above. A view, NOT a reference to the
+    // Functions entry, since codegen of the body may grow Functions
+    llvm::ArrayRef<Symbol> parameter_names = f.parameters;
+    if (f.name != Symbol::EMPTY)
+        parameter_names = symbol_slot(Functions, f.name).parameter_names;
+
+    // add the function arguments to NamedValues so that they’re accessible to
+    // VariableExprAST nodes, and remove them once body is done. If a name is
+    // repeated, the first parameter gets it
+    unsigned idx = 0;
     for (auto &param : func->args()) {
-        NamedValues.insert_or_assign(param.getName().str(), &param);
+        auto &slot = symbol_slot(NamedValues, parameter_names[idx++]);
+        if (!slot)
+            slot = &param;
+    }
+
+    // Flags of each floating point instruction in the body, and the
+    // function's attributes for what the backend does (for eg. fused
+    // multiply-add, or reciprocal instead of a division)
+    llvm::IRBuilderBase::FastMathFlagGuard restore_flags(*LBuilder);
+    llvm::FastMathFlags flags;
+    switch (f.fp_mode == FPMode::DEFAULT ? DefaultFPMode : f.fp_mode) {
+    case FPMode::FAST:
+        flags.setFast();
+        for (auto *attribute :
+             {"unsafe-fp-math", "no-infs-fp-math", "no-nans-fp-math",
+              "no-signed-zeros-fp-math", "approx-func-fp-math"})
+            func->addFnAttr(attribute, "true");
+        break;
+    case FPMode::CONTRACT:
+        flags.setAllowContract();
+        break;
+    default:
+        break;
+    }
+    LBuilder->setFastMathFlags(flags);
+
+    std::optional<std::vector<ValueType>> inferred;
+    if (!types) {
+        inferred = infer_types(f, *func, parameter_names, declared_function);
+        types = inferred ? &*inferred : nullptr;
+    }
+    llvm::SmallVector<llvm::AllocaInst *, 8> variables;
+    auto *retval =
+        types ? codegen_body(f, f.body, func, *types, variables) : nullptr;
+
+    for (auto name : parameter_names)
+        NamedValues[index(name)] = nullptr;
+    for (NodeIndex n = 0; n < f.size(); ++n) {
+        if (f.kinds[n] == NodeKind::ASSIGN)
+            symbol_slot(NamedValues, f.symbol(n)) = nullptr;
     }
 
-    auto *retval = this->block->codegen(func);
     if (retval) {
         LBuilder->CreateRet(retval);
 
+        // Variables in registers (SSA values, phi nodes in loops) instead of
+        // memory, same as LLVM's mem2reg pass, but done even at -O0
+        if (!variables.empty()) {
+            llvm::DominatorTree dominators(*func);
+            llvm::PromoteMemToReg(variables, dominators);
+        }
+
+        erase_unused_condition_casts(*func);
         llvm::verifyFunction(*func);
 
         return func;
     } else {
         // Error reading body, remove function
+        if (f.name != Symbol::EMPTY)
+            symbol_slot(Functions, f.name) = {};
         func->eraseFromParent();
         return nullptr;
     }
 }
 
-Ptr<ExprAST> LogError(const utf8::string &str) {
-    std::cerr << rang::style::bold << rang::fg::red
+llvm::Function *codegen(const FlatFunction &f) {
+    return f.is_extern() ? codegen_prototype(f) : codegen_function(f, nullptr);
+}
+
+llvm::Function *codegen(const FlatFunction &f,
+                        const std::vector<ValueType> &types) {
+    return codegen_function(f, &types);
+}
+
+void set_default_fp_mode(FPMode mode) { DefaultFPMode = mode; }
+
+llvm::ArrayRef<Symbol> declared_parameters(Symbol function) {
+    return symbol_slot(Functions, function).parameter_names;
+}
+
+llvm::Function *declared_function(Symbol function) {
+    return symbol_slot(Functions, function).func;
+}
+
+llvm::GlobalVariable *codegen_constant(const std::string &name, double value) {
+    return new llvm::GlobalVariable(
+        *LModule, llvm::Type::getDoubleTy(*LContext), /*isConstant*/ true,
+        llvm::GlobalValue::ExternalLinkage,
+        llvm::ConstantFP::get(*LContext, llvm::APFloat(value)), name);
+}
+
+static thread_local std::ostream *Diagnostics = &std::cerr;
+
+std::ostream &diagnostics() { return *Diagnostics; }
+
+DiagnosticsTo::DiagnosticsTo(std::ostream &out) : previous(Diagnostics) {
+    Diagnostics = &out;
+}
+
+DiagnosticsTo::~DiagnosticsTo() { Diagnostics = previous; }
+
+ExprAST *LogError(const utf8::string &str) {
+    diagnostics() << rang::style::bold << rang::fg::red
               << "LogError: " << rang::style::reset << str << '\n';
     return nullptr;
 }
 
-Ptr<FunctionPrototypeAST> LogErrorP(const utf8::string &str) {
+FunctionPrototypeAST *LogErrorP(const utf8::string &str) {
     LogError(str);
     return nullptr;
 }
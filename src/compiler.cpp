@@ -2,6 +2,7 @@
 #include "util.hpp"
 #include <exception>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <stdexcept>
 #include <string>
@@ -10,10 +11,14 @@
     (LLVM_VERSION_MAJOR == 17 && LLVM_VERSION_MINOR == 0 && LLVM_VERSION_PATCH < 6)
 #include <llvm/ADT/Optional.h>
 #endif
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/Triple.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/Module.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/MC/SubtargetFeature.h>
 #include <llvm/Support/CodeGen.h>
 #include <llvm/Support/Host.h>
 #if (LLVM_VERSION_MAJOR < 14)
@@ -29,7 +34,8 @@
 
 extern Ptr<llvm::Module> LModule;
 
-llvm::TargetMachine *InitialisationCompiler() {
+llvm::TargetMachine *InitialisationCompiler(const std::string &cpu,
+                                            const std::string &arch, bool pic) {
     auto TargetTriple = llvm::sys::getDefaultTargetTriple();
 
     // Initialise all targets for emitting code
@@ -39,8 +45,11 @@ llvm::TargetMachine *InitialisationCompiler() {
     llvm::InitializeAllAsmParsers();
     llvm::InitializeAllAsmPrinters();
 
+    // With an 'arch', lookupTarget() changes the triple's architecture to it
+    auto triple = llvm::Triple(TargetTriple);
     auto err_str = std::string();
-    auto Target = llvm::TargetRegistry::lookupTarget(TargetTriple, err_str);
+    auto Target = llvm::TargetRegistry::lookupTarget(
+        arch == "native" ? "" : arch, triple, err_str);
 
     if (Target == nullptr) {
         std::cerr << rang::style::bold << rang::fg::red
@@ -48,10 +57,31 @@ llvm::TargetMachine *InitialisationCompiler() {
                   << ": " << err_str << rang::style::reset;
         throw std::exception();
     }
+    TargetTriple = triple.str();
+
+    // Without any additional features, by default
+    auto CPU = cpu;
+    auto Features = llvm::SubtargetFeatures();
+    if (cpu == "native") {
+        CPU = llvm::sys::getHostCPUName().str();
+
+        llvm::StringMap<bool> host_features;
+        if (llvm::sys::getHostCPUFeatures(host_features)) {
+            for (auto &feature : host_features)
+                Features.AddFeature(feature.first(), feature.second);
+        }
+    }
+
+    // Created for the default CPU, since an unknown one prints a warning
+    std::unique_ptr<llvm::MCSubtargetInfo> subtarget(
+        Target->createMCSubtargetInfo(TargetTriple, "", ""));
+    if (!subtarget || !subtarget->isCPUStringValid(CPU)) {
+        std::cerr << rang::style::bold << rang::fg::red << "Unknown CPU \""
+                  << CPU << "\" for target triple=" << TargetTriple
+                  << rang::style::reset << std::endl;
+        throw std::exception();
+    }
 
-    auto CPU = "generic"; // without any additional features, options or
-                          // relocation model
-    auto Features = "";   // no additional features
     llvm::TargetOptions opt;
 
 #if (LLVM_VERSION_MAJOR < 17) || \
@@ -60,9 +90,11 @@ llvm::TargetMachine *InitialisationCompiler() {
 #else
     auto RM = std::optional<llvm::Reloc::Model>();
 #endif
+    if (pic)
+        RM = llvm::Reloc::PIC_;
 
-    auto TargetMachine =
-        Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM);
+    auto TargetMachine = Target->createTargetMachine(
+        TargetTriple, CPU, Features.getString(), opt, RM);
 
     // configure module, to specify the target and data layout
     LModule->setDataLayout(TargetMachine->createDataLayout());
@@ -0,0 +1,282 @@
+#include "evaluate.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include <llvm/ADT/SmallVector.h>
+
+namespace {
+struct EvalFrame {
+    const FlatFunction *f;
+    NodeIndex node;
+    size_t args;   // arguments of f are at arguments[args..]
+    size_t locals; // local variables of f are at locals[locals..]
+    uint32_t step = 0;
+
+    double saved = 0; // BINARY: lhs
+
+    // CALL: values of the arguments done till now are values[first_value..],
+    // and arguments (and locals) of the callee are at arguments[call_args..]
+    // (and locals[call_locals..])
+    size_t first_value = 0;
+    size_t call_args = 0, call_locals = 0;
+};
+
+/**
+ * Same steps as ExprCodegen (see codegen in ast.cpp), but computing the
+ * values: each visit_* gets the value of the child done before it in
+ * 'value', and returns next child to evaluate, or NO_NODE once the node is
+ * done, with its value in 'value'
+ */
+class Evaluation : public FlatVisitor<Evaluation, NodeIndex> {
+    const std::vector<FlatFunction> &definitions;
+    uint64_t fuel;
+    bool failed = false;
+
+    llvm::SmallVector<EvalFrame, 32> frames;
+    llvm::SmallVector<double, 32> values;    // CALL: arguments being done
+    llvm::SmallVector<double, 32> arguments; // of the functions on 'frames'
+
+    // Of the functions on 'frames', each local variable once it's assigned
+    llvm::SmallVector<std::pair<Symbol, double>, 32> locals;
+
+    // Set by visit_call, when the child returned is body of this function
+    const FlatFunction *callee = nullptr;
+
+  public:
+    Evaluation(const std::vector<FlatFunction> &definitions, uint64_t fuel)
+        : definitions(definitions), fuel(fuel) {}
+
+    std::optional<double> run(const FlatFunction &f,
+                              llvm::ArrayRef<double> args) {
+        arguments.assign(args.begin(), args.end());
+        frames.push_back({&f, f.body, 0, 0});
+
+        double value = 0;
+        while (!frames.empty()) {
+            if (fuel == 0)
+                return std::nullopt;
+            --fuel;
+
+            auto &frame = frames.back();
+            callee = nullptr;
+            auto next = visit(*frame.f, frame.node, frame, value);
+            if (failed)
+                return std::nullopt;
+
+            if (next == NO_NODE)
+                frames.pop_back();
+            else if (callee)
+                frames.push_back(
+                    {callee, next, frame.call_args, frame.call_locals});
+            else
+                frames.push_back({frame.f, next, frame.args, frame.locals});
+        }
+        return value;
+    }
+
+    NodeIndex visit_number(const FlatFunction &f, NodeIndex n, EvalFrame &,
+                           double &value) {
+        value = f.number(n);
+        return NO_NODE;
+    }
+
+    NodeIndex visit_variable(const FlatFunction &f, NodeIndex n,
+                             EvalFrame &frame, double &value) {
+        if (auto *variable = assigned(frame, f.symbol(n))) {
+            value = *variable;
+            return NO_NODE;
+        }
+
+        // First parameter of the name, same as codegen
+        auto it = std::find(f.parameters.begin(), f.parameters.end(),
+                            f.symbol(n));
+        if (it == f.parameters.end())
+            return fail(); // or a local not assigned yet, 0 at runtime
+
+        value = arguments[frame.args + (it - f.parameters.begin())];
+        return NO_NODE;
+    }
+
+    NodeIndex visit_unary(const FlatFunction &f, NodeIndex n,
+                          EvalFrame &frame, double &value) {
+        if (frame.step++ == 0)
+            return f.children_of(n)[0];
+
+        if (f.opr(n) != '-')
+            return fail();
+        value = -value;
+        return NO_NODE;
+    }
+
+    NodeIndex visit_binary(const FlatFunction &f, NodeIndex n,
+                           EvalFrame &frame, double &value) {
+        switch (frame.step++) {
+        case 0:
+            return f.children_of(n)[0];
+        case 1:
+            frame.saved = value;
+            return f.children_of(n)[1];
+        }
+
+        double a = frame.saved, b = value;
+        switch (f.opr(n)) {
+        case '+':
+            value = a + b;
+            break;
+        case '-':
+            value = a - b;
+            break;
+        case '*':
+            value = a * b;
+            break;
+        case '/':
+            value = a / b;
+            break;
+        case '<': // 'fcmp ult', ie. true if unordered (a NaN) or less
+            value = std::isnan(a) || std::isnan(b) || a < b;
+            break;
+        case '>':
+            value = std::isnan(a) || std::isnan(b) || a > b;
+            break;
+        default:
+            return fail();
+        }
+        return NO_NODE;
+    }
+
+    NodeIndex visit_if(const FlatFunction &f, NodeIndex n, EvalFrame &frame,
+                       double &value) {
+        auto parts = f.children_of(n);
+        switch (frame.step++) {
+        case 0:
+            return parts[0];
+        case 1: // 'fcmp one', ie. ordered and not equal to 0
+            return !std::isnan(value) && value != 0 ? parts[1] : parts[2];
+        }
+        return NO_NODE;
+    }
+
+    NodeIndex visit_block(const FlatFunction &f, NodeIndex n,
+                          EvalFrame &frame, double &) {
+        auto expressions = f.children_of(n);
+        auto step = frame.step++;
+        return step < expressions.size() ? expressions[step] : NO_NODE;
+    }
+
+    NodeIndex visit_call(const FlatFunction &f, NodeIndex n,
+                         EvalFrame &frame, double &value) {
+        auto args = f.children_of(n);
+        auto step = frame.step++;
+
+        const FlatFunction *definition = nullptr;
+        if (index(f.symbol(n)) < definitions.size())
+            definition = &definitions[index(f.symbol(n))];
+
+        if (step == 0) {
+            if (!definition || definition->is_extern() ||
+                definition->parameters.size() != args.size())
+                return fail();
+            frame.first_value = values.size();
+        } else if (step <= args.size()) {
+            values.push_back(value);
+        } else {
+            // Body is done, its value is the call's
+            arguments.resize(frame.call_args);
+            locals.resize(frame.call_locals);
+            return NO_NODE;
+        }
+
+        if (step < args.size())
+            return args[step];
+
+        frame.call_args = arguments.size();
+        frame.call_locals = locals.size();
+        arguments.append(values.begin() + frame.first_value, values.end());
+        values.resize(frame.first_value);
+
+        callee = definition;
+        return definition->body;
+    }
+
+    // Parameters assigned to are locals too, so the arguments stay as passed
+    NodeIndex visit_assign(const FlatFunction &f, NodeIndex n,
+                           EvalFrame &frame, double &value) {
+        if (frame.step++ == 0)
+            return f.children_of(n)[0];
+
+        if (auto *variable = assigned(frame, f.symbol(n)))
+            *variable = value;
+        else
+            locals.emplace_back(f.symbol(n), value);
+        return NO_NODE;
+    }
+
+    NodeIndex visit_while(const FlatFunction &f, NodeIndex n,
+                          EvalFrame &frame, double &value) {
+        auto parts = f.children_of(n);
+
+        // Condition at step 0, then body and condition again, alternately
+        auto step = frame.step++;
+        if (step % 2 == 0)
+            return parts[0];
+        if (!std::isnan(value) && value != 0) // same as 'if'
+            return parts[1];
+
+        value = 0;
+        return NO_NODE;
+    }
+
+  private:
+    // Value of a variable assigned to in the function of 'frame', if it has
+    // been assigned yet
+    double *assigned(const EvalFrame &frame, Symbol name) {
+        for (auto i = frame.locals; i < locals.size(); ++i) {
+            if (locals[i].first == name)
+                return &locals[i].second;
+        }
+        return nullptr;
+    }
+
+    NodeIndex fail() {
+        failed = true;
+        return NO_NODE;
+    }
+};
+} // namespace
+
+void ConstantEvaluator::define(const FlatFunction &f,
+                               llvm::ArrayRef<Symbol> parameters) {
+    auto &definition = symbol_slot(definitions, f.name);
+    definition = f;
+    definition.parameters.assign(parameters.begin(), parameters.end());
+}
+
+std::optional<double>
+ConstantEvaluator::call(Symbol callee, llvm::ArrayRef<double> args) const {
+    if (index(callee) >= definitions.size())
+        return std::nullopt;
+
+    auto &definition = definitions[index(callee)];
+    if (definition.is_extern() || definition.parameters.size() != args.size())
+        return std::nullopt;
+
+    return run(definition, args);
+}
+
+std::optional<double>
+ConstantEvaluator::evaluate(const FlatFunction &f) const {
+    // Not compiled yet, and codegen would fail
+    if (f.is_extern() || !f.parameters.empty() ||
+        read_before_assignment(f) != NO_NODE)
+        return std::nullopt;
+
+    return run(f, {});
+}
+
+std::optional<double>
+ConstantEvaluator::run(const FlatFunction &f,
+                       llvm::ArrayRef<double> args) const {
+    return Evaluation(definitions, fuel).run(f, args);
+}
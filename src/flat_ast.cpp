@@ -0,0 +1,201 @@
+#include "flat_ast.hpp"
+#include "ast.hpp"
+
+#include <cstdint>
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallVector.h>
+
+NodeIndex FlatFunction::add(NodeKind kind, uint32_t operand,
+                            llvm::ArrayRef<NodeIndex> node_children) {
+    kinds.push_back(kind);
+    operands.push_back(operand);
+    first_child.push_back(children.size());
+    child_count.push_back(node_children.size());
+    children.insert(children.end(), node_children.begin(),
+                    node_children.end());
+
+    return kinds.size() - 1;
+}
+
+NodeIndex FlatFunction::add_number(double value, ValueType type,
+                                   bool fraction) {
+    numbers.push_back(value);
+    number_types.push_back(type);
+    number_fractions.push_back(fraction);
+    return add(NodeKind::NUMBER, numbers.size() - 1);
+}
+
+void FlatFunction::clear() {
+    name = Symbol::EMPTY;
+    parameters.clear();
+    parameter_types.clear();
+    return_type = ValueType::ANY;
+    body = NO_NODE;
+    fp_mode = FPMode::DEFAULT;
+    kinds.clear();
+    operands.clear();
+    first_child.clear();
+    child_count.clear();
+    children.clear();
+    numbers.clear();
+    number_types.clear();
+    number_fractions.clear();
+}
+
+bool FlatFunction::assigns(Symbol name) const {
+    for (NodeIndex n = 0; n < size(); ++n) {
+        if (kinds[n] == NodeKind::ASSIGN && symbol(n) == name)
+            return true;
+    }
+    return false;
+}
+
+NodeIndex read_before_assignment(const FlatFunction &f) {
+    llvm::SmallVector<Symbol, 8> assigned;
+    llvm::SmallVector<NodeIndex, 8> unassigned_reads;
+    auto is_assigned = [&](Symbol name) {
+        return llvm::is_contained(assigned, name);
+    };
+
+    for (NodeIndex n = 0; n < f.size(); ++n) {
+        if (f.kinds[n] == NodeKind::ASSIGN && !is_assigned(f.symbol(n)))
+            assigned.push_back(f.symbol(n));
+        else if (f.kinds[n] == NodeKind::VARIABLE &&
+                 !is_assigned(f.symbol(n)) &&
+                 !llvm::is_contained(f.parameters, f.symbol(n)))
+            unassigned_reads.push_back(n);
+    }
+
+    // Those never assigned are unknown variables, left to codegen to report
+    for (auto n : unassigned_reads) {
+        if (is_assigned(f.symbol(n)))
+            return n;
+    }
+    return NO_NODE;
+}
+
+namespace {
+// Appends children of a node, in the order they are flattened (and evaluated)
+struct ChildrenOf : ExprVisitor<ChildrenOf> {
+    using Out = llvm::SmallVectorImpl<const ExprAST *>;
+
+    void visit_unary(const UnaryExprAST *node, Out &out) {
+        out.push_back(node->operand);
+    }
+    void visit_binary(const BinaryExprAST *node, Out &out) {
+        out.append({node->lhs, node->rhs});
+    }
+    void visit_if(const IfExprAST *node, Out &out) {
+        out.append({node->condition, node->then_, node->else_});
+    }
+    void visit_block(const BlockAST *node, Out &out) {
+        out.append(node->expressions.begin(), node->expressions.end());
+    }
+    void visit_call(const FunctionCallAST *node, Out &out) {
+        out.append(node->args.begin(), node->args.end());
+    }
+    void visit_assign(const AssignAST *node, Out &out) {
+        out.push_back(node->value);
+    }
+    void visit_while(const WhileAST *node, Out &out) {
+        out.append({node->condition, node->body});
+    }
+    void visit_node(const ExprAST *, Out &) {} // leaves
+};
+
+// Appends the flat node, its children are already flattened, at 'children'
+struct FlatNodeOf : ExprVisitor<FlatNodeOf, NodeIndex> {
+    using Children = llvm::ArrayRef<NodeIndex>;
+
+    NodeIndex visit_number(const NumberAST *node, FlatFunction &out,
+                           Children) {
+        return out.add_number(node->value, node->type, node->fraction);
+    }
+    NodeIndex visit_variable(const VariableAST *node, FlatFunction &out,
+                             Children) {
+        return out.add(NodeKind::VARIABLE, index(node->var_name));
+    }
+    NodeIndex visit_unary(const UnaryExprAST *node, FlatFunction &out,
+                          Children children) {
+        return out.add(NodeKind::UNARY, static_cast<uint8_t>(node->opr),
+                       children);
+    }
+    NodeIndex visit_binary(const BinaryExprAST *node, FlatFunction &out,
+                           Children children) {
+        return out.add(NodeKind::BINARY, static_cast<uint8_t>(node->opr),
+                       children);
+    }
+    NodeIndex visit_if(const IfExprAST *, FlatFunction &out,
+                       Children children) {
+        return out.add(NodeKind::IF, 0, children);
+    }
+    NodeIndex visit_block(const BlockAST *, FlatFunction &out,
+                          Children children) {
+        return out.add(NodeKind::BLOCK, 0, children);
+    }
+    NodeIndex visit_call(const FunctionCallAST *node, FlatFunction &out,
+                         Children children) {
+        return out.add(NodeKind::CALL, index(node->callee), children);
+    }
+    NodeIndex visit_assign(const AssignAST *node, FlatFunction &out,
+                           Children children) {
+        return out.add(NodeKind::ASSIGN, index(node->variable), children);
+    }
+    NodeIndex visit_while(const WhileAST *, FlatFunction &out,
+                          Children children) {
+        return out.add(NodeKind::WHILE, 0, children);
+    }
+};
+} // namespace
+
+NodeIndex flatten(const ExprAST *root, FlatFunction &out) {
+    // Nodes waiting for their children to be flattened, and the flattened
+    // nodes whose parent isn't yet, a node's children are at the end of
+    // 'done' once it's back on top of 'pending'
+    struct Pending {
+        const ExprAST *node;
+        size_t first_done = SIZE_MAX; // SIZE_MAX till children are pushed
+    };
+    llvm::SmallVector<Pending, 32> pending = {{root}};
+    llvm::SmallVector<NodeIndex, 32> done;
+    llvm::SmallVector<const ExprAST *, 8> children;
+
+    while (!pending.empty()) {
+        auto &top = pending.back();
+        if (top.first_done == SIZE_MAX) {
+            top.first_done = done.size();
+
+            // In reverse, so the first child is on top, and flattened first
+            children.clear();
+            ChildrenOf().visit(top.node, children);
+            for (auto it = children.rbegin(); it != children.rend(); ++it)
+                pending.push_back({*it});
+            continue;
+        }
+
+        auto first_done = top.first_done;
+        auto index = FlatNodeOf().visit(
+            top.node, out,
+            llvm::ArrayRef<NodeIndex>(done).drop_front(first_done));
+        pending.pop_back();
+
+        done.resize(first_done);
+        done.push_back(index);
+    }
+
+    return done.back();
+}
+
+void FunctionPrototypeAST::flatten(FlatFunction &out) const {
+    out.name = function_name;
+    out.parameters.assign(parameter_names.begin(), parameter_names.end());
+    out.parameter_types.assign(parameter_types.begin(), parameter_types.end());
+    out.return_type = return_type;
+}
+
+void FunctionAST::flatten(FlatFunction &out) const {
+    prototype->flatten(out);
+    out.fp_mode = fp_mode;
+    out.body = ::flatten(block, out);
+}
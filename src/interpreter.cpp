@@ -1,10 +1,22 @@
 #include "interpreter.hpp"
 #include "ast.hpp"
+#include "evaluate.hpp"
 #include "lexer.hpp"
+#include "multiversion.hpp"
+#include "optimise.hpp"
+#include "promote.hpp"
+#include "purity.hpp"
+#include "specialise.hpp"
+#include "tail_calls.hpp"
+#include "thread_pool.hpp"
+#include "types.hpp"
 #include "utf8.hpp"
 #include "visualise.hpp"
+#include <algorithm>
+#include <cctype>
 #include <exception>
 #include <iostream>
+#include <sstream>
 
 #include <llvm/Support/raw_ostream.h>
 #include <rang.hpp>
@@ -13,152 +25,446 @@ extern Ptr<llvm::LLVMContext> LContext;
 extern Ptr<llvm::IRBuilder<>> LBuilder;
 extern Ptr<llvm::Module> LModule;
 
-Ptr<FunctionAST> HandleFunctionDefinition(bool print_ir) {
-    auto expr = parseFunctionExpr();
-    if (expr) {
-        // std::cout << "Successfully parsed a function body" << std::endl;
+using std::holds_alternative;
+
+ItemKind top_level_kind(const Token &token) {
+    return std::visit(
+        overload{
+            [](const TOK_EOF &) { return ItemKind::END; },
+            [](const TOK_EXTERN &) { return ItemKind::EXTERN; },
+            [](const TOK_FN &) { return ItemKind::FUNCTION; },
+            [](const TOK_OTHER &t) {
+                return t.c == ';' ? ItemKind::SEPARATOR : ItemKind::EXPRESSION;
+            },
+            [](const auto &) { return ItemKind::EXPRESSION; },
+        },
+        token);
+}
+
+template <class Parse>
+static bool parse_definition(Lexer &lexer, Arena &arena, FlatFunction &flat,
+                             bool optimise_ast, Parse parse) {
+    auto expr = parse(lexer, arena);
+    if (!expr) {
+        diagnostics() << "Failed to parse... Skipping" << std::endl;
+        lexer.advance();
+        return false;
+    }
+
+    flat.clear();
+    expr->flatten(flat);
+    if (optimise_ast)
+        optimise(flat);
+    return true;
+}
+
+bool ParseTopLevelItem(Lexer &lexer, Arena &arena, ItemKind kind,
+                       FlatFunction &flat, bool optimise_ast) {
+    switch (kind) {
+    case ItemKind::END:
+        return false;
+    case ItemKind::SEPARATOR:
+        lexer.advance();
+        return false;
+    case ItemKind::EXTERN:
+        return parse_definition(lexer, arena, flat, optimise_ast,
+                                parseExternPrototypeExpr);
+    case ItemKind::FUNCTION:
+        return parse_definition(lexer, arena, flat, optimise_ast,
+                                parseFunctionExpr);
+    case ItemKind::EXPRESSION:
+        return parse_definition(lexer, arena, flat, optimise_ast,
+                                parseTopLevelExpr);
+    }
+    return false;
+}
+
+/**
+ * Codegen the integer copy of 'flat' (see promote.hpp) compiled as 'func',
+ * if it has one, and make 'func' call it
+ *
+ * @returns the copy, or nullptr
+ */
+static llvm::Function *promote_definition(const FlatFunction &flat,
+                                          llvm::Function &func,
+                                          llvm::ArrayRef<Symbol> parameters,
+                                          DefinitionPasses passes) {
+    auto &promoter = *passes.promoter;
+    auto promotion = promoter.promote(flat, parameters);
+    if (!promotion)
+        return nullptr;
+
+    auto *integer = codegen(promotion->copy, promotion->types);
+    if (!integer)
+        return nullptr;
+    if (passes.tail_calls)
+        passes.tail_calls->eliminate_recursion(*integer);
+
+    // Only called from 'func' and other copies
+    integer->setLinkage(llvm::Function::InternalLinkage);
+    guard_promotion(func, *integer);
+    promoter.promoted(flat, *promotion);
+    return integer;
+}
+
+static const FlatFunction *codegen_definition(const FlatFunction &flat,
+                                              bool print_ir, bool anonymous,
+                                              DefinitionPasses passes) {
+    // Before its own codegen, which declares it
+    bool untyped = is_untyped(flat, declared_function);
+
+    if (auto *FnIR = codegen(flat)) {
+        bool defined = !anonymous && !flat.is_extern() && untyped;
+        auto parameters = declared_parameters(flat.name);
+
+        // Before the guard calling its integer copy is added
+        if (passes.tail_calls && !anonymous && !flat.is_extern())
+            passes.tail_calls->eliminate_recursion(*FnIR);
+
+        llvm::Function *integer = nullptr;
+        if (defined && passes.promoter)
+            integer = promote_definition(flat, *FnIR, parameters, passes);
 
         // Pretty print LLVM IR
-        if (auto *FnIR = expr->codegen()) {
-            if (print_ir)
-                FnIR->print(llvm::errs());
-            fprintf(stderr, "\n");
-            // FnIR->viewCFG();
+        if (print_ir) {
+            FnIR->print(llvm::errs());
+            if (integer)
+                integer->print(llvm::errs());
         }
+        fprintf(stderr, "\n");
+        // FnIR->viewCFG();
 
-    } else {
-        std::cerr << "Failed to parse... Skipping" << std::endl;
-        CurrentToken = get_next_token();
+        // Remove the anonymous expression.
+        if (anonymous) {
+            FnIR->eraseFromParent();
+        } else if (defined) {
+            if (passes.evaluator)
+                passes.evaluator->define(flat, parameters);
+            if (passes.specialiser)
+                passes.specialiser->define(flat, parameters);
+        }
     }
-    return expr;
+    return &flat;
 }
 
-Ptr<FunctionPrototypeAST> HandleExtern(bool print_ir) {
-    auto expr = parseExternPrototypeExpr();
-    if (expr) {
-        // std::cout << "Successfully parsed an extern prototype" << std::endl;
+// A call having only numbers as arguments
+static bool has_constant_call(const FlatFunction &flat) {
+    auto is_number = [&](NodeIndex n) {
+        return flat.kinds[n] == NodeKind::NUMBER;
+    };
+    for (NodeIndex n = 0; n < flat.size(); ++n) {
+        auto args = flat.children_of(n);
+        if (flat.kinds[n] == NodeKind::CALL &&
+            std::all_of(args.begin(), args.end(), is_number))
+            return true;
+    }
+    return false;
+}
 
-        // Pretty print LLVM IR
-        if (auto *FnIR = expr->codegen()) {
-            if (print_ir)
-                FnIR->print(llvm::errs());
-            fprintf(stderr, "\n");
+ConstantNames::ConstantNames(std::string_view file_stem) {
+    // Only what a C identifier can have
+    for (char c : file_stem)
+        stem += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+}
+
+std::string ConstantNames::next() {
+    return "saras_expr_" + stem + "_" + std::to_string(expressions++);
+}
+
+/**
+ * Compile-time evaluation of a definition, before its codegen: calls in it
+ * with constant arguments become their values, and a top-level expression
+ * whose value is known becomes an exported constant instead, named by
+ * 'names' (if passed)
+ *
+ * @returns true if it became a constant, so there's nothing to codegen
+ */
+static bool evaluate_definition(FlatFunction &flat, bool anonymous,
+                                ConstantEvaluator &evaluator,
+                                ConstantNames *names) {
+    // The evaluator computes with doubles
+    bool untyped = is_untyped(flat, declared_function);
+
+    if (anonymous && names) {
+        auto name = names->next();
+        if (auto value = untyped ? evaluator.evaluate(flat) : std::nullopt) {
+            codegen_constant(name, *value);
+            return true;
         }
+    }
+
+    if (untyped && has_constant_call(flat)) {
+        optimise(flat, [&](Symbol callee, llvm::ArrayRef<double> args) {
+            return evaluator.call(callee, args);
+        });
+    }
+    return false;
+}
 
+/**
+ * Point calls in 'flat' with constant arguments to specialised copies (see
+ * specialise.hpp), and codegen the new copies. Copies are all declared
+ * first, since they can call each other
+ */
+static void specialise_definition(FlatFunction &flat, bool print_ir,
+                                  DefinitionPasses passes) {
+    std::vector<FlatFunction> copies;
+    if (passes.evaluator) {
+        auto &evaluator = *passes.evaluator;
+        passes.specialiser->specialise_calls(
+            flat, copies, [&](Symbol callee, llvm::ArrayRef<double> args) {
+                return evaluator.call(callee, args);
+            });
     } else {
-        std::cerr << "Failed to parse... Skipping" << std::endl;
-        CurrentToken = get_next_token();
+        passes.specialiser->specialise_calls(flat, copies);
     }
-    return expr;
+
+    // Only called from this module, so LLVM is free to inline or drop them
+    for (auto &copy : copies) {
+        FlatFunction prototype;
+        prototype.name = copy.name;
+        prototype.parameters = copy.parameters;
+        prototype.parameter_types = copy.parameter_types;
+        prototype.return_type = copy.return_type;
+        codegen(prototype)->setLinkage(llvm::Function::InternalLinkage);
+    }
+    for (auto &copy : copies)
+        codegen_definition(copy, print_ir, false, passes);
 }
 
-// Top level parsing
-Ptr<FunctionAST> HandleTopLevelExpression(bool print_ir) {
-    auto expr = parseTopLevelExpr();
-    if (expr) {
-        // std::cout << "Successfully parsed a top level expression" <<
-        // std::endl;
+void HandleTopLevelItem(ItemKind kind, FlatFunction *flat, bool parser_mode,
+                        bool print_ir, DefinitionPasses passes) {
+    bool anonymous = kind == ItemKind::EXPRESSION;
+    if (flat && passes.evaluator && kind != ItemKind::EXTERN &&
+        evaluate_definition(*flat, anonymous, *passes.evaluator,
+                            passes.constant_names)) {
+        visualise_ast(flat);
+        return;
+    }
+    // Not in a top-level expression, it's erased after codegen anyway
+    if (flat && passes.specialiser && kind == ItemKind::FUNCTION)
+        specialise_definition(*flat, print_ir, passes);
 
-        // Pretty print LLVM IR
-        if (auto *FnIR = expr->codegen()) {
-            if (print_ir)
-                FnIR->print(llvm::errs());
-            fprintf(stderr, "\n");
+    switch (kind) {
+    case ItemKind::END:
+        if (parser_mode) {
+            std::cout << "Acting for EOF" << std::endl;
+        }
+        break;
+    case ItemKind::SEPARATOR:
+        break;
+    case ItemKind::EXTERN:
+        visualise_ast(flat ? codegen_definition(*flat, print_ir, false,
+                                                passes)
+                           : nullptr);
+        if (parser_mode) {
+            std::cout << "Saved parsed AST for extern declaration"
+                      << std::endl;
+        }
+        break;
+    case ItemKind::FUNCTION:
+        visualise_ast(flat ? codegen_definition(*flat, print_ir, false,
+                                                passes)
+                           : nullptr);
+        if (parser_mode) {
+            std::cout << "Saved parsed AST for function" << std::endl;
+        }
+        break;
+    case ItemKind::EXPRESSION:
+        visualise_ast(flat ? codegen_definition(*flat, print_ir, true,
+                                                passes)
+                           : nullptr);
+        if (parser_mode) {
+            std::cout << "Saved parsed AST for top-level expression"
+                      << std::endl;
+        }
+        break;
+    }
+}
 
-            // Remove the anonymous expression.
-            FnIR->eraseFromParent();
+namespace {
+// Top-level item parsed on a worker, to be handled later, in order
+struct ParsedItem {
+    ItemKind kind;
+    bool parsed = false;
+    bool threw = false;      // message is at end of 'diagnostics'
+    std::string diagnostics; // printed before handling the item
+    FlatFunction flat;
+};
+
+// Items parsed from 'start' till the first one at/after 'end_token'
+struct Segment {
+    Lexer::Checkpoint start, end;
+    size_t end_token;
+    std::vector<ParsedItem> items;
+};
+} // namespace
+
+static void parse_segment(const Lexer &lexer, Segment &segment,
+                          bool optimise_ast) {
+    auto part = lexer.fork(segment.start);
+    Arena arena;
+
+    segment.items.clear();
+    while (part.checkpoint().replayed - 1 < segment.end_token) {
+        auto &item = segment.items.emplace_back();
+        item.kind = top_level_kind(part.current());
+
+        std::ostringstream messages;
+        {
+            DiagnosticsTo redirect(messages);
+            try {
+                item.parsed = ParseTopLevelItem(part, arena, item.kind,
+                                                item.flat, optimise_ast);
+            } catch (std::string &e) {
+                messages << e << std::endl;
+                item.threw = true;
+            } catch (std::exception &e) {
+                messages << e.what() << std::endl;
+                item.threw = true;
+            }
         }
-    } else {
-        std::cerr << "Failed to parse... Skipping" << std::endl;
-        CurrentToken = get_next_token();
+        item.diagnostics = messages.str();
+        arena.reset();
+
+        if (item.kind == ItemKind::END)
+            break;
     }
-    return expr;
+    segment.end = part.checkpoint();
 }
 
-void run_interpreter(std::unordered_set<std::string> options) {
+/**
+ * Same as the loop in run_interpreter(), but parses on the pool
+ *
+ * Tokens are split into segments, each starting at a 'fn' or 'extern' token,
+ * and each segment is parsed into its own items (speculatively, assuming
+ * parsing reaches its first token with no item in progress). Then items are
+ * handled (codegen etc.) in order, on this thread. When the previous segment
+ * ended elsewhere than where the next one started (for eg. a failed parse
+ * skipped the 'fn' token), the next one is parsed again, from where the
+ * previous actually ended. So output is the same as parsing one by one
+ */
+static void run_parallel(Lexer &lexer, ThreadPool &pool, bool parser_mode,
+                         bool print_ir, bool print_prompt, bool optimise_ast,
+                         DefinitionPasses passes) {
+    // Few segments per thread, for balancing, but not too small
+    constexpr size_t MIN_SEGMENT_TOKENS = 4096;
+    auto num_segments = std::clamp<size_t>(
+        lexer.size() / MIN_SEGMENT_TOKENS, 1, size_t(pool.size()) * 8);
+
+    std::vector<Segment> segments(1);
+    segments[0].start = lexer.checkpoint();
+    for (size_t i = 1; i < num_segments; ++i) {
+        auto t = std::max(lexer.size() * i / num_segments,
+                          segments.back().start.replayed);
+        while (t < lexer.size() && !holds_alternative<TOK_FN>(lexer.token(t)) &&
+               !holds_alternative<TOK_EXTERN>(lexer.token(t)))
+            ++t;
+        if (t == lexer.size())
+            break;
+
+        segments.back().end_token = t;
+        segments.emplace_back().start = lexer.checkpoint_at(t);
+    }
+    segments.back().end_token = lexer.size();
+
+    pool.parallel_for(segments.size(), [&](size_t i) {
+        parse_segment(lexer, segments[i], optimise_ast);
+    });
+
+    auto at = segments[0].start;
+    for (auto &segment : segments) {
+        if (segment.start != at) {
+            segment.start = at;
+            parse_segment(lexer, segment, optimise_ast);
+        }
+
+        for (auto &item : segment.items) {
+            std::cerr << item.diagnostics;
+            if (!item.threw) {
+                try {
+                    HandleTopLevelItem(item.kind,
+                                       item.parsed ? &item.flat : nullptr,
+                                       parser_mode, print_ir, passes);
+                } catch (std::string &e) {
+                    std::cerr << e << std::endl;
+                } catch (std::exception &e) {
+                    std::cerr << e.what() << std::endl;
+                }
+            }
+
+            if (print_prompt)
+                std::cout << rang::fg::yellow << "--saras--> "
+                          << rang::style::reset;
+        }
+
+        at = segment.end;
+        segment.items = {}; // free the flattened functions
+    }
+}
+
+void run_interpreter(Lexer &lexer, std::unordered_set<std::string> options,
+                     ThreadPool *pool, DefinitionPasses passes,
+                     const PipelineOptions &pipeline) {
     bool parser_mode = options.find("parser-mode") != options.end();
     bool no_print_ir = options.find("no-print-ir") != options.end();
     bool no_print_prompt = options.find("no-print-prompt") != options.end();
-
-    bool EofEncountered = false;
-    auto visiter_run = overload{
-        [&](TOK_EOF &t) {
-            if (parser_mode) {
-                std::cout << "Acting for EOF" << std::endl;
-            }
-            EofEncountered = true;
-        },
-        [&](TOK_EXTERN &t) {
-            visualise_ast(HandleExtern(!parser_mode && !no_print_ir).get());
-            if (parser_mode) {
-                std::cout << "Saved parsed AST for extern declaration"
-                          << std::endl;
-            }
-        },
-        [&](TOK_FN &t) {
-            visualise_ast(
-                HandleFunctionDefinition(!parser_mode && !no_print_ir).get());
-            if (parser_mode) {
-                std::cout << "Saved parsed AST for function" << std::endl;
-            }
-        },
-        [&](TOK_KEYWORDS &t) {
-            visualise_ast(
-                HandleTopLevelExpression(!parser_mode && !no_print_ir).get());
-            if (parser_mode) {
-                std::cout << "Saved parsed AST for top-level expression"
-                          << std::endl;
-            }
-        },
-        [&](TOK_OTHER &t) {
-            if (t == ';') {
-                CurrentToken = get_next_token();
-                return;
-            }
-            visualise_ast(
-                HandleTopLevelExpression(!parser_mode && !no_print_ir).get());
-            if (parser_mode) {
-                std::cout << "Saved parsed AST for top-level expression"
-                          << std::endl;
-            }
-        },
-        [&](TOK_NUMBER &t) {
-            visualise_ast(
-                HandleTopLevelExpression(!parser_mode && !no_print_ir).get());
-            if (parser_mode) {
-                std::cout << "Saved parsed AST for top-level expression"
-                          << std::endl;
-            }
-        },
-        [&](TOK_IDENTIFIER &t) {
-            visualise_ast(
-                HandleTopLevelExpression(!parser_mode && !no_print_ir).get());
-            if (parser_mode) {
-                std::cout << "Saved parsed AST for top-level expression"
-                          << std::endl;
-            }
-        },
-    };
+    bool print_ir = !parser_mode && !no_print_ir;
+    // Parser mode shows the AST as it was parsed
+    bool optimise_ast =
+        !parser_mode && options.find("no-ast-opt") == options.end();
+    if (!optimise_ast)
+        passes.specialiser = nullptr;
 
     // if (!parser_mode)
     if (!no_print_prompt)
         std::cout << rang::fg::yellow << "--saras--> " << rang::style::reset;
 
-    CurrentToken = get_next_token();
-    while (!EofEncountered) {
-        try {
-            std::visit(visiter_run, CurrentToken);
+    lexer.advance();
+    if (pool && lexer.replaying()) {
+        run_parallel(lexer, *pool, parser_mode, print_ir, !no_print_prompt,
+                     optimise_ast, passes);
+    } else {
+        // AST of each top-level item is allocated here, and freed (all at
+        // once) before parsing the next one, same for its flattened form
+        Arena arena;
+        FlatFunction flat;
+
+        bool EofEncountered = false;
+        while (!EofEncountered) {
+            auto kind = top_level_kind(lexer.current());
+            EofEncountered = kind == ItemKind::END;
+            try {
+                bool parsed =
+                    ParseTopLevelItem(lexer, arena, kind, flat, optimise_ast);
+                HandleTopLevelItem(kind, parsed ? &flat : nullptr,
+                                   parser_mode, print_ir, passes);
 
-        } catch (std::string &e) {
-            std::cerr << e << std::endl;
-        } catch (std::exception &e) {
-            std::cerr << e.what() << std::endl;
+            } catch (std::string &e) {
+                std::cerr << e << std::endl;
+            } catch (std::exception &e) {
+                std::cerr << e.what() << std::endl;
+            }
+
+            arena.reset();
+
+            if (!no_print_prompt)
+                std::cout << rang::fg::yellow << "--saras--> "
+                          << rang::style::reset;
         }
+    }
 
-        if (!no_print_prompt)
-            std::cout << rang::fg::yellow << "--saras--> "
-                      << rang::style::reset;
+    // All definitions are known by now, even those after their 'extern'
+    infer_function_attributes(*LModule);
+    // Before multiversioning, so each version calls others the same way
+    if (passes.tail_calls)
+        passes.tail_calls->mark_tail_calls(*LModule);
+    if (pipeline.multiversion && pipeline.target_machine &&
+        !multiversion(*LModule, *pipeline.target_machine)) {
+        std::cerr << "Multiversioning needs an x86-64 ELF target, skipping it"
+                  << std::endl;
     }
+    run_pipeline(*LModule, pipeline);
 
     if (!no_print_ir && !no_print_prompt) {
         std::cout << std::endl
@@ -169,6 +475,16 @@ void run_interpreter(std::unordered_set<std::string> options) {
         LModule->print(llvm::errs(), nullptr);
     }
 
+    if (passes.specialiser &&
+        options.find("report-specialisations") != options.end())
+        passes.specialiser->report(std::cerr);
+    if (passes.promoter &&
+        options.find("report-int-promotions") != options.end())
+        passes.promoter->report(std::cerr);
+    if (passes.tail_calls &&
+        options.find("report-tail-calls") != options.end())
+        passes.tail_calls->report(std::cerr);
+
     if (parser_mode && !no_print_prompt) {
         std::cout << rang::style::italic << rang::fg::green
                   << "Please look for graph*.png, for outputted abstract "
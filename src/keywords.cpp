@@ -0,0 +1,104 @@
+#include "keywords.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+KeywordTable LangKeywords;
+
+KeywordTable::KeywordTable()
+    : keys(BUILTIN_KEYWORDS.cbegin(), BUILTIN_KEYWORDS.cend()),
+      slots(BUILTIN_KEYWORD_TABLE.slots.cbegin(),
+            BUILTIN_KEYWORD_TABLE.slots.cend()),
+      seeds(BUILTIN_KEYWORD_TABLE.seeds.cbegin(),
+            BUILTIN_KEYWORD_TABLE.seeds.cend()),
+      built_keys(BUILTIN_KEYWORDS.size()) {}
+
+void KeywordTable::add_alias(std::string_view existing,
+                             std::string_view alias) {
+    insert(existing, alias);
+    rebuild();
+}
+
+void KeywordTable::load_alias_pack(const std::string &filename) {
+    std::ifstream fin(filename);
+    if (!fin) {
+        throw std::runtime_error("Could not open keyword alias pack: " +
+                                 filename);
+    }
+
+    try {
+        std::string line;
+        for (int line_no = 1; std::getline(fin, line); ++line_no) {
+            if (auto comment = line.find('#'); comment != std::string::npos)
+                line.erase(comment);
+
+            std::istringstream words(line);
+            std::string existing, alias, extra;
+            if (!(words >> existing))
+                continue; // empty line
+
+            if (!(words >> alias) || (words >> extra)) {
+                throw std::runtime_error(
+                    filename + ":" + std::to_string(line_no) +
+                    ": Expected \"<existing keyword> <alias>\"");
+            }
+
+            try {
+                insert(existing, alias);
+            } catch (const std::runtime_error &err) {
+                throw std::runtime_error(filename + ":" + std::to_string(line_no) +
+                                         ": " + err.what());
+            }
+        }
+    } catch (...) {
+        keys.resize(built_keys); // drop the partially loaded pack
+        throw;
+    }
+
+    rebuild();
+}
+
+Keyword KeywordTable::find_pending(std::string_view s) const {
+    for (auto i = built_keys; i < keys.size(); ++i) {
+        if (keys[i].spelling == s)
+            return keys[i].kind;
+    }
+    return find(s);
+}
+
+void KeywordTable::insert(std::string_view existing, std::string_view alias) {
+    auto kind = find_pending(existing);
+    if (kind == Keyword::NONE) {
+        throw std::runtime_error("\"" + std::string(existing) +
+                                 "\" is not a keyword");
+    }
+    if (find_pending(alias) != Keyword::NONE) {
+        throw std::runtime_error("\"" + std::string(alias) +
+                                 "\" is already a keyword");
+    }
+
+    alias_storage.emplace_back(alias);
+    keys.push_back({alias_storage.back(), kind});
+}
+
+void KeywordTable::rebuild() {
+    // Keep the table at most half full
+    size_t size = 1;
+    while (size < 2 * keys.size())
+        size *= 2;
+
+    std::vector<uint32_t> chain;
+    while (true) {
+        slots.resize(size);
+        seeds.resize(size);
+        chain.resize(keys.size() + size);
+
+        if (perfect_hash::build(keys.data(), keys.size(), slots, seeds, chain))
+            break;
+        size *= 2;
+    }
+
+    built_keys = keys.size();
+}
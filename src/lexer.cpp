@@ -1,12 +1,18 @@
 #include "lexer.hpp"
-#include "assert.hpp"
+#include "scanner.hpp"
+#include "thread_pool.hpp"
 #include "tokens.hpp"
 #include "utf8.hpp"
 #include "util.hpp"
 #include <algorithm>
 #include <cctype>
+#include <charconv>
 #include <cstdio>
-#include <istream>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <tuple>
 #include <variant>
 
 #include <iostream>
@@ -14,73 +20,402 @@
 
 using std::holds_alternative;
 
-extern std::basic_istream<char> *input;
+/**
+ * @returns byte at pos + ahead (as unsigned), or EOF once whole source is
+ * consumed */
+int Lexer::peek(size_t ahead) {
+    while (pos + ahead >= source.size()) {
+        if (!source.refill())
+            return EOF;
+    }
+    return static_cast<uint8_t>(source.data()[pos + ahead]);
+}
+
+/**
+ * Advance pos over a run of bytes, using one of the scanner:: kernels
+ *
+ * If the run continues till end of what has been read yet, refill and scan
+ * again, since a stream (eg. stdin) may have more
+ */
+void Lexer::advance_while(const char *(*kernel)(const char *, const char *)) {
+    do {
+        auto *data = source.data();
+        pos = kernel(data + pos, data + source.size()) - data;
+    } while (pos == source.size() && source.refill());
+}
+
+// Any byte of a multi-byte utf-8 character has its 8th bit set
+static inline bool is_not_ascii(int c) { return c >= 0x80; }
 
-Token get_next_token() {
-    static utf8::_char LastChar = char(' '); // UTF-8 character
-    utf8::string data_str;
+// Skip whitespaces, keeping track of lines passed
+void Lexer::skip_whitespace() {
+    auto start = pos;
+    advance_while(scanner::skip_whitespace);
 
-    /* Ignore all whitespaces (also true for first call to this function) */
-    while (utf8::isspace(LastChar)) {
-        LastChar = utf8::get_character(*input);
+    auto *data = source.data();
+    auto *nl = static_cast<const char *>(memchr(data + start, '\n', pos - start));
+    while (nl) {
+        ++line;
+        line_start = nl - data + 1;
+        nl = static_cast<const char *>(memchr(nl + 1, '\n', data + pos - nl - 1));
     }
+}
+
+// Span of the token from 'start' till pos
+SourceSpan Lexer::span_from(size_t start) {
+    if (column_pos < line_start) {
+        column_pos = line_start;
+        column = 1;
+    }
+
+    // Count utf-8 characters, ie. all bytes except continuation bytes
+    // (10xxxxxx)
+    auto *data = source.data();
+    for (; column_pos < start; ++column_pos)
+        column += (data[column_pos] & 0xC0) != 0x80;
+
+    return SourceSpan{static_cast<uint32_t>(start),
+                      static_cast<uint32_t>(pos - start), line, column};
+}
+
+void Lexer::reset() {
+    replay_chunk = replay_pos = replayed = replay_error = 0;
+    pos = line_start = column_pos = 0;
+    line = column = 1;
+    current_token = TOK_EOF{};
+}
+
+Token Lexer::lex() {
+    int c;
+
+    while (true) {
+        /* Ignore all whitespaces */
+        skip_whitespace();
+
+        c = peek();
+        if (c != '#')
+            break;
+
+        // it is a single-line comment, skip till end of line (case if it's
+        // EOF or not is handled after the loop)
+        advance_while(scanner::skip_comment);
+    }
+
+    auto start = pos;
+
+    if (c == EOF)
+        return TOK_EOF{span_from(start)};
 
     /* [A-Z|a-z] */
-    if (utf8::isalpha(LastChar) || utf8::is_not_ascii(LastChar)) {
-        /* [A-Z|a-z][A-Z|a-z|0-9|_]+ */
-        while (utf8::isalnum(LastChar) || utf8::is_not_ascii(LastChar) ||
-               LastChar == '_') {
-            data_str += LastChar;
-            LastChar = utf8::get_character(*input);
-        }
+    if (::isalpha(c) || is_not_ascii(c)) {
+        /* [A-Z|a-z][A-Z|a-z|0-9|_]+, scanned in place */
+        advance_while(scanner::scan_identifier);
 
-        if (data_str == "fn" || data_str == "प्रकर" || data_str == "ప్రక్రియ") {
-            return TOK_FN{};
-        } else if (data_str == "extern" || data_str == "बाहरीप्रकर" || data_str == "బాహ్య-ప్రక్రియ") {
-            return TOK_EXTERN{};
-        } else if (std::find(LANG_KEYWORDS.cbegin(), LANG_KEYWORDS.cend(),
-                             data_str) != LANG_KEYWORDS.cend()) {
-            return TOK_KEYWORDS{data_str};
+        auto *begin = source.data() + start, *end = source.data() + pos;
+        auto span = span_from(start);
+        if (scanner::validate_utf8(begin, end) != end)
+            throw LexError("Invalid UTF-8 in identifier", span);
+
+        auto text = std::string_view(begin, end - begin);
+        switch (auto kind = LangKeywords.find(text)) {
+        case Keyword::NONE:
+            return TOK_IDENTIFIER{Symbols.intern(text), span};
+        case Keyword::FN:
+            return TOK_FN{span};
+        case Keyword::EXTERN:
+            return TOK_EXTERN{span};
+        default:
+            return TOK_KEYWORDS{kind, span};
         }
+    } else if (::isdigit(c)) {
+        return lex_number(start);
+    }
+
+    // Now advance lexer pointer, next call should start after this character
+    ++pos;
+
+    return TOK_OTHER{static_cast<char>(c), span_from(start)};
+}
+
+/**
+ * Consume rest of a bad number literal (so that lexing can continue after
+ * it), and throw
+ */
+void Lexer::malformed_number(size_t start) {
+    while (true) {
+        advance_while(scanner::scan_identifier);
+        if (peek() != '.')
+            break;
+        ++pos;
+    }
+
+    auto span = span_from(start);
+    throw LexError("Malformed number \"" +
+                       std::string(source.view(start, span.length)) + "\"",
+                   span);
+}
+
+/**
+ * Scan a run of (hex) digits, '_' is allowed only in between digits
+ *
+ * @returns number of digits
+ */
+size_t Lexer::lex_digits(size_t start, bool hex) {
+    auto run_start = pos;
 
-        return TOK_IDENTIFIER{data_str};
-    } else if (utf8::isdigit(LastChar)) {
-        /* [0-9] */
-        data_str.clear();
-        data_str += LastChar;
+    if (hex) {
+        for (int c = peek(); ::isxdigit(c) || c == '_'; c = peek())
+            ++pos;
+    } else {
+        advance_while(scanner::scan_digits);
+    }
+
+    auto run = source.view(run_start, pos - run_start);
+    if (run.find('_') == std::string_view::npos)
+        return run.size(); // fast path, no separators
+
+    if (run.front() == '_' || run.back() == '_' ||
+        run.find("__") != std::string_view::npos)
+        malformed_number(start);
+
+    return run.size() - std::count(run.cbegin(), run.cend(), '_');
+}
+
+/**
+ * @matches:
+ * number
+ *   => digits [ '.' [digits] ] [ ('e'|'E') ['+'|'-'] digits ]
+ *   => ('0x'|'0X') hexdigits [ '.' [hexdigits] ] [ ('p'|'P') ['+'|'-'] digits ]
+ *
+ * Digits may be separated with '_', eg. 1_000_000.5, and it may be followed
+ * by a type suffix, eg. 1i64 (not part of this token)
+ *
+ * Parsed with std::from_chars, directly from source bytes (only copied if
+ * separators need to be removed), so it's correctly rounded, for hex floats
+ * too
+ */
+TOK_NUMBER Lexer::lex_number(size_t start) {
+    bool hex = peek() == '0' && (peek(1) == 'x' || peek(1) == 'X');
+    if (hex)
+        pos += 2;
+
+    auto mantissa_start = pos;
+    auto digits = lex_digits(start, hex);
+    if (peek() == '.') {
+        ++pos;
+        digits += lex_digits(start, hex);
+    }
+    if (digits == 0) // for eg. "0x"
+        malformed_number(start);
+
+    if (int e = peek(); hex ? (e == 'p' || e == 'P') : (e == 'e' || e == 'E')) {
+        ++pos;
+        if (peek() == '+' || peek() == '-')
+            ++pos;
+        if (lex_digits(start, false) == 0)
+            malformed_number(start);
+    }
 
-        LastChar = utf8::get_character(*input);
-        while (utf8::isdigit(LastChar) || (LastChar == '.')) {
-            data_str += LastChar;
-            LastChar = utf8::get_character(*input);
+    // A number can't be directly followed by these, for eg. "1.2.3", "1e",
+    // except by a type suffix
+    if (int c = peek(); (c == '.' || c == '_' || ::isalnum(c) ||
+                         is_not_ascii(c)) &&
+                        !at_type_suffix())
+        malformed_number(start);
+
+    auto text = source.view(mantissa_start, pos - mantissa_start);
+
+    std::string without_separators;
+    if (text.find('_') != std::string_view::npos) {
+        without_separators.reserve(text.size());
+        std::copy_if(text.cbegin(), text.cend(),
+                     std::back_inserter(without_separators),
+                     [](char c) { return c != '_'; });
+        text = without_separators;
+    }
+
+    double val = 0;
+    auto [end, err] = std::from_chars(
+        text.data(), text.data() + text.size(), val,
+        hex ? std::chars_format::hex : std::chars_format::general);
+
+    auto span = span_from(start);
+    if (err != std::errc() || end != text.data() + text.size()) {
+        throw LexError("Number out of range \"" +
+                           std::string(source.view(start, span.length)) + "\"",
+                       span);
+    }
+
+    return TOK_NUMBER{val, span};
+}
+
+/**
+ * A type suffix of a number is at pos, for eg. "i64" of "1i64". It's lexed as
+ * the next token, ie. an identifier right after the number, see
+ * parseNumberExpr()
+ */
+bool Lexer::at_type_suffix() {
+    for (auto *suffix : {"i64", "f32", "f64"}) {
+        if (peek() == suffix[0] && peek(1) == suffix[1] &&
+            peek(2) == suffix[2]) {
+            int c = peek(3);
+            return !(c == '_' || ::isalnum(c) || is_not_ascii(c));
         }
+    }
+    return false;
+}
+
+const Token &Lexer::replay() {
+    auto &errors = lexed->errors;
+    if (replay_error < errors.size() &&
+        errors[replay_error].before_token == replayed) {
+        throw errors[replay_error++].error;
+    }
+
+    // TOK_EOF (end of last chunk) keeps repeating once reached
+    if (replayed == lexed->size)
+        return lexed->chunks.back().back();
+
+    // Other chunks may even be empty (eg. only comments)
+    while (replay_pos == lexed->chunks[replay_chunk].size()) {
+        ++replay_chunk;
+        replay_pos = 0;
+    }
+
+    ++replayed;
+    return lexed->chunks[replay_chunk][replay_pos++];
+}
+
+// Chunk having token 'index', and index of the token in it, empty chunks have
+// same first_token as the next one, so upper_bound skips them
+static std::pair<size_t, size_t>
+locate_token(const std::vector<size_t> &first_token, size_t index) {
+    auto chunk =
+        std::upper_bound(first_token.begin(), first_token.end(), index) -
+        first_token.begin() - 1;
+    return {chunk, index - first_token[chunk]};
+}
 
-        return TOK_NUMBER{std::stod(data_str)};
-    } else if (LastChar == '#') { // it is a single-line comment
-        // std::getline(std::cin, DataStr);    // read the line
+const Token &Lexer::token(size_t index) const {
+    auto [chunk, pos] = locate_token(lexed->first_token, index);
+    return lexed->chunks[chunk][pos];
+}
+
+Lexer::Checkpoint Lexer::checkpoint_at(size_t index) const {
+    auto &errors = lexed->errors;
+    auto thrown = std::partition_point(
+        errors.begin(), errors.end(),
+        [&](const PendingError &e) { return e.before_token <= index; });
+    return {index + 1, size_t(thrown - errors.begin())};
+}
+
+Lexer Lexer::fork(const Checkpoint &from) const {
+    auto other = Lexer(SourceBuffer::from_view(source.data(), source.size()));
+    other.lexed = lexed;
+    other.replayed = from.replayed;
+    other.replay_error = from.replay_error;
+    std::tie(other.replay_chunk, other.replay_pos) =
+        locate_token(lexed->first_token, from.replayed);
+    if (from.replayed > 0)
+        other.current_token = token(from.replayed - 1);
+    return other;
+}
 
-        while (!utf8::is_eof(LastChar) && LastChar != '\n' &&
-               LastChar != '\r') {
-            LastChar = utf8::get_character(*input);
+void Lexer::lex_chunk(const SourceBuffer &source, size_t begin, size_t end,
+                      std::vector<Token> &tokens,
+                      std::vector<PendingError> &errors) {
+    auto chunk = Lexer(SourceBuffer::from_view(source.data() + begin,
+                                               end - begin));
+
+    // Reserving is cheap, since pages of a vector are only touched once
+    // written, and saves copying the tokens on each regrowth (there are ~1
+    // token per 4 bytes in typical source)
+    tokens.reserve((end - begin) / 3 + 1);
+
+    while (true) {
+        try {
+            tokens.push_back(chunk.advance());
+        } catch (const LexError &err) {
+            errors.push_back({tokens.size(), err});
+            continue;
         }
 
-        // Case if it's EOF or not is handled by next call
-        return get_next_token();
-    } else if (utf8::is_eof(LastChar)) {
-        return TOK_EOF{};
+        if (holds_alternative<TOK_EOF>(tokens.back()))
+            break;
+    }
+}
+
+void Lexer::lex_parallel(ThreadPool &pool) {
+    source.read_all();
+
+    // Few chunks per thread, so a thread that finishes early picks up another
+    // one, but not too small, since each chunk has some fixed cost
+    constexpr size_t MIN_CHUNK = 256 * 1024;
+    auto num_chunks = std::clamp<size_t>(source.size() / MIN_CHUNK, 1,
+                                         size_t(pool.size()) * 4);
+
+    // Chunk boundaries, each just after a '\n'
+    std::vector<size_t> bounds = {0};
+    auto *data = source.data();
+    for (size_t i = 1; i < num_chunks; ++i) {
+        auto target = std::max(bounds.back(), source.size() * i / num_chunks);
+        auto *nl = static_cast<const char *>(
+            memchr(data + target, '\n', source.size() - target));
+        if (!nl)
+            break;
+        if (size_t(nl - data + 1) > bounds.back())
+            bounds.push_back(nl - data + 1);
+    }
+    if (bounds.back() != source.size() || bounds.size() == 1)
+        bounds.push_back(source.size());
+    num_chunks = bounds.size() - 1;
+
+    auto result = std::make_shared<Lexed>();
+    auto &chunks = result->chunks;
+    chunks.assign(num_chunks, {});
+    std::vector<std::vector<PendingError>> chunk_errors(num_chunks);
+    pool.parallel_for(num_chunks, [&](size_t i) {
+        lex_chunk(source, bounds[i], bounds[i + 1], chunks[i], chunk_errors[i]);
+    });
+
+    // Index of first token, and the line each chunk starts at. Every chunk
+    // ends with its TOK_EOF, which is at (1 + newlines in the chunk), and is
+    // dropped, except for the last chunk
+    auto &first_token = result->first_token;
+    first_token.assign(num_chunks, 0);
+    std::vector<uint32_t> first_line(num_chunks, 1);
+    for (size_t i = 0; i + 1 < num_chunks; ++i) {
+        first_line[i + 1] = first_line[i] + get_span(chunks[i].back()).line - 1;
+        chunks[i].pop_back();
+        first_token[i + 1] = first_token[i] + chunks[i].size();
     }
+    result->size = first_token.back() + chunks.back().size();
 
-    auto current = TOK_OTHER{LastChar};
+    auto relocate = [&](SourceSpan &span, size_t i) {
+        span.offset += bounds[i];
+        span.line += first_line[i] - 1;
+    };
 
-    // Now advance lexer pointer, next call should use a different value of
-    // LastChar
-    LastChar = utf8::get_character(*input);
+    pool.parallel_for(num_chunks, [&](size_t i) {
+        for (auto &tok : chunks[i])
+            std::visit([&](auto &t) { relocate(t.span, i); }, tok);
+    });
 
-    return current;
+    for (size_t i = 0; i < num_chunks; ++i) {
+        for (auto &[before_token, err] : chunk_errors[i]) {
+            auto span = err.span;
+            relocate(span, i);
+            result->errors.push_back(
+                {first_token[i] + before_token, LexError(err.message, span)});
+        }
+    }
+
+    lexed = std::move(result);
+    reset();
 }
 
-void dump_all_tokens() {
-    Token t = TOK_OTHER{' '};
+void dump_all_tokens(Lexer &lexer) {
+    Token t = TOK_OTHER{' ', SourceSpan{}};
 
     using namespace tabulate;
 
@@ -99,18 +434,31 @@ void dump_all_tokens() {
         overload{[](const TOK_EOF &t) -> utf8::string { return ""; },
                  [](const TOK_FN &t) -> utf8::string { return ""; },
                  [](const TOK_EXTERN &t) -> utf8::string { return ""; },
-                 [](const TOK_IDENTIFIER &t) { return t.identifier_str; },
-                 [](const TOK_KEYWORDS &t) { return t.str; },
+                 [&](const TOK_IDENTIFIER &t) {
+                     return utf8::string(lexer.text(t));
+                 },
+                 [&](const TOK_KEYWORDS &t) {
+                     return utf8::string(lexer.text(t));
+                 },
                  [](const TOK_NUMBER &t) { return std::to_string(t.val); },
                  [](const TOK_OTHER &t) { return utf8::to_string(t.c); }};
 
-    table.add_row({"Token", "  DataStr  "});
+    table.add_row({"Token", "  DataStr  ", "Line:Col"});
     while (!holds_alternative<TOK_EOF>(t)) {
-        t = get_next_token();
+        try {
+            t = lexer.advance();
+        } catch (const std::runtime_error &err) {
+            table.add_row({"ERROR", err.what(), ""});
+            continue;
+        }
         auto token_name = std::visit(visiter_tok_to_str, t);
         auto token_datastr = std::visit(visiter_datastr, t);
 
-        table.add_row({token_name, token_datastr});
+        auto span = get_span(t);
+        auto location =
+            std::to_string(span.line) + ":" + std::to_string(span.column);
+
+        table.add_row({token_name, token_datastr, location});
     }
 
     table[0]
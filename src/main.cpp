@@ -1,21 +1,30 @@
 #include "compiler.hpp"
+#include "evaluate.hpp"
 #include "interpreter.hpp"
+#include "keywords.hpp"
 #include "lexer.hpp"
+#include "pipeline.hpp"
+#include "promote.hpp"
+#include "source.hpp"
+#include "specialise.hpp"
+#include "tail_calls.hpp"
+#include "thread_pool.hpp"
 #include "util.hpp"
 #include <cxxopts.hpp>
 #include <rang.hpp>
 
+#include <cstdint>
 #include <filesystem>
-#include <fstream>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <unordered_set>
 
-Token CurrentToken;
 extern Ptr<llvm::LLVMContext> LContext;
 extern Ptr<llvm::IRBuilder<>> LBuilder;
 extern Ptr<llvm::Module> LModule;
 
-std::basic_istream<char> *input = &std::cin; // source code file, or std::cin
-
 int main(int argc, char *argv[]) {
     cxxopts::Options options("saras", "A compiler frontend");
 
@@ -27,7 +36,57 @@ int main(int argc, char *argv[]) {
         ("ir", "Stop at IR stage, prints LLVM Intermediate Representation for "
                 "all expressions and functions")
         ("no-print-ir", "Don't print IR in Interpreter mode (default mode)")
+        ("no-ast-opt", "Don't optimise the AST before codegen (constant "
+                       "folding, identities, common subexpressions)")
+        ("specialise-budget", "Specialise functions on constant arguments "
+                              "of their calls, with copies of up to N AST "
+                              "nodes in all (0 = don't)",
+                              cxxopts::value<size_t>()->default_value(
+                                  std::to_string(Specialiser::DEFAULT_BUDGET)))
+        ("report-specialisations", "Print the specialised copies of each "
+                                   "function, at the end")
+        ("no-int-promotion", "Don't compile copies of functions computing "
+                             "with whole numbers using i64s")
+        ("report-int-promotions", "Print the functions given an i64 copy, "
+                                  "or gaining too little for one, at the "
+                                  "end")
+        ("no-tail-calls", "Don't turn recursion in tail positions into "
+                          "loops, nor mark other tail calls")
+        ("report-tail-calls", "Print the loops and tail calls made in each "
+                              "function, at the end")
+        ("O,opt-level", "Optimise the IR at level 0, 1, 2, 3, s (size) or z "
+                        "(smaller size), for eg. -O2",
+                        cxxopts::value<std::string>()->default_value("0"))
+        ("print-pipeline", "Print the LLVM passes run for the -O level")
+        ("ir-stats", "Print size of each function before and after -O")
+        ("ffast-math", "Let floating point operations be reassociated, "
+                       "approximated etc. assuming no NaN or infinity, "
+                       "like C's -ffast-math")
+        ("fp-contract", "\"fast\" (or \"on\") lets a*b + c be a fused "
+                        "multiply-add, rounded once, \"off\" doesn't",
+                        cxxopts::value<std::string>()->default_value("off"))
         ("c,compile", "Compile provided filename", cxxopts::value<std::string>())
+        ("mcpu", "With -c, generate code for this CPU (for eg. haswell, "
+                 "x86-64-v3), \"native\" being this machine's, with all its "
+                 "features",
+                 cxxopts::value<std::string>()->default_value("generic"))
+        ("march", "With -c, generate code for this architecture (for eg. "
+                  "x86-64, aarch64) instead of this machine's",
+                  cxxopts::value<std::string>()->default_value("native"))
+        ("multiversion", "With -c, also compile each function for AVX2 and "
+                         "AVX-512, the version run being picked as per the "
+                         "CPU, when the program loads (x86-64 Linux only)")
+        ("eval-fuel", "With -c, evaluate top-level expressions, and calls with "
+                      "constant arguments, at compile time, giving up after N "
+                      "steps (0 = don't)",
+                      cxxopts::value<uint64_t>()->default_value(
+                          std::to_string(ConstantEvaluator::DEFAULT_FUEL)))
+        ("keywords", "Load keyword aliases from file, each line being "
+                     "\"<existing keyword> <alias>\", can be repeated",
+                     cxxopts::value<std::vector<std::string>>())
+        ("j,jobs", "Lex whole input upfront, in parallel chunks on N threads, "
+                   "and parse its definitions in parallel (0 = all cores)",
+                   cxxopts::value<unsigned>())
         ("h,help", "Print usage");
     // clang-format on
 
@@ -48,6 +107,20 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
+    if (result.count("keywords")) {
+        try {
+            for (auto &pack :
+                 result["keywords"].as<std::vector<std::string>>()) {
+                LangKeywords.load_alias_pack(pack);
+            }
+        } catch (const std::runtime_error &err) {
+            std::cerr << rang::style::bold << rang::fg::red
+                      << "Error: " << rang::style::reset << err.what()
+                      << std::endl;
+            return 1;
+        }
+    }
+
     // Initialise interpreter
     // Open a new context and module.
     LContext = std::make_unique<llvm::LLVMContext>();
@@ -56,11 +129,73 @@ int main(int argc, char *argv[]) {
     // Create a new builder for the module.
     LBuilder = std::make_unique<llvm::IRBuilder<>>(*LContext);
 
+    // source code from stdin, unless a file is passed with '-c'
+    auto stdin_lexer = Lexer(SourceBuffer::from_fd(STDIN_FILENO));
+
+    std::unique_ptr<ThreadPool> pool;
+    if (result.count("jobs"))
+        pool = std::make_unique<ThreadPool>(result["jobs"].as<unsigned>());
+
+    if (pool && !result.count("compile"))
+        stdin_lexer.lex_parallel(*pool);
+
+    // Options for run_interpreter(), common to all modes
+    std::unordered_set<std::string> run_options;
+    if (result.count("no-ast-opt"))
+        run_options.insert("no-ast-opt");
+    if (result.count("report-specialisations"))
+        run_options.insert("report-specialisations");
+    if (result.count("report-int-promotions"))
+        run_options.insert("report-int-promotions");
+    if (result.count("report-tail-calls"))
+        run_options.insert("report-tail-calls");
+
+    PipelineOptions pipeline;
+    if (auto level = parse_opt_level(result["opt-level"].as<std::string>())) {
+        pipeline.level = *level;
+    } else {
+        std::cerr << rang::style::bold << rang::fg::red
+                  << "Error: " << rang::style::reset
+                  << "Unknown optimisation level, see \"saras --help\""
+                  << std::endl;
+        return 1;
+    }
+    pipeline.print_pipeline = result.count("print-pipeline");
+    pipeline.print_stats = result.count("ir-stats");
+
+    // Functions with a [fast], [contract] or [strict] annotation keep it
+    auto fp_contract = result["fp-contract"].as<std::string>();
+    if (fp_contract != "off" && fp_contract != "on" && fp_contract != "fast") {
+        std::cerr << rang::style::bold << rang::fg::red
+                  << "Error: " << rang::style::reset
+                  << "--fp-contract should be fast, on or off" << std::endl;
+        return 1;
+    }
+    if (result.count("ffast-math"))
+        set_default_fp_mode(FPMode::FAST);
+    else if (fp_contract != "off")
+        set_default_fp_mode(FPMode::CONTRACT);
+
+    DefinitionPasses passes;
+    std::unique_ptr<Specialiser> specialiser;
+    if (auto budget = result["specialise-budget"].as<size_t>()) {
+        specialiser = std::make_unique<Specialiser>(budget);
+        passes.specialiser = specialiser.get();
+    }
+    IntegerPromoter promoter;
+    if (!result.count("no-int-promotion"))
+        passes.promoter = &promoter;
+    TailCalls tail_calls;
+    if (!result.count("no-tail-calls"))
+        passes.tail_calls = &tail_calls;
+
     if (result.count("lexer")) {
-        dump_all_tokens();
+        dump_all_tokens(stdin_lexer);
         return 0;
     } else if (result.count("parser")) {
-        run_interpreter({"parser-mode"});
+        run_options.insert("parser-mode");
+        run_interpreter(stdin_lexer, run_options, pool.get(), passes,
+                        pipeline);
         return 0;
     } else if (result.count("compile")) {
         auto filename = result["compile"].as<std::string>();
@@ -78,20 +213,55 @@ int main(int argc, char *argv[]) {
         auto object_filename =
             std::filesystem::path(filename).stem().string() + ".o";
 
-        auto source_code = std::ifstream(filename);
-        input = &source_code;
-        run_interpreter({"no-print-ir", "no-print-prompt"});
+        SourceBuffer source_code;
+        try {
+            source_code = SourceBuffer::from_file(filename);
+        } catch (const std::runtime_error &err) {
+            std::cerr << rang::style::bold << rang::fg::red
+                      << "Error: " << rang::style::reset << err.what()
+                      << std::endl;
+
+            return 1;
+        }
+
+        auto lexer = Lexer(std::move(source_code));
+        if (pool)
+            lexer.lex_parallel(*pool);
+        std::unique_ptr<ConstantEvaluator> evaluator;
+        ConstantNames constant_names(
+            std::filesystem::path(filename).stem().string());
+        if (auto fuel = result["eval-fuel"].as<uint64_t>()) {
+            evaluator = std::make_unique<ConstantEvaluator>(fuel);
+            passes.evaluator = evaluator.get();
+            passes.constant_names = &constant_names;
+        }
+
+        // Addresses returned by its ifunc resolvers need relocating, so the
+        // code is position independent then (as gcc's default is)
+        pipeline.multiversion = result.count("multiversion");
+
+        // Before codegen, so the optimisations know the target
+        llvm::TargetMachine *target_machine;
+        try {
+            target_machine = InitialisationCompiler(
+                result["mcpu"].as<std::string>(),
+                result["march"].as<std::string>(), pipeline.multiversion);
+        } catch (const std::exception &) {
+            return 1; // error is already printed
+        }
+        pipeline.target_machine = target_machine;
+
+        run_options.insert({"no-print-ir", "no-print-prompt"});
+        run_interpreter(lexer, run_options, pool.get(), passes, pipeline);
 
-        auto *target_machine = InitialisationCompiler();
         return CompileToObjectFile(object_filename, target_machine);
     }
 
     try {
-        if (result.count("--no-print-ir")) {
-            run_interpreter({"no-print-ir"});
-        } else {
-            run_interpreter();
-        }
+        if (result.count("--no-print-ir"))
+            run_options.insert("no-print-ir");
+        run_interpreter(stdin_lexer, run_options, pool.get(), passes,
+                        pipeline);
     } catch (std::string &s) {
         std::cerr << rang::style::bold << rang::fg::red
                   << "ERROR: " << rang::style::reset << s << std::endl;
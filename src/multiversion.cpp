@@ -0,0 +1,172 @@
+#include "multiversion.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/GlobalIFunc.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+
+namespace {
+/**
+ * Bits in __cpu_model.__cpu_features[0], same order as enum ProcessorFeatures
+ * of libgcc's cpuinfo.h and compiler-rt's cpu_model.c (X86_FEATURE_COMPAT in
+ * llvm/Support/X86TargetParser.def)
+ */
+enum CpuFeature : uint32_t {
+    AVX2 = 10,
+    FMA = 14,
+    AVX512F = 15,
+    AVX512VL = 20,
+    AVX512BW = 21,
+    AVX512DQ = 22,
+    AVX512CD = 23,
+};
+
+constexpr uint32_t bit(CpuFeature feature) { return uint32_t(1) << feature; }
+
+struct Version {
+    const char *suffix;
+    const char *features; // added to the target machine's
+    uint32_t required;    // CpuFeature bits, all must be there
+};
+
+// Best first, since the resolver picks the first one the CPU can run
+const Version VERSIONS[] = {
+    {".avx512", "+avx2,+fma,+avx512f,+avx512vl,+avx512bw,+avx512dq,+avx512cd",
+     bit(AVX2) | bit(FMA) | bit(AVX512F) | bit(AVX512VL) | bit(AVX512BW) |
+         bit(AVX512DQ) | bit(AVX512CD)},
+    {".avx2", "+avx2,+fma", bit(AVX2) | bit(FMA)},
+};
+
+// Features of the version, with the ones 'f' already has
+std::string features_of(const llvm::Function &f,
+                        const llvm::TargetMachine &target_machine,
+                        const Version &version) {
+    auto features = f.hasFnAttribute("target-features")
+                        ? f.getFnAttribute("target-features")
+                              .getValueAsString()
+                              .str()
+                        : target_machine.getTargetFeatureString().str();
+    return features.empty() ? version.features
+                            : features + "," + version.features;
+}
+
+/**
+ * Resolver of the ifunc for 'name', returning first of 'versions' (same order
+ * as VERSIONS) the CPU supports, else 'fallback'
+ */
+llvm::Function *
+make_resolver(llvm::Module &module, const std::string &name,
+              llvm::ArrayRef<llvm::Function *> versions,
+              llvm::Function *fallback) {
+    auto &context = module.getContext();
+    auto *i32 = llvm::Type::getInt32Ty(context);
+
+    // struct __processor_model { u32 vendor, type, subtype, features[1]; }
+    auto *model_type = llvm::StructType::get(
+        context, {i32, i32, i32, llvm::ArrayType::get(i32, 1)});
+    auto *model = module.getOrInsertGlobal("__cpu_model", model_type);
+    auto init = module.getOrInsertFunction(
+        "__cpu_indicator_init", llvm::Type::getVoidTy(context));
+
+    auto *resolver = llvm::Function::Create(
+        llvm::FunctionType::get(fallback->getType(), false),
+        llvm::Function::InternalLinkage, name + ".resolver", module);
+    llvm::IRBuilder<> builder(
+        llvm::BasicBlock::Create(context, "entry", resolver));
+
+    // Resolvers run before constructors, so __cpu_model isn't set yet
+    builder.CreateCall(init);
+    auto *features = builder.CreateLoad(
+        i32, builder.CreateConstInBoundsGEP2_32(model_type, model, 3, 0),
+        "features");
+
+    for (size_t i = 0; i < versions.size(); ++i) {
+        auto *required = llvm::ConstantInt::get(i32, VERSIONS[i].required);
+        auto *supported = builder.CreateICmpEQ(
+            builder.CreateAnd(features, required), required);
+
+        auto *then_bb = llvm::BasicBlock::Create(context, "", resolver);
+        auto *else_bb = llvm::BasicBlock::Create(context, "", resolver);
+        builder.CreateCondBr(supported, then_bb, else_bb);
+
+        builder.SetInsertPoint(then_bb);
+        builder.CreateRet(versions[i]);
+        builder.SetInsertPoint(else_bb);
+    }
+    builder.CreateRet(fallback);
+
+    return resolver;
+}
+} // namespace
+
+bool multiversion(llvm::Module &module,
+                  const llvm::TargetMachine &target_machine) {
+    auto &triple = target_machine.getTargetTriple();
+    if (triple.getArch() != llvm::Triple::x86_64 || !triple.isOSBinFormatELF())
+        return false;
+
+    // Internal ones (for eg. specialised copies) too, for the calls to them
+    std::vector<llvm::Function *> defined;
+    for (auto &f : module) {
+        if (!f.isDeclaration())
+            defined.push_back(&f);
+    }
+
+    // Declare all versions first, so each can call others of its version
+    std::vector<std::vector<llvm::Function *>> versions(defined.size());
+    std::vector<llvm::ValueToValueMapTy> mappings(std::size(VERSIONS));
+    for (size_t i = 0; i < defined.size(); ++i) {
+        auto *f = defined[i];
+        for (size_t v = 0; v < std::size(VERSIONS); ++v) {
+            auto *version = llvm::Function::Create(
+                f->getFunctionType(), llvm::Function::InternalLinkage,
+                f->getName() + VERSIONS[v].suffix, module);
+            versions[i].push_back(version);
+
+            mappings[v][f] = version;
+            auto arg = version->arg_begin();
+            for (auto &param : f->args())
+                mappings[v][&param] = &*arg++;
+        }
+    }
+
+    for (size_t i = 0; i < defined.size(); ++i) {
+        auto *f = defined[i];
+        for (size_t v = 0; v < std::size(VERSIONS); ++v) {
+            auto *version = versions[i][v];
+            llvm::SmallVector<llvm::ReturnInst *, 4> returns;
+            llvm::CloneFunctionInto(
+                version, f, mappings[v],
+                llvm::CloneFunctionChangeType::LocalChangesOnly, returns);
+            version->setLinkage(llvm::Function::InternalLinkage);
+            version->addFnAttr("target-features",
+                               features_of(*f, target_machine, VERSIONS[v]));
+        }
+    }
+
+    // Original is the default version, and its name is now the ifunc's
+    for (size_t i = 0; i < defined.size(); ++i) {
+        auto *f = defined[i];
+        if (!f->hasExternalLinkage())
+            continue;
+
+        auto name = f->getName().str();
+        f->setName(name + ".default");
+        f->setLinkage(llvm::Function::InternalLinkage);
+
+        auto *resolver = make_resolver(module, name, versions[i], f);
+        llvm::GlobalIFunc::create(f->getFunctionType(),
+                                  f->getAddressSpace(),
+                                  llvm::Function::ExternalLinkage, name,
+                                  resolver, &module);
+    }
+    return true;
+}
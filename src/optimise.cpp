@@ -0,0 +1,328 @@
+#include "optimise.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include <llvm/ADT/Hashing.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallVector.h>
+
+namespace {
+uint64_t bits_of(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+/**
+ * Builds the optimised copy of 'in' into 'out', one node at a time in
+ * post-order, so children of a node are already in 'out' (at mapped[child])
+ * when it's visited. Each visit_* returns the node of 'out' that 'n' became
+ */
+class Optimiser : public FlatVisitor<Optimiser, NodeIndex> {
+    FlatFunction &out;
+    CallFolder fold_call; // can be empty
+    std::vector<NodeIndex> mapped; // node of 'in' -> node of 'out'
+    std::vector<bool> pure; // per node of 'out', no call, loop, assignment
+                            // or variable assigned to in it
+
+    // Variables assigned to (by any node of 'in'), so reading one gives
+    // whatever it was last assigned, not always the same value
+    llvm::SmallVector<uint32_t, 8> assigned;
+
+    // Hash of a node -> nodes of 'out' with that hash, only the pure ones
+    std::unordered_multimap<size_t, NodeIndex> nodes;
+
+  public:
+    Optimiser(FlatFunction &out, CallFolder fold_call)
+        : out(out), fold_call(fold_call) {}
+
+    void run(const FlatFunction &in) {
+        out.name = in.name;
+        out.parameters = in.parameters;
+        out.parameter_types = in.parameter_types;
+        out.return_type = in.return_type;
+        out.fp_mode = in.fp_mode;
+
+        for (NodeIndex n = 0; n < in.size(); ++n) {
+            if (in.kinds[n] == NodeKind::ASSIGN &&
+                !llvm::is_contained(assigned, in.operands[n]))
+                assigned.push_back(in.operands[n]);
+        }
+
+        mapped.resize(in.size());
+        for (NodeIndex n = 0; n < in.size(); ++n)
+            mapped[n] = visit(in, n);
+
+        out.body = in.is_extern() ? NO_NODE : mapped[in.body];
+    }
+
+    NodeIndex visit_number(const FlatFunction &in, NodeIndex n) {
+        return number(in.number(n), in.number_type(n), in.number_fraction(n));
+    }
+
+    NodeIndex visit_variable(const FlatFunction &in, NodeIndex n) {
+        if (llvm::is_contained(assigned, in.operands[n]))
+            return impure(NodeKind::VARIABLE, in.operands[n]);
+        return make(NodeKind::VARIABLE, in.operands[n]);
+    }
+
+    NodeIndex visit_unary(const FlatFunction &in, NodeIndex n) {
+        auto operand = mapped[in.children_of(n)[0]];
+        if (in.opr(n) == '-')
+            return negate(operand);
+        return make(NodeKind::UNARY, in.operands[n], {operand});
+    }
+
+    NodeIndex visit_binary(const FlatFunction &in, NodeIndex n) {
+        auto opr = in.opr(n);
+        auto lhs = mapped[in.children_of(n)[0]];
+        auto rhs = mapped[in.children_of(n)[1]];
+
+        if (is_literal(lhs) && is_literal(rhs)) {
+            double a = out.number(lhs), b = out.number(rhs);
+            auto type = ValueType::ANY;
+            bool fraction =
+                out.number_fraction(lhs) || out.number_fraction(rhs);
+            switch (opr) {
+            case '+':
+                return number(a + b, type, fraction);
+            case '-':
+                return number(a - b, type, fraction);
+            case '*':
+                return number(a * b, type, fraction);
+            case '/':
+                return number(a / b, type, fraction);
+            case '<': // 'fcmp ult', ie. true if unordered (a NaN) or less
+                return number(std::isnan(a) || std::isnan(b) || a < b);
+            case '>':
+                return number(std::isnan(a) || std::isnan(b) || a > b);
+            }
+        }
+
+        switch (opr) {
+        case '*':
+            if (is_number(rhs, 1.0))
+                return lhs;
+            if (is_number(lhs, 1.0))
+                return rhs;
+            if (is_number(rhs, -1.0))
+                return negate(lhs);
+            if (is_number(lhs, -1.0))
+                return negate(rhs);
+            break;
+        case '/':
+            if (is_number(rhs, 1.0))
+                return lhs;
+            if (is_number(rhs, -1.0))
+                return negate(lhs);
+            break;
+        case '+':
+            if (is_number(rhs, -0.0))
+                return lhs;
+            if (is_number(lhs, -0.0))
+                return rhs;
+            break;
+        case '-':
+            if (is_number(rhs, 0.0))
+                return lhs;
+            break;
+        }
+
+        return make(NodeKind::BINARY, in.operands[n], {lhs, rhs});
+    }
+
+    NodeIndex visit_if(const FlatFunction &in, NodeIndex n) {
+        return make(NodeKind::IF, in.operands[n], children(in, n));
+    }
+
+    NodeIndex visit_block(const FlatFunction &in, NodeIndex n) {
+        auto expressions = children(in, n);
+        if (n != in.body && expressions.size() == 1)
+            return expressions[0];
+        return make(NodeKind::BLOCK, in.operands[n], expressions);
+    }
+
+    NodeIndex visit_call(const FlatFunction &in, NodeIndex n) {
+        auto args = children(in, n);
+        auto constant_args = std::all_of(
+            args.begin(), args.end(), [&](auto arg) { return is_literal(arg); });
+        if (fold_call && constant_args) {
+            llvm::SmallVector<double, 4> values;
+            for (auto arg : args)
+                values.push_back(out.number(arg));
+            if (auto value = fold_call(in.symbol(n), values))
+                return number(*value);
+        }
+
+        return impure(NodeKind::CALL, in.operands[n], args);
+    }
+
+    NodeIndex visit_assign(const FlatFunction &in, NodeIndex n) {
+        return impure(NodeKind::ASSIGN, in.operands[n], children(in, n));
+    }
+
+    NodeIndex visit_while(const FlatFunction &in, NodeIndex n) {
+        return impure(NodeKind::WHILE, in.operands[n], children(in, n));
+    }
+
+  private:
+    llvm::SmallVector<NodeIndex, 4> children(const FlatFunction &in,
+                                             NodeIndex n) const {
+        llvm::SmallVector<NodeIndex, 4> result;
+        for (auto child : in.children_of(n))
+            result.push_back(mapped[child]);
+        return result;
+    }
+
+    bool is_number(NodeIndex n) const {
+        return out.kinds[n] == NodeKind::NUMBER;
+    }
+
+    /**
+     * A number without type suffix, which is computed as f64 and then takes
+     * the type of what it's used with (see types.hpp), so with the other
+     * operand being of any type, folding these, or the identities, keep its
+     * type and value. Not so for a typed one, for eg. x*1f64 is an f64 even if
+     * x is an i64
+     */
+    bool is_literal(NodeIndex n) const {
+        return is_number(n) && out.number_type(n) == ValueType::ANY;
+    }
+
+    // Exactly 'value', ie. 0.0 doesn't match -0.0
+    bool is_number(NodeIndex n, double value) const {
+        return is_literal(n) && bits_of(out.number(n)) == bits_of(value);
+    }
+
+    NodeIndex negate(NodeIndex n) {
+        if (is_number(n))
+            return number(-out.number(n), out.number_type(n),
+                          out.number_fraction(n));
+        if (out.kinds[n] == NodeKind::UNARY && out.opr(n) == '-')
+            return out.children_of(n)[0];
+        return make(NodeKind::UNARY, '-', {n});
+    }
+
+    // 'fraction' is kept for a literal folded from one, see NumberAST
+    NodeIndex number(double value, ValueType type = ValueType::ANY,
+                     bool fraction = false) {
+        auto hash = llvm::hash_combine(uint8_t(NodeKind::NUMBER),
+                                       bits_of(value), uint8_t(type),
+                                       fraction);
+        auto [begin, end] = nodes.equal_range(hash);
+        for (auto it = begin; it != end; ++it) {
+            auto n = it->second;
+            if (is_number(n) && bits_of(out.number(n)) == bits_of(value) &&
+                out.number_type(n) == type &&
+                out.number_fraction(n) == fraction)
+                return n;
+        }
+
+        auto index = out.add_number(value, type, fraction);
+        pure.push_back(true);
+        nodes.emplace(hash, index);
+        return index;
+    }
+
+    // A new node, never the same as another
+    NodeIndex impure(NodeKind kind, uint32_t operand,
+                     llvm::ArrayRef<NodeIndex> node_children = {}) {
+        auto index = out.add(kind, operand, node_children);
+        pure.push_back(false);
+        return index;
+    }
+
+    // Existing node same as this, if it's pure, else a new one
+    NodeIndex make(NodeKind kind, uint32_t operand,
+                   llvm::ArrayRef<NodeIndex> node_children = {}) {
+        bool is_pure = true;
+        for (auto child : node_children)
+            is_pure = is_pure && pure[child];
+
+        auto hash = llvm::hash_combine(
+            uint8_t(kind), operand,
+            llvm::hash_combine_range(node_children.begin(),
+                                     node_children.end()));
+        if (is_pure) {
+            auto [begin, end] = nodes.equal_range(hash);
+            for (auto it = begin; it != end; ++it) {
+                auto n = it->second;
+                if (out.kinds[n] == kind && out.operands[n] == operand &&
+                    out.children_of(n) == node_children)
+                    return n;
+            }
+        }
+
+        auto index = out.add(kind, operand, node_children);
+        pure.push_back(is_pure);
+        if (is_pure)
+            nodes.emplace(hash, index);
+        return index;
+    }
+};
+
+/**
+ * Copy of 'f' with only the nodes reachable from its body, still in
+ * post-order
+ */
+FlatFunction without_unused(const FlatFunction &f) {
+    FlatFunction result;
+    result.name = f.name;
+    result.parameters = f.parameters;
+    result.parameter_types = f.parameter_types;
+    result.return_type = f.return_type;
+    result.fp_mode = f.fp_mode;
+    if (f.is_extern())
+        return result;
+
+    // Parents come after their children, so going backwards, a node is
+    // known to be used before its children are reached
+    std::vector<bool> used(f.size());
+    used[f.body] = true;
+    for (auto n = f.body + 1; n-- > 0;) {
+        if (used[n]) {
+            for (auto child : f.children_of(n))
+                used[child] = true;
+        }
+    }
+
+    std::vector<NodeIndex> mapped(f.size(), NO_NODE);
+    llvm::SmallVector<NodeIndex, 4> children;
+    for (NodeIndex n = 0; n < f.size(); ++n) {
+        if (!used[n])
+            continue;
+
+        if (f.kinds[n] == NodeKind::NUMBER) {
+            mapped[n] = result.add_number(f.number(n), f.number_type(n),
+                                          f.number_fraction(n));
+            continue;
+        }
+
+        children.clear();
+        for (auto child : f.children_of(n))
+            children.push_back(mapped[child]);
+        mapped[n] = result.add(f.kinds[n], f.operands[n], children);
+    }
+
+    result.body = mapped[f.body];
+    return result;
+}
+} // namespace
+
+void optimise(FlatFunction &f, CallFolder fold_call) {
+    if (f.is_extern())
+        return;
+
+    FlatFunction optimised;
+    Optimiser(optimised, fold_call).run(f);
+    f = without_unused(optimised);
+}
+
+void optimise(FlatFunction &f) { optimise(f, CallFolder()); }
+
+void remove_unused(FlatFunction &f) { f = without_unused(f); }
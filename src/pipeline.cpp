@@ -0,0 +1,183 @@
+#include "pipeline.hpp"
+
+#include <map>
+#include <vector>
+
+#if (LLVM_VERSION_MAJOR < 17) || \
+    (LLVM_VERSION_MAJOR == 17 && LLVM_VERSION_MINOR == 0 && LLVM_VERSION_PATCH < 6)
+#include <llvm/ADT/Optional.h>
+#endif
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Passes/OptimizationLevel.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace {
+struct FunctionStats {
+    size_t instructions = 0;
+    size_t blocks = 0;
+    size_t calls = 0;
+};
+
+// Of each function with a body, by name, in order of the module
+std::vector<std::pair<std::string, FunctionStats>>
+stats_of(const llvm::Module &module) {
+    std::vector<std::pair<std::string, FunctionStats>> result;
+    for (auto &f : module) {
+        if (f.isDeclaration())
+            continue;
+
+        FunctionStats stats;
+        for (auto &block : f) {
+            ++stats.blocks;
+            for (auto &inst : block) {
+                ++stats.instructions;
+                if (llvm::isa<llvm::CallBase>(inst))
+                    ++stats.calls;
+            }
+        }
+        result.emplace_back(f.getName().str(), stats);
+    }
+    return result;
+}
+
+void print_stats(
+    const std::vector<std::pair<std::string, FunctionStats>> &before,
+    const std::vector<std::pair<std::string, FunctionStats>> &after) {
+    std::map<std::string, FunctionStats> after_by_name(after.begin(),
+                                                       after.end());
+
+    auto &out = llvm::errs();
+    auto row = [&](const FunctionStats &a, const FunctionStats *b,
+                   llvm::StringRef name) {
+        auto cell = [&](size_t FunctionStats::*count) {
+            return b ? llvm::formatv("{0} -> {1}", a.*count, b->*count).str()
+                     : llvm::formatv("{0} -> -", a.*count).str();
+        };
+        out << llvm::formatv("{0,14} {1,12} {2,12}  {3}\n",
+                             cell(&FunctionStats::instructions),
+                             cell(&FunctionStats::blocks),
+                             cell(&FunctionStats::calls), name);
+    };
+
+    out << llvm::formatv("{0,14} {1,12} {2,12}  {3}\n", "instructions",
+                         "blocks", "calls", "function");
+
+    FunctionStats total_before, total_after;
+    for (auto &[name, stats] : before) {
+        auto it = after_by_name.find(name);
+        row(stats, it == after_by_name.end() ? nullptr : &it->second, name);
+
+        total_before.instructions += stats.instructions;
+        total_before.blocks += stats.blocks;
+        total_before.calls += stats.calls;
+    }
+    for (auto &[name, stats] : after) {
+        total_after.instructions += stats.instructions;
+        total_after.blocks += stats.blocks;
+        total_after.calls += stats.calls;
+    }
+    row(total_before, &total_after, "(all)");
+}
+
+llvm::OptimizationLevel llvm_level(OptLevel level) {
+    switch (level) {
+    case OptLevel::O0:
+        return llvm::OptimizationLevel::O0;
+    case OptLevel::O1:
+        return llvm::OptimizationLevel::O1;
+    case OptLevel::O2:
+        return llvm::OptimizationLevel::O2;
+    case OptLevel::O3:
+        return llvm::OptimizationLevel::O3;
+    case OptLevel::Os:
+        return llvm::OptimizationLevel::Os;
+    case OptLevel::Oz:
+        return llvm::OptimizationLevel::Oz;
+    }
+    return llvm::OptimizationLevel::O0;
+}
+} // namespace
+
+std::optional<OptLevel> parse_opt_level(const std::string &name) {
+    if (name == "0")
+        return OptLevel::O0;
+    if (name == "1")
+        return OptLevel::O1;
+    if (name == "2")
+        return OptLevel::O2;
+    if (name == "3")
+        return OptLevel::O3;
+    if (name == "s")
+        return OptLevel::Os;
+    if (name == "z")
+        return OptLevel::Oz;
+    return std::nullopt;
+}
+
+void run_pipeline(llvm::Module &module, const PipelineOptions &options) {
+    if (options.level == OptLevel::O0 && !options.print_pipeline &&
+        !options.print_stats)
+        return;
+
+    auto level = llvm_level(options.level);
+
+    // Vectorizers on at -O2 and above, but not for size, same as clang
+    llvm::PipelineTuningOptions tuning;
+    tuning.LoopVectorization = tuning.SLPVectorization =
+        level.getSpeedupLevel() > 1 && level.getSizeLevel() < 2;
+
+#if (LLVM_VERSION_MAJOR < 17) || \
+    (LLVM_VERSION_MAJOR == 17 && LLVM_VERSION_MINOR == 0 && LLVM_VERSION_PATCH < 6)
+    auto pgo = llvm::Optional<llvm::PGOOptions>();
+#else
+    auto pgo = std::optional<llvm::PGOOptions>();
+#endif
+
+    // Given to PassBuilder, only so it knows the passes' names for printing
+    llvm::PassInstrumentationCallbacks callbacks;
+    if (options.print_pipeline) {
+        // PassBuilder gives 'callbacks' the passes' names only with this
+        // option, same as 'opt -print-pipeline-passes', else we only have
+        // their C++ class names
+        auto &registered = llvm::cl::getRegisteredOptions();
+        auto option = registered.find("print-pipeline-passes");
+        if (option != registered.end())
+            static_cast<llvm::cl::opt<bool> *>(option->second)->setValue(true);
+    }
+    llvm::PassBuilder builder(options.target_machine, tuning, pgo, &callbacks);
+
+    llvm::LoopAnalysisManager loop_analyses;
+    llvm::FunctionAnalysisManager function_analyses;
+    llvm::CGSCCAnalysisManager cgscc_analyses;
+    llvm::ModuleAnalysisManager module_analyses;
+    builder.registerModuleAnalyses(module_analyses);
+    builder.registerCGSCCAnalyses(cgscc_analyses);
+    builder.registerFunctionAnalyses(function_analyses);
+    builder.registerLoopAnalyses(loop_analyses);
+    builder.crossRegisterProxies(loop_analyses, function_analyses,
+                                 cgscc_analyses, module_analyses);
+
+    auto passes = options.level == OptLevel::O0
+                      ? builder.buildO0DefaultPipeline(level)
+                      : builder.buildPerModuleDefaultPipeline(level);
+
+    if (options.print_pipeline) {
+        passes.printPipeline(llvm::errs(), [&](llvm::StringRef class_name) {
+            auto name = callbacks.getPassNameForClassName(class_name);
+            return name.empty() ? class_name : name;
+        });
+        llvm::errs() << "\n";
+    }
+
+    auto before = stats_of(module);
+    passes.run(module, module_analyses);
+
+    if (options.print_stats)
+        print_stats(before, stats_of(module));
+}
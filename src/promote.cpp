@@ -0,0 +1,554 @@
+#include "promote.hpp"
+#include "ast.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+#include <string>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/Support/MathExtras.h>
+
+namespace {
+// Whole numbers up to it (either sign) are exact as doubles, and so are sums
+// and products of them, as long as these are within it too
+constexpr int64_t EXACT_LIMIT = int64_t(1) << 53;
+
+// Times the body of a recursive function is analysed to find its range of
+// results, before taking it as any double
+constexpr int MAX_ITERATIONS = 8;
+
+/**
+ * Values a node can have: none (yet), for eg. results of a recursive call
+ * before any are known, or a variable in a branch never taken, whole numbers
+ * in [min, max] (within EXACT_LIMIT, and never -0), or any double
+ */
+struct Range {
+    enum Kind : uint8_t { NONE, WHOLE, ANY };
+    Kind kind = NONE;
+    int64_t min = 0, max = 0;
+
+    static Range any() { return {ANY, 0, 0}; }
+
+    // Range::any() if it's beyond EXACT_LIMIT, none if it's empty
+    static Range whole(int64_t min, int64_t max) {
+        if (min > max)
+            return {};
+        if (min < -EXACT_LIMIT || max > EXACT_LIMIT)
+            return any();
+        return {WHOLE, min, max};
+    }
+
+    bool contains(int64_t value) const {
+        return kind == WHOLE && min <= value && value <= max;
+    }
+
+    bool operator==(const Range &other) const {
+        return kind == other.kind && min == other.min && max == other.max;
+    }
+};
+
+// Values either 'a' or 'b' can have
+Range join(Range a, Range b) {
+    if (a.kind == Range::NONE)
+        return b;
+    if (b.kind == Range::NONE)
+        return a;
+    if (a.kind == Range::ANY || b.kind == Range::ANY)
+        return Range::any();
+    return Range::whole(std::min(a.min, b.min), std::max(a.max, b.max));
+}
+
+// Range of 'lhs opr rhs', for whole 'lhs' and 'rhs'
+Range binary(char opr, Range lhs, Range rhs) {
+    switch (opr) {
+    case '+':
+        return Range::whole(lhs.min + rhs.min, lhs.max + rhs.max);
+    case '-':
+        return Range::whole(lhs.min - rhs.max, lhs.max - rhs.min);
+    case '*': {
+        // 0 times a negative number is -0
+        if ((lhs.contains(0) && rhs.min < 0) ||
+            (lhs.min < 0 && rhs.contains(0)))
+            return Range::any();
+
+        int64_t min = INT64_MAX, max = INT64_MIN;
+        for (auto a : {lhs.min, lhs.max}) {
+            for (auto b : {rhs.min, rhs.max}) {
+                int64_t product;
+                if (llvm::MulOverflow(a, b, product))
+                    return Range::any();
+                min = std::min(min, product);
+                max = std::max(max, product);
+            }
+        }
+        return Range::whole(min, max);
+    }
+    case '<':
+    case '>':
+        return Range::whole(0, 1);
+    }
+    return Range::any(); // a division, which can have a fraction
+}
+
+Range summary_result(const IntegerPromoter::Summary &summary) {
+    if (!summary.result)
+        return Range::any();
+    return Range::whole(summary.result->first, summary.result->second);
+}
+
+/**
+ * Ranges of the nodes of a function, given ranges of its parameters
+ *
+ * A parameter's range is found for each node (before the ranges of nodes),
+ * from the parent's, narrowed in a branch of an 'if' by the condition, when
+ * it compares the parameter with a number (for eg. 'n < 1'). A node shared by
+ * many parents (see optimise()) gets all their ranges joined. A variable's
+ * value is then taken from its parent's ranges, since a variable node is
+ * usually shared by all uses of it, even across branches
+ */
+class RangeAnalysis {
+    using Summary = IntegerPromoter::Summary;
+
+    const FlatFunction &f;
+    const std::vector<Summary> &summaries;
+    Symbol copy; // of 'f' itself, for its recursive calls
+
+    size_t num_parameters;
+    std::vector<int> parameter_of; // of each variable, -1 if not a parameter
+    std::vector<ValueType> parameter_types;
+    std::vector<Range> environments; // num_parameters ranges for each node
+
+    Range *environment(NodeIndex n) {
+        return environments.data() + size_t(n) * num_parameters;
+    }
+
+    Range operand(NodeIndex parent, NodeIndex child) {
+        if (f.kinds[child] != NodeKind::VARIABLE)
+            return ranges[child];
+        auto parameter = parameter_of[child];
+        return parameter < 0 ? Range::any() : environment(parent)[parameter];
+    }
+
+    void narrow(Range *environment, NodeIndex condition, bool taken) const;
+
+  public:
+    std::vector<Range> ranges;   // of each node
+    std::vector<Symbol> callees; // of each call, the copy it goes to, if any
+
+    RangeAnalysis(const FlatFunction &f, llvm::ArrayRef<Symbol> parameters,
+                  const std::vector<Summary> &summaries, Symbol copy);
+
+    // Parameters of type I64 are whole numbers within PARAMETER_LIMIT, the
+    // others any double. Finds the ranges of parameters at each node
+    void assume(const std::vector<ValueType> &types);
+
+    /**
+     * Ranges of the nodes, with results of calls to the copy itself taken to
+     * be in 'recursion'. When 'last', no node is left without values (as
+     * codegen needs a type for each)
+     *
+     * @returns range of the body
+     */
+    Range run(Range recursion, bool last);
+
+    // Type 'n' is computed in, after the last run()
+    ValueType type_of(NodeIndex n) const;
+
+    // Parameter 'p' is an operand of a node computed as an i64, or passed to
+    // an i64 parameter of another function's copy, after the last run()
+    bool is_useful(size_t p) const;
+};
+
+RangeAnalysis::RangeAnalysis(const FlatFunction &f,
+                             llvm::ArrayRef<Symbol> parameters,
+                             const std::vector<Summary> &summaries,
+                             Symbol copy)
+    : f(f), summaries(summaries), copy(copy),
+      num_parameters(parameters.size()), parameter_of(f.size(), -1),
+      ranges(f.size()), callees(f.size(), Symbol::EMPTY) {
+    // A variable is the first parameter of its name, same as in codegen
+    for (NodeIndex n = 0; n < f.size(); ++n) {
+        if (f.kinds[n] != NodeKind::VARIABLE)
+            continue;
+        auto it = std::find(parameters.begin(), parameters.end(), f.symbol(n));
+        if (it != parameters.end())
+            parameter_of[n] = it - parameters.begin();
+    }
+}
+
+// For a whole x, 'x < c' is 'x <= ceil(c) - 1', and 'x > c' is
+// 'x >= floor(c) + 1'
+void RangeAnalysis::narrow(Range *environment, NodeIndex condition,
+                           bool taken) const {
+    if (f.kinds[condition] != NodeKind::BINARY)
+        return;
+
+    auto opr = f.opr(condition);
+    auto variable = f.children_of(condition)[0];
+    auto number = f.children_of(condition)[1];
+    if (f.kinds[variable] == NodeKind::NUMBER) {
+        std::swap(variable, number); // 'c < x' is 'x > c'
+        opr = opr == '<' ? '>' : opr == '>' ? '<' : opr;
+    }
+    if ((opr != '<' && opr != '>') || f.kinds[number] != NodeKind::NUMBER ||
+        f.kinds[variable] != NodeKind::VARIABLE ||
+        parameter_of[variable] < 0)
+        return;
+
+    // A NaN compares as true (see optimise.hpp), and beyond EXACT_LIMIT it
+    // doesn't narrow anything
+    auto &range = environment[parameter_of[variable]];
+    auto limit = f.number(number);
+    if (range.kind != Range::WHOLE || std::isnan(limit))
+        return;
+    limit = std::clamp(limit, -0x1p60, 0x1p60);
+
+    auto min = range.min, max = range.max;
+    if (opr == '<' && taken)
+        max = std::min(max, int64_t(std::ceil(limit)) - 1);
+    else if (opr == '<')
+        min = std::max(min, int64_t(std::ceil(limit)));
+    else if (taken)
+        min = std::max(min, int64_t(std::floor(limit)) + 1);
+    else
+        max = std::min(max, int64_t(std::floor(limit)));
+    range = Range::whole(min, max);
+}
+
+void RangeAnalysis::assume(const std::vector<ValueType> &types) {
+    parameter_types = types;
+    environments.assign(f.size() * num_parameters, Range());
+
+    auto *body = environment(f.body);
+    for (size_t p = 0; p < num_parameters; ++p) {
+        body[p] = types[p] == ValueType::I64
+                      ? Range::whole(-IntegerPromoter::PARAMETER_LIMIT,
+                                     IntegerPromoter::PARAMETER_LIMIT)
+                      : Range::any();
+    }
+
+    // Parents come after their children, so going backwards, all of them
+    // are done before the node
+    std::vector<Range> narrowed(num_parameters);
+    for (auto n = f.size(); n-- > 0;) {
+        auto children = f.children_of(n);
+        for (size_t i = 0; i < children.size(); ++i) {
+            std::copy_n(environment(n), num_parameters, narrowed.begin());
+            if (f.kinds[n] == NodeKind::IF && i > 0)
+                narrow(narrowed.data(), children[0], i == 1);
+
+            auto *child = environment(children[i]);
+            for (size_t p = 0; p < num_parameters; ++p)
+                child[p] = join(child[p], narrowed[p]);
+        }
+    }
+}
+
+Range RangeAnalysis::run(Range recursion, bool last) {
+    for (NodeIndex n = 0; n < f.size(); ++n) {
+        auto children = f.children_of(n);
+        auto &range = ranges[n];
+        callees[n] = Symbol::EMPTY;
+
+        switch (f.kinds[n]) {
+        case NodeKind::NUMBER: {
+            auto number = f.number(n);
+            auto clamped = std::clamp(number, -0x1p60, 0x1p60);
+            if (std::trunc(number) != number ||
+                (number == 0 && std::signbit(number)))
+                range = Range::any(); // a fraction, NaN or -0
+            else
+                range = Range::whole(int64_t(clamped), int64_t(clamped));
+            break;
+        }
+        case NodeKind::VARIABLE:
+            range = parameter_of[n] < 0 ? Range::any()
+                                        : environment(n)[parameter_of[n]];
+            break;
+        case NodeKind::UNARY: {
+            // Negating 0 gives -0
+            auto operand = this->operand(n, children[0]);
+            if (operand.kind != Range::WHOLE)
+                range = operand;
+            else if (operand.contains(0))
+                range = Range::any();
+            else
+                range = Range::whole(-operand.max, -operand.min);
+            break;
+        }
+        case NodeKind::BINARY: {
+            auto lhs = operand(n, children[0]), rhs = operand(n, children[1]);
+            if (lhs.kind == Range::NONE || rhs.kind == Range::NONE)
+                range = Range();
+            else if (lhs.kind == Range::ANY || rhs.kind == Range::ANY)
+                range = Range::any();
+            else
+                range = binary(f.opr(n), lhs, rhs);
+            break;
+        }
+        case NodeKind::IF:
+            range = join(operand(n, children[1]), operand(n, children[2]));
+            break;
+        case NodeKind::BLOCK:
+            range = operand(n, children.back());
+            break;
+        case NodeKind::CALL: {
+            // Goes to the copy if the i64 parameters get whole numbers within
+            // the limit, else to the function itself, with any value
+            auto callee = f.symbol(n);
+            const std::vector<ValueType> *types = nullptr;
+            auto result = recursion;
+            Symbol target = copy;
+            if (callee == f.name) {
+                types = &parameter_types;
+            } else if (index(callee) < summaries.size() &&
+                       summaries[index(callee)].copy != Symbol::EMPTY) {
+                auto &summary = summaries[index(callee)];
+                types = &summary.parameter_types;
+                result = summary_result(summary);
+                target = summary.copy;
+            }
+
+            range = Range::any();
+            if (!types || types->size() != children.size())
+                break;
+
+            bool fits = true;
+            for (size_t i = 0; i < children.size() && fits; ++i) {
+                auto arg = operand(n, children[i]);
+                if (arg.kind == Range::NONE && !last) {
+                    result = Range(); // not called, yet
+                } else if ((*types)[i] == ValueType::I64) {
+                    fits = arg.kind == Range::WHOLE &&
+                           arg.min >= -IntegerPromoter::PARAMETER_LIMIT &&
+                           arg.max <= IntegerPromoter::PARAMETER_LIMIT;
+                }
+            }
+            if (fits) {
+                range = result;
+                callees[n] = target;
+            }
+            break;
+        }
+        case NodeKind::ASSIGN: // not promoted, see promote()
+        case NodeKind::WHILE:
+            range = Range::any();
+            break;
+        }
+
+        if (last && range.kind == Range::NONE)
+            range = Range::any();
+    }
+    return ranges[f.body];
+}
+
+ValueType RangeAnalysis::type_of(NodeIndex n) const {
+    if (f.kinds[n] == NodeKind::VARIABLE) {
+        return parameter_of[n] < 0 ? ValueType::F64
+                                   : parameter_types[parameter_of[n]];
+    }
+    return ranges[n].kind == Range::WHOLE ? ValueType::I64 : ValueType::F64;
+}
+
+bool RangeAnalysis::is_useful(size_t p) const {
+    for (NodeIndex n = 0; n < f.size(); ++n) {
+        auto children = f.children_of(n);
+        auto kind = f.kinds[n];
+
+        // Not a recursive call, which only passes it on to itself
+        const std::vector<ValueType> *types = nullptr;
+        if (kind == NodeKind::CALL && callees[n] != Symbol::EMPTY &&
+            callees[n] != copy)
+            types = &summaries[index(f.symbol(n))].parameter_types;
+        else if ((kind != NodeKind::UNARY && kind != NodeKind::BINARY) ||
+                 ranges[n].kind != Range::WHOLE)
+            continue;
+
+        for (size_t i = 0; i < children.size(); ++i) {
+            if (f.kinds[children[i]] == NodeKind::VARIABLE &&
+                parameter_of[children[i]] == int(p) &&
+                (!types || (*types)[i] == ValueType::I64))
+                return true;
+        }
+    }
+    return false;
+}
+} // namespace
+
+std::optional<IntegerPromoter::Promotion>
+IntegerPromoter::promote(const FlatFunction &f,
+                         llvm::ArrayRef<Symbol> parameters) {
+    if (f.is_extern() || f.name == Symbol::EMPTY || parameters.empty())
+        return std::nullopt;
+
+    // Ranges are of values, not of variables changing in loops
+    for (NodeIndex n = 0; n < f.size(); ++n) {
+        if (f.kinds[n] == NodeKind::ASSIGN || f.kinds[n] == NodeKind::WHILE)
+            return std::nullopt;
+    }
+
+    auto copy = Symbols.intern(std::string(Symbols.name(f.name)) + ".int");
+    RangeAnalysis analysis(f, parameters, summaries, copy);
+
+    // Parameters that gain nothing as i64s are made f64 one by one, till
+    // all those left are useful
+    std::vector<ValueType> types(parameters.size(), ValueType::I64);
+    Range result;
+    while (true) {
+        analysis.assume(types);
+
+        // Results of recursive calls are none at first, and then all those
+        // of the last iteration, till it has no new ones
+        result = Range();
+        for (int i = 0; i < MAX_ITERATIONS; ++i) {
+            auto next = join(result, analysis.run(result, false));
+            if (next == result)
+                break;
+            result = i + 1 < MAX_ITERATIONS ? next : Range::any();
+        }
+        if (result.kind != Range::WHOLE)
+            result = Range::any();
+        analysis.run(result, true);
+
+        auto useless = types.end();
+        for (size_t p = 0; p < types.size(); ++p) {
+            if (types[p] == ValueType::I64 && !analysis.is_useful(p)) {
+                useless = types.begin() + p;
+                break;
+            }
+        }
+        if (useless == types.end())
+            break;
+        *useless = ValueType::F64;
+    }
+
+    Summary summary;
+    summary.copy = copy;
+    summary.parameter_types = types;
+    if (result.kind == Range::WHOLE)
+        summary.result = std::make_pair(result.min, result.max);
+    for (NodeIndex n = 0; n < f.size(); ++n) {
+        summary.recursive |= analysis.callees[n] == copy;
+        if (f.kinds[n] == NodeKind::UNARY || f.kinds[n] == NodeKind::BINARY) {
+            ++summary.operations;
+            summary.integer_operations +=
+                analysis.type_of(n) == ValueType::I64;
+        }
+    }
+    if (summary.integer_operations == 0 ||
+        std::find(types.begin(), types.end(), ValueType::I64) == types.end())
+        return std::nullopt;
+    if (!is_profitable(summary)) {
+        // Reported, but calls to it don't go to a copy
+        summary.copy = Symbol::EMPTY;
+        symbol_slot(summaries, f.name) = std::move(summary);
+        order.push_back(f.name);
+        return std::nullopt;
+    }
+
+    Promotion promotion{f, {}, std::move(summary)};
+    auto &function = promotion.copy;
+    function.name = copy;
+    function.parameters.assign(parameters.begin(), parameters.end());
+    function.parameter_types = types;
+    function.return_type =
+        result.kind == Range::WHOLE ? ValueType::I64 : ValueType::F64;
+    for (NodeIndex n = 0; n < f.size(); ++n) {
+        if (analysis.callees[n] != Symbol::EMPTY)
+            function.operands[n] = index(analysis.callees[n]);
+        promotion.types.push_back(analysis.type_of(n));
+    }
+    return promotion;
+}
+
+bool IntegerPromoter::is_profitable(const Summary &summary) {
+    if (summary.integer_operations * 2 < summary.operations)
+        return false;
+    if (summary.recursive)
+        return true;
+    auto parameters = std::count(summary.parameter_types.begin(),
+                                 summary.parameter_types.end(), ValueType::I64);
+    return summary.integer_operations >= GUARD_OPERATIONS * parameters;
+}
+
+void IntegerPromoter::promoted(const FlatFunction &f,
+                               const Promotion &promotion) {
+    symbol_slot(summaries, f.name) = promotion.summary;
+    order.push_back(f.name);
+}
+
+void IntegerPromoter::report(std::ostream &out) const {
+    for (auto function : order) {
+        auto &summary = summaries[index(function)];
+        if (summary.copy == Symbol::EMPTY) {
+            out << Symbols.name(function) << ":\n    not promoted, "
+                << summary.integer_operations << " of " << summary.operations
+                << " operations as i64, too few for the guard\n";
+            continue;
+        }
+        auto parameters = declared_parameters(summary.copy);
+        out << Symbols.name(function) << ":\n    " << Symbols.name(summary.copy)
+            << "(";
+        for (size_t i = 0; i < parameters.size(); ++i) {
+            out << (i ? ", " : "") << Symbols.name(parameters[i]) << ": "
+                << type_name(summary.parameter_types[i]);
+        }
+        out << ")";
+        if (summary.result) {
+            out << ": i64 in [" << summary.result->first << ", "
+                << summary.result->second << "]";
+        }
+        out << ", " << summary.integer_operations << " of "
+            << summary.operations << " operations as i64\n";
+    }
+}
+
+void guard_promotion(llvm::Function &func, llvm::Function &integer) {
+    auto &context = func.getContext();
+    auto *i64 = llvm::Type::getInt64Ty(context);
+    auto *entry = &func.getEntryBlock();
+    auto *guard = llvm::BasicBlock::Create(context, "int_guard", &func, entry);
+    auto *call = llvm::BasicBlock::Create(context, "int_call", &func, entry);
+
+    llvm::IRBuilder<> builder(guard);
+    llvm::Value *whole = nullptr;
+    llvm::SmallVector<llvm::Value *, 8> args;
+    for (auto &param : func.args()) {
+        if (!integer.getArg(param.getArgNo())->getType()->isIntegerTy()) {
+            args.push_back(&param);
+            continue;
+        }
+
+        // Converting it to an i64 and back gives the same bits only for a
+        // whole number, not -0 or NaN, and fptosi.sat has no poison
+        auto *value = builder.CreateIntrinsic(
+            llvm::Intrinsic::fptosi_sat, {i64, param.getType()}, {&param},
+            nullptr, param.getName() + ".int");
+        auto *back = builder.CreateSIToFP(value, param.getType());
+        auto *same = builder.CreateICmpEQ(builder.CreateBitCast(back, i64),
+                                          builder.CreateBitCast(&param, i64));
+
+        // -LIMIT <= value <= LIMIT
+        auto limit = IntegerPromoter::PARAMETER_LIMIT;
+        auto *in_range = builder.CreateICmpULE(
+            builder.CreateAdd(value, builder.getInt64(limit)),
+            builder.getInt64(2 * limit));
+
+        auto *fits = builder.CreateAnd(same, in_range);
+        whole = whole ? builder.CreateAnd(whole, fits) : fits;
+        args.push_back(value);
+    }
+    builder.CreateCondBr(whole, call, entry);
+
+    builder.SetInsertPoint(call);
+    llvm::Value *result = builder.CreateCall(&integer, args);
+    if (result->getType() != func.getReturnType())
+        result = builder.CreateSIToFP(result, func.getReturnType());
+    builder.CreateRet(result);
+}
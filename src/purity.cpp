@@ -0,0 +1,122 @@
+#include "purity.hpp"
+
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/Analysis/CallGraph.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/Instructions.h>
+
+namespace {
+// What's known about a function, each true only if proven
+struct Purity {
+    bool no_memory = true;
+    bool no_unwind = true;
+    bool will_return = true;
+    bool no_ub = true; // no instruction can be UB, whatever the arguments
+};
+
+// From the attributes 'f' already has
+Purity known_purity(const llvm::Function &f) {
+    return {f.doesNotAccessMemory(), f.doesNotThrow(), f.willReturn(),
+            f.isSpeculatable()};
+}
+
+// A loop in the control flow, ie. a cycle between basic blocks
+bool has_loop(llvm::Function &f) {
+    for (auto scc = llvm::scc_begin(&f); !scc.isAtEnd(); ++scc) {
+        if (scc.hasCycle())
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Purity of an SCC of the call graph, ie. of each function in it, given all
+ * it calls outside itself are already done (their attributes are set)
+ */
+Purity scc_purity(const std::vector<llvm::CallGraphNode *> &scc,
+                  bool recursive) {
+    Purity purity;
+    purity.will_return = !recursive;
+
+    auto in_scc = [&](const llvm::Function *f) {
+        for (auto *node : scc) {
+            if (node->getFunction() == f)
+                return true;
+        }
+        return false;
+    };
+
+    for (auto *node : scc) {
+        auto *f = node->getFunction();
+        if (!f || f->isDeclaration()) // not in a cycle, but just in case
+            return {false, false, false, false};
+        if (has_loop(*f))
+            purity.will_return = false;
+
+        for (auto &inst : llvm::instructions(*f)) {
+            // Branches and phis are fine, only their targets/values matter.
+            // Anything else, for eg. an integer division by a non-constant,
+            // must be safe to run even where the source wouldn't run it
+            if (!inst.isTerminator() && !llvm::isa<llvm::PHINode>(inst) &&
+                !llvm::isSafeToSpeculativelyExecute(&inst))
+                purity.no_ub = false;
+
+            auto *call = llvm::dyn_cast<llvm::CallBase>(&inst);
+            if (!call) {
+                if (inst.mayReadOrWriteMemory())
+                    purity.no_memory = false;
+                if (inst.mayThrow())
+                    purity.no_unwind = false;
+                continue;
+            }
+
+            auto *callee = call->getCalledFunction();
+            if (!callee) // indirect, could be anything
+                return {false, false, false, false};
+            if (in_scc(callee))
+                continue;
+
+            auto known = known_purity(*callee);
+            purity.no_memory = purity.no_memory && known.no_memory;
+            purity.no_unwind = purity.no_unwind && known.no_unwind;
+            purity.will_return = purity.will_return && known.will_return;
+        }
+    }
+    return purity;
+}
+} // namespace
+
+void infer_function_attributes(llvm::Module &module) {
+    llvm::CallGraph graph(module);
+
+    // Callees come before callers, so they are done by then
+    for (auto scc = llvm::scc_begin(&graph); !scc.isAtEnd(); ++scc) {
+        // The node for calls from/to outside the module has no function
+        auto &nodes = *scc;
+        if (nodes.size() == 1 && (!nodes[0]->getFunction() ||
+                                  nodes[0]->getFunction()->isDeclaration()))
+            continue;
+
+        auto purity = scc_purity(nodes, scc.hasCycle());
+        for (auto *node : nodes) {
+            auto *f = node->getFunction();
+            if (!f || f->isDeclaration())
+                continue;
+
+            // Same as 'memory(none)' on LLVM 16+, and 'readnone' before
+            if (purity.no_memory)
+                f->setDoesNotAccessMemory();
+            if (purity.no_unwind)
+                f->setDoesNotThrow();
+            if (purity.will_return)
+                f->setWillReturn();
+            if (purity.no_memory && purity.no_unwind && purity.will_return &&
+                purity.no_ub)
+                f->setSpeculatable();
+        }
+    }
+}
@@ -0,0 +1,268 @@
+#include "scanner.hpp"
+
+#include <cstdint>
+
+#if defined(__x86_64__) && defined(__SSE2__) &&                               \
+    (defined(__GNUC__) || defined(__clang__))
+#define SCANNER_X86 1
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+/**
+ * Each character class has a scalar 'match', and on x86 the same as SSE2 and
+ * AVX2 versions, which return a vector with the sign bit set in every lane
+ * (byte) that matches. Only the sign bits are used (by movemask), so the other
+ * bits in a lane can be anything.
+ */
+namespace {
+
+#ifdef SCANNER_X86
+// t <= n, treating bytes as unsigned
+inline __m128i le_u(__m128i t, char n) {
+    return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(n)), t);
+}
+inline __m128i eq(__m128i v, char c) {
+    return _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
+}
+inline __m128i sub(__m128i v, char c) {
+    return _mm_sub_epi8(v, _mm_set1_epi8(c));
+}
+
+AVX2_TARGET inline __m256i le_u(__m256i t, char n) {
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(n)), t);
+}
+AVX2_TARGET inline __m256i eq(__m256i v, char c) {
+    return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c));
+}
+AVX2_TARGET inline __m256i sub(__m256i v, char c) {
+    return _mm256_sub_epi8(v, _mm256_set1_epi8(c));
+}
+#endif
+
+struct Whitespace {
+    static bool match(uint8_t c) {
+        return c == ' ' || uint8_t(c - '\t') <= ('\r' - '\t');
+    }
+#ifdef SCANNER_X86
+    static __m128i match(__m128i v) {
+        return _mm_or_si128(eq(v, ' '), le_u(sub(v, '\t'), '\r' - '\t'));
+    }
+    AVX2_TARGET static __m256i match(__m256i v) {
+        return _mm256_or_si256(eq(v, ' '), le_u(sub(v, '\t'), '\r' - '\t'));
+    }
+#endif
+};
+
+struct CommentBody {
+    static bool match(uint8_t c) { return c != '\n' && c != '\r'; }
+#ifdef SCANNER_X86
+    static __m128i match(__m128i v) {
+        auto newline = _mm_or_si128(eq(v, '\n'), eq(v, '\r'));
+        return _mm_xor_si128(newline, _mm_set1_epi8(-1));
+    }
+    AVX2_TARGET static __m256i match(__m256i v) {
+        auto newline = _mm256_or_si256(eq(v, '\n'), eq(v, '\r'));
+        return _mm256_xor_si256(newline, _mm256_set1_epi8(-1));
+    }
+#endif
+};
+
+struct IdentifierBody {
+    static bool match(uint8_t c) {
+        return c >= 0x80 || uint8_t((c | 0x20) - 'a') <= 'z' - 'a' ||
+               uint8_t(c - '0') <= 9 || c == '_';
+    }
+#ifdef SCANNER_X86
+    // 'v' itself has sign bit set for the non-ascii bytes
+    static __m128i match(__m128i v) {
+        auto alpha =
+            le_u(sub(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a'), 'z' - 'a');
+        auto digit = le_u(sub(v, '0'), 9);
+        return _mm_or_si128(_mm_or_si128(v, alpha),
+                            _mm_or_si128(digit, eq(v, '_')));
+    }
+    AVX2_TARGET static __m256i match(__m256i v) {
+        auto alpha = le_u(sub(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a'),
+                          'z' - 'a');
+        auto digit = le_u(sub(v, '0'), 9);
+        return _mm256_or_si256(_mm256_or_si256(v, alpha),
+                               _mm256_or_si256(digit, eq(v, '_')));
+    }
+#endif
+};
+
+struct Digits {
+    static bool match(uint8_t c) { return uint8_t(c - '0') <= 9 || c == '_'; }
+#ifdef SCANNER_X86
+    static __m128i match(__m128i v) {
+        return _mm_or_si128(le_u(sub(v, '0'), 9), eq(v, '_'));
+    }
+    AVX2_TARGET static __m256i match(__m256i v) {
+        return _mm256_or_si256(le_u(sub(v, '0'), 9), eq(v, '_'));
+    }
+#endif
+};
+
+template <class Class>
+const char *scalar_scan(const char *p, const char *end) {
+    while (p < end && Class::match(uint8_t(*p)))
+        ++p;
+    return p;
+}
+
+/**
+ * @returns Length of the well-formed utf-8 sequence at p, or 0 if it's
+ * invalid/truncated
+ */
+int utf8_sequence(const uint8_t *p, const uint8_t *end) {
+    auto cont = [&](int i, uint8_t lo = 0x80, uint8_t hi = 0xBF) {
+        return p + i < end && p[i] >= lo && p[i] <= hi;
+    };
+
+    uint8_t lead = p[0];
+    if (lead < 0x80)
+        return 1;
+    if (lead >= 0xC2 && lead <= 0xDF)
+        return cont(1) ? 2 : 0;
+    if (lead == 0xE0)
+        return cont(1, 0xA0) && cont(2) ? 3 : 0;
+    if (lead == 0xED) // no surrogates
+        return cont(1, 0x80, 0x9F) && cont(2) ? 3 : 0;
+    if (lead >= 0xE1 && lead <= 0xEF)
+        return cont(1) && cont(2) ? 3 : 0;
+    if (lead == 0xF0)
+        return cont(1, 0x90) && cont(2) && cont(3) ? 4 : 0;
+    if (lead >= 0xF1 && lead <= 0xF3)
+        return cont(1) && cont(2) && cont(3) ? 4 : 0;
+    if (lead == 0xF4) // till U+10FFFF
+        return cont(1, 0x80, 0x8F) && cont(2) && cont(3) ? 4 : 0;
+
+    return 0; // continuation byte as lead, overlong 0xC0/0xC1, or > 0xF4
+}
+
+const char *scalar_validate_utf8(const char *begin, const char *end) {
+    auto p = reinterpret_cast<const uint8_t *>(begin);
+    auto e = reinterpret_cast<const uint8_t *>(end);
+
+    while (p < e) {
+        auto len = utf8_sequence(p, e);
+        if (len == 0)
+            break;
+        p += len;
+    }
+
+    return reinterpret_cast<const char *>(p);
+}
+
+#ifdef SCANNER_X86
+template <class Class> const char *sse2_scan(const char *p, const char *end) {
+    for (; end - p >= 16; p += 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        unsigned mismatch = ~_mm_movemask_epi8(Class::match(v)) & 0xFFFF;
+        if (mismatch)
+            return p + __builtin_ctz(mismatch);
+    }
+    return scalar_scan<Class>(p, end);
+}
+
+template <class Class>
+AVX2_TARGET const char *avx2_scan(const char *p, const char *end) {
+    for (; end - p >= 32; p += 32) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        unsigned mismatch = ~unsigned(_mm256_movemask_epi8(Class::match(v)));
+        if (mismatch)
+            return p + __builtin_ctz(mismatch);
+    }
+    return sse2_scan<Class>(p, end);
+}
+
+// Skip blocks of pure ascii, only the blocks having non-ascii bytes are
+// checked byte by byte
+const char *sse2_validate_utf8(const char *p, const char *end) {
+    while (end - p >= 16) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        unsigned non_ascii = _mm_movemask_epi8(v);
+        if (non_ascii == 0) {
+            p += 16;
+            continue;
+        }
+
+        p += __builtin_ctz(non_ascii);
+        auto len = utf8_sequence(reinterpret_cast<const uint8_t *>(p),
+                                 reinterpret_cast<const uint8_t *>(end));
+        if (len == 0)
+            return p;
+        p += len;
+    }
+    return scalar_validate_utf8(p, end);
+}
+
+AVX2_TARGET const char *avx2_validate_utf8(const char *p, const char *end) {
+    while (end - p >= 32) {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        unsigned non_ascii = _mm256_movemask_epi8(v);
+        if (non_ascii == 0) {
+            p += 32;
+            continue;
+        }
+
+        p += __builtin_ctz(non_ascii);
+        auto len = utf8_sequence(reinterpret_cast<const uint8_t *>(p),
+                                 reinterpret_cast<const uint8_t *>(end));
+        if (len == 0)
+            return p;
+        p += len;
+    }
+    return sse2_validate_utf8(p, end);
+}
+#endif
+
+using Kernel = const char *(*)(const char *, const char *);
+
+struct Kernels {
+    Kernel skip_whitespace, skip_comment, scan_identifier, scan_digits,
+        validate_utf8;
+};
+
+Kernels select_kernels() {
+#ifdef SCANNER_X86
+    __builtin_cpu_init(); // required, since this runs before main()
+    if (__builtin_cpu_supports("avx2")) {
+        return {avx2_scan<Whitespace>, avx2_scan<CommentBody>,
+                avx2_scan<IdentifierBody>, avx2_scan<Digits>,
+                avx2_validate_utf8};
+    }
+    return {sse2_scan<Whitespace>, sse2_scan<CommentBody>,
+            sse2_scan<IdentifierBody>, sse2_scan<Digits>,
+            sse2_validate_utf8};
+#else
+    return {scalar_scan<Whitespace>, scalar_scan<CommentBody>,
+            scalar_scan<IdentifierBody>, scalar_scan<Digits>,
+            scalar_validate_utf8};
+#endif
+}
+
+const Kernels Selected = select_kernels();
+
+} // namespace
+
+const char *scanner::skip_whitespace(const char *begin, const char *end) {
+    return Selected.skip_whitespace(begin, end);
+}
+
+const char *scanner::skip_comment(const char *begin, const char *end) {
+    return Selected.skip_comment(begin, end);
+}
+
+const char *scanner::scan_identifier(const char *begin, const char *end) {
+    return Selected.scan_identifier(begin, end);
+}
+
+const char *scanner::scan_digits(const char *begin, const char *end) {
+    return Selected.scan_digits(begin, end);
+}
+
+const char *scanner::validate_utf8(const char *begin, const char *end) {
+    return Selected.validate_utf8(begin, end);
+}
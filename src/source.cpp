@@ -0,0 +1,120 @@
+#include "source.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+SourceBuffer::SourceBuffer(int fd) : fd(fd), eof(false) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return; // not mappable, will be read block by block in refill()
+
+    // Offset of a redirected stdin may not be 0 (eg. partially consumed)
+    auto start = lseek(fd, 0, SEEK_CUR);
+    if (start < 0)
+        start = 0;
+    if (start >= st.st_size)
+        return;
+
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED)
+        return;
+
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+    map_base = addr;
+    map_length = st.st_size;
+    mapped = static_cast<const char *>(addr) + start;
+    length = st.st_size - start;
+    eof = true;
+}
+
+SourceBuffer SourceBuffer::from_file(const std::string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file: " + filename + ": " +
+                                 std::strerror(errno));
+    }
+
+    auto buffer = SourceBuffer(fd);
+    if (buffer.mapped) {
+        close(fd); // mapping stays valid after closing the descriptor
+        buffer.fd = -1;
+    }
+
+    return buffer;
+}
+
+SourceBuffer SourceBuffer::from_fd(int fd) { return SourceBuffer(fd); }
+
+SourceBuffer SourceBuffer::from_string(std::string source) {
+    SourceBuffer buffer;
+    buffer.length = source.size();
+    buffer.owned = std::move(source);
+    return buffer;
+}
+
+SourceBuffer SourceBuffer::from_view(const char *data, size_t length) {
+    SourceBuffer buffer;
+    buffer.mapped = data; // map_base stays null, so it's never unmapped
+    buffer.length = length;
+    return buffer;
+}
+
+SourceBuffer::SourceBuffer(SourceBuffer &&other) noexcept
+    : map_base(std::exchange(other.map_base, nullptr)),
+      map_length(std::exchange(other.map_length, 0)),
+      mapped(std::exchange(other.mapped, nullptr)),
+      owned(std::move(other.owned)), length(std::exchange(other.length, 0)),
+      fd(std::exchange(other.fd, -1)), eof(std::exchange(other.eof, true)) {}
+
+SourceBuffer &SourceBuffer::operator=(SourceBuffer &&other) noexcept {
+    std::swap(map_base, other.map_base);
+    std::swap(map_length, other.map_length);
+    std::swap(mapped, other.mapped);
+    std::swap(owned, other.owned);
+    std::swap(length, other.length);
+    std::swap(fd, other.fd);
+    std::swap(eof, other.eof);
+    return *this;
+}
+
+SourceBuffer::~SourceBuffer() {
+    if (map_base)
+        munmap(map_base, map_length);
+    if (fd > STDERR_FILENO)
+        close(fd);
+}
+
+bool SourceBuffer::refill() {
+    if (eof)
+        return false;
+
+    // Same as std::cin being tied to std::cout, flush pending output (eg. the
+    // interactive prompt) before blocking on read
+    std::cout.flush();
+
+    owned.resize(length + BLOCK_SIZE);
+
+    ssize_t n;
+    do {
+        n = read(fd, owned.data() + length, BLOCK_SIZE);
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) {
+        eof = true;
+        owned.resize(length);
+        return false;
+    }
+
+    length += n;
+    owned.resize(length);
+    return true;
+}
@@ -0,0 +1,217 @@
+#include "specialise.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+namespace {
+uint64_t bits_of(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+double double_of(uint64_t bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * A number without type suffix, as a constant argument, since only functions
+ * without types (ie. all f64, see is_untyped()) are copied, and a typed
+ * number (for eg. 0.1f32) can have a different value as an f64
+ */
+bool is_literal(const FlatFunction &f, NodeIndex n) {
+    return f.kinds[n] == NodeKind::NUMBER &&
+           f.number_type(n) == ValueType::ANY;
+}
+
+/**
+ * Replace each 'if' having a number as condition by the branch it takes.
+ * Only done in copies, since the original already compiled fine, while
+ * dropping a branch of any function would drop errors in it (see
+ * optimise.hpp)
+ *
+ * @returns true if any 'if' was replaced
+ */
+bool prune_branches(FlatFunction &f) {
+    auto taken = [&](NodeIndex n) {
+        while (f.kinds[n] == NodeKind::IF) {
+            auto parts = f.children_of(n);
+            if (f.kinds[parts[0]] != NodeKind::NUMBER)
+                break;
+
+            // 'fcmp one', ie. ordered and not equal to 0
+            auto condition = f.number(parts[0]);
+            n = !std::isnan(condition) && condition != 0 ? parts[1] : parts[2];
+        }
+        return n;
+    };
+
+    // Body is a block, so never an 'if' itself
+    bool changed = false;
+    for (auto &child : f.children) {
+        auto branch = taken(child);
+        changed = changed || branch != child;
+        child = branch;
+    }
+    return changed;
+}
+} // namespace
+
+void Specialiser::define(const FlatFunction &f,
+                         llvm::ArrayRef<Symbol> parameters) {
+    auto &definition = symbol_slot(definitions, f.name);
+    definition = f;
+    definition.parameters.assign(parameters.begin(), parameters.end());
+    definition.parameter_types.assign(parameters.size(), ValueType::ANY);
+}
+
+std::optional<Symbol>
+Specialiser::specialise(const FlatFunction &f, NodeIndex n,
+                        std::vector<FlatFunction> &copies,
+                        CallFolder fold_call) {
+    auto callee = f.symbol(n);
+    auto args = f.children_of(n);
+    if (index(callee) >= definitions.size())
+        return std::nullopt;
+
+    const auto &definition = definitions[index(callee)];
+    if (definition.is_extern() || definition.parameters.size() != args.size())
+        return std::nullopt;
+
+    Pattern pattern;
+    for (size_t i = 0; i < args.size(); ++i) {
+        // A parameter assigned to isn't always its argument
+        if (!is_literal(f, args[i]))
+            pattern.push_back(std::nullopt);
+        else if (definition.assigns(definition.parameters[i]))
+            return std::nullopt;
+        else
+            pattern.push_back(bits_of(f.number(args[i])));
+    }
+    if (std::none_of(pattern.begin(), pattern.end(),
+                     [](const auto &arg) { return arg.has_value(); }))
+        return std::nullopt;
+
+    auto key = std::make_pair(callee, pattern);
+    if (auto it = copy_of.find(key); it != copy_of.end())
+        return it->second;
+
+    auto &function_copies = copies_by_function[callee];
+    if (definition.size() > budget || function_copies.size() == MAX_COPIES)
+        return std::nullopt;
+
+    auto name = Symbols.intern(std::string(Symbols.name(callee)) + "." +
+                               std::to_string(function_copies.size()));
+
+    FlatFunction copy = definition;
+    copy.name = name;
+    copy.parameters.clear();
+    copy.parameter_types.clear();
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (!pattern[i]) {
+            copy.parameters.push_back(definition.parameters[i]);
+            copy.parameter_types.push_back(definition.parameter_types[i]);
+        }
+    }
+
+    // A variable is the first parameter of its name, same as in codegen
+    for (NodeIndex v = 0; v < copy.size(); ++v) {
+        if (copy.kinds[v] != NodeKind::VARIABLE)
+            continue;
+
+        auto &parameters = definition.parameters;
+        auto it = std::find(parameters.begin(), parameters.end(),
+                            copy.symbol(v));
+        if (it == parameters.end() || !pattern[it - parameters.begin()])
+            continue;
+
+        copy.kinds[v] = NodeKind::NUMBER;
+        copy.operands[v] = copy.numbers.size();
+        copy.numbers.push_back(double_of(*pattern[it - parameters.begin()]));
+        copy.number_types.push_back(ValueType::ANY);
+        copy.number_fractions.push_back(false);
+    }
+
+    // Before optimising, so a recursive call with same constants is to the
+    // copy itself
+    copy_of.emplace(key, name);
+    optimise(copy, fold_call);
+    if (prune_branches(copy))
+        optimise(copy, fold_call);
+
+    budget -= std::min(budget, copy.size());
+    function_copies.push_back(
+        {name, std::move(pattern), definition.size(), copy.size()});
+    copies.push_back(std::move(copy));
+    return name;
+}
+
+bool Specialiser::rewrite_calls(FlatFunction &f,
+                                std::vector<FlatFunction> &copies,
+                                CallFolder fold_call) {
+    bool changed = false;
+    for (NodeIndex n = 0; n < f.size(); ++n) {
+        if (f.kinds[n] != NodeKind::CALL)
+            continue;
+
+        auto copy = specialise(f, n, copies, fold_call);
+        if (!copy)
+            continue;
+
+        // Only the arguments that aren't constants are passed now, they are
+        // moved to the front of the node's children
+        auto first = f.children.begin() + f.first_child[n];
+        auto last = std::remove_if(first, first + f.child_count[n],
+                                   [&](NodeIndex arg) {
+                                       return is_literal(f, arg);
+                                   });
+        f.child_count[n] = last - first;
+        f.operands[n] = index(*copy);
+        changed = true;
+    }
+    return changed;
+}
+
+void Specialiser::specialise_calls(FlatFunction &f,
+                                   std::vector<FlatFunction> &copies,
+                                   CallFolder fold_call) {
+    if (f.is_extern())
+        return;
+
+    auto first_new = copies.size();
+    if (rewrite_calls(f, copies, fold_call))
+        remove_unused(f);
+
+    // Calls in the new copies, which may add more copies
+    for (auto i = first_new; i < copies.size(); ++i) {
+        auto copy = std::move(copies[i]);
+        if (rewrite_calls(copy, copies, fold_call))
+            remove_unused(copy);
+        copies[i] = std::move(copy);
+    }
+}
+
+void Specialiser::report(std::ostream &out) const {
+    for (auto &[function, function_copies] : copies_by_function) {
+        if (function_copies.empty())
+            continue;
+
+        auto &parameters = definitions[index(function)].parameters;
+        out << Symbols.name(function) << ":\n";
+        for (auto &copy : function_copies) {
+            out << "    " << Symbols.name(copy.name) << " for (";
+            for (size_t i = 0; i < copy.pattern.size(); ++i) {
+                out << (i ? ", " : "") << Symbols.name(parameters[i]);
+                if (copy.pattern[i])
+                    out << " = " << double_of(*copy.pattern[i]);
+            }
+            out << "), " << copy.size << " nodes (from "
+                << copy.original_size << ")\n";
+        }
+    }
+}
@@ -0,0 +1,49 @@
+#include "symbols.hpp"
+
+#include <functional>
+#include <stdexcept>
+
+SymbolTable Symbols;
+
+SymbolTable::SymbolTable() { intern(""); }
+
+SymbolTable::~SymbolTable() {
+    for (auto &block : names)
+        delete[] block.load();
+}
+
+void SymbolTable::set_name(Symbol s, std::string_view name) {
+    auto &block = names[index(s) >> BLOCK_BITS];
+
+    auto *slots = block.load(std::memory_order_acquire);
+    if (!slots) {
+        // Some other thread may be allocating the same block, only one wins
+        auto *fresh = new std::string_view[BLOCK_SIZE];
+        if (block.compare_exchange_strong(slots, fresh)) {
+            slots = fresh;
+        } else {
+            delete[] fresh;
+        }
+    }
+
+    slots[index(s) & (BLOCK_SIZE - 1)] = name;
+}
+
+Symbol SymbolTable::intern(std::string_view name) {
+    auto &shard = shards[std::hash<std::string_view>{}(name) % NUM_SHARDS];
+
+    std::lock_guard lock(shard.mutex);
+    if (auto it = shard.ids.find(name); it != shard.ids.end())
+        return it->second;
+
+    auto id = next_id.fetch_add(1, std::memory_order_acq_rel);
+    if (id == UINT32_MAX)
+        throw std::runtime_error("Too many distinct identifiers");
+
+    auto &stored = shard.storage.emplace_back(name);
+    auto s = static_cast<Symbol>(id);
+    set_name(s, stored);
+    shard.ids.emplace(stored, s);
+
+    return s;
+}
@@ -0,0 +1,367 @@
+#include "tail_calls.hpp"
+
+#include <ostream>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Transforms/Utils/Local.h>
+
+namespace {
+// 'ret' each phi's value reaches (see returned_by()), or nullptr, as the
+// phis of nested 'if's are on the way for every branch
+using Returns = llvm::DenseMap<llvm::PHINode *, llvm::ReturnInst *>;
+
+/**
+ * The 'ret' which 'value' (computed in 'block') reaches as it is, going only
+ * through blocks that merge values (with phis) and then branch (without a
+ * condition) or return, the way each 'if' is codegen-ed. Codegen doesn't
+ * make a cycle of such blocks, which would be an infinite loop
+ *
+ * @returns nullptr if the value is used anywhere else on the way
+ */
+llvm::ReturnInst *returned_by(llvm::Value *value, llvm::BasicBlock *block,
+                              Returns &known) {
+    llvm::SmallVector<llvm::PHINode *, 8> phis; // on the way
+    llvm::ReturnInst *ret = nullptr;
+    while (value->hasOneUse()) {
+        auto *terminator = block->getTerminator();
+        if (auto *returned = llvm::dyn_cast<llvm::ReturnInst>(terminator)) {
+            if (returned->getReturnValue() == value)
+                ret = returned;
+            break;
+        }
+
+        auto *branch = llvm::dyn_cast<llvm::BranchInst>(terminator);
+        if (!branch || branch->isConditional())
+            break;
+
+        auto *next = branch->getSuccessor(0);
+        if (next == block || next->getFirstNonPHI() != next->getTerminator())
+            break;
+        block = next;
+
+        // Or it's used further on, if the phi had only it, and was folded
+        auto *phi = llvm::dyn_cast<llvm::PHINode>(*value->user_begin());
+        if (!phi || phi->getParent() != next)
+            continue;
+        if (auto it = known.find(phi); it != known.end()) {
+            ret = it->second;
+            break;
+        }
+        phis.push_back(phi);
+        value = phi;
+    }
+
+    for (auto *phi : phis)
+        known[phi] = ret;
+    return ret;
+}
+
+/**
+ * Instructions after 'call' in its block, except 'around' (using its value),
+ * could as well be before it: they don't use its value, nor call anything,
+ * nor have any other effect
+ */
+bool only_pure_after(llvm::CallInst *call, llvm::Instruction *around) {
+    for (auto *inst = call->getNextNode(); !inst->isTerminator();
+         inst = inst->getNextNode()) {
+        if (inst == around)
+            continue;
+        if (llvm::isa<llvm::CallBase>(inst) || inst->mayHaveSideEffects() ||
+            llvm::is_contained(inst->operands(), call))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Make 'block' return 'value' (which it computes) itself, instead of passing
+ * it on to phis returning it (see returned_by())
+ */
+void return_directly(llvm::BasicBlock *block, llvm::Value *value) {
+    auto *terminator = block->getTerminator();
+    for (auto *successor : llvm::successors(block))
+        successor->removePredecessor(block);
+    llvm::ReturnInst::Create(block->getContext(), value, terminator);
+    terminator->eraseFromParent();
+}
+
+// Operator of 'opcode' as written in saras, + or *
+char operator_of(unsigned opcode) {
+    switch (opcode) {
+    case llvm::Instruction::Add:
+    case llvm::Instruction::FAdd:
+        return '+';
+    default:
+        return '*';
+    }
+}
+
+// A call of a function to itself, to be a jump back to its start
+struct RecursiveCall {
+    llvm::CallInst *call;
+    llvm::BinaryOperator *around = nullptr; // + or * with its value
+};
+
+// Operand of 'around' other than 'call'
+llvm::Value *other_operand(const RecursiveCall &call) {
+    auto *first = call.around->getOperand(0);
+    return first == call.call ? call.around->getOperand(1) : first;
+}
+} // namespace
+
+bool TailCalls::eliminate_recursion(llvm::Function &func) {
+    llvm::SmallVector<RecursiveCall, 4> calls;
+    unsigned accumulator = 0;
+    size_t kept = 0;
+    Returns known;
+    for (auto &inst : llvm::instructions(func)) {
+        auto *call = llvm::dyn_cast<llvm::CallInst>(&inst);
+        if (!call || call->getCalledFunction() != &func)
+            continue;
+
+        auto *block = call->getParent();
+        if (returned_by(call, block, known)) {
+            if (only_pure_after(call, nullptr))
+                calls.push_back({call});
+            continue;
+        }
+
+        if (!call->hasOneUse())
+            continue;
+        auto *around =
+            llvm::dyn_cast<llvm::BinaryOperator>(*call->user_begin());
+        if (!around || around->getParent() != block ||
+            !returned_by(around, block, known) ||
+            !only_pure_after(call, around))
+            continue;
+
+        auto opcode = around->getOpcode();
+        switch (opcode) {
+        case llvm::Instruction::Add:
+        case llvm::Instruction::Mul:
+            break;
+        case llvm::Instruction::FAdd:
+        case llvm::Instruction::FMul:
+            // Rounding would differ, (a*b)*c isn't always a*(b*c)
+            if (around->hasAllowReassoc())
+                break;
+            ++kept;
+            continue;
+        default:
+            continue;
+        }
+
+        // Only one accumulator, the first operator found
+        if (other_operand({call, around}) == call ||
+            (accumulator && opcode != accumulator))
+            continue;
+        accumulator = opcode;
+        calls.push_back({call, around});
+    }
+
+    if (calls.empty() && !kept)
+        return false;
+    auto &summary = summaries[func.getName().str()];
+    summary.kept += kept;
+    if (calls.empty())
+        return false;
+    summary.loops += calls.size();
+    summary.accumulator = accumulator;
+
+    // Parameters (and the accumulator) are phis at the start, which the
+    // calls jump back to, with their arguments
+    auto &context = func.getContext();
+    auto *header = &func.getEntryBlock();
+    header->setName("tailrecurse");
+    auto *entry = llvm::BasicBlock::Create(context, "entry", &func, header);
+    auto *enter = llvm::BranchInst::Create(header, entry);
+
+    // Allocas stay in the entry block, though all are promoted by now
+    while (auto *alloca = llvm::dyn_cast<llvm::AllocaInst>(&header->front()))
+        alloca->moveBefore(enter);
+
+    llvm::IRBuilder<> builder(header, header->begin());
+    llvm::SmallVector<llvm::PHINode *, 8> parameters;
+    for (auto &param : func.args()) {
+        auto *phi = builder.CreatePHI(param.getType(), calls.size() + 1,
+                                      param.getName() + ".tr");
+        param.replaceAllUsesWith(phi);
+        phi->addIncoming(&param, entry);
+        parameters.push_back(phi);
+    }
+
+    // It's computed as 'accumulator op (value returned)', for eg. in
+    // 'n*virhanka(n-1)', the accumulator is multiplied by 'n' at each step
+    auto opcode = llvm::Instruction::BinaryOps(accumulator);
+    llvm::PHINode *total = nullptr;
+    llvm::FastMathFlags fast_math; // of the operators, if on doubles
+    if (accumulator) {
+        total = builder.CreatePHI(func.getReturnType(), calls.size() + 1,
+                                  "accumulator.tr");
+        total->addIncoming(llvm::ConstantExpr::getBinOpIdentity(
+                               accumulator, func.getReturnType()),
+                           entry);
+    }
+
+    for (auto &recursive : calls) {
+        auto [call, around] = recursive;
+        auto *block = call->getParent();
+        auto *terminator = block->getTerminator();
+        for (size_t i = 0; i < parameters.size(); ++i)
+            parameters[i]->addIncoming(call->getArgOperand(i), block);
+        if (total) {
+            llvm::Value *next = total;
+            if (around) {
+                auto *step = llvm::BinaryOperator::Create(
+                    opcode, total, other_operand(recursive), "accumulate.tr",
+                    terminator);
+                if (llvm::isa<llvm::FPMathOperator>(around)) {
+                    fast_math = around->getFastMathFlags();
+                    step->setFastMathFlags(fast_math);
+                }
+                next = step;
+            }
+            total->addIncoming(next, block);
+        }
+
+        for (auto *successor : llvm::successors(block))
+            successor->removePredecessor(block);
+        llvm::BranchInst::Create(header, terminator);
+        terminator->eraseFromParent();
+    }
+
+    // Phis merging the values may have been folded into those of another
+    // call, in blocks now unreachable, so these go first
+    llvm::removeUnreachableBlocks(func);
+    for (auto [call, around] : calls) {
+        if (around)
+            around->eraseFromParent();
+        call->eraseFromParent();
+    }
+
+    // What only the calls used is dead now
+    llvm::SmallVector<llvm::WeakTrackingVH, 16> dead;
+    for (auto &inst : llvm::instructions(func)) {
+        if (llvm::isInstructionTriviallyDead(&inst))
+            dead.push_back(&inst);
+    }
+    llvm::RecursivelyDeleteTriviallyDeadInstructions(dead);
+
+    // Values returned by other paths
+    if (total) {
+        for (auto &block : func) {
+            auto *ret = llvm::dyn_cast<llvm::ReturnInst>(block.getTerminator());
+            if (!ret)
+                continue;
+            auto *result = llvm::BinaryOperator::Create(
+                opcode, total, ret->getReturnValue(), "accumulated.tr", ret);
+            if (llvm::isa<llvm::FPMathOperator>(result))
+                result->setFastMathFlags(fast_math);
+            ret->setOperand(0, result);
+        }
+    }
+    return true;
+}
+
+void TailCalls::mark_tail_calls(llvm::Module &module) {
+    // First, as a musttail call needs same calling convention as its caller
+    for (auto &func : module) {
+        if (func.isDeclaration() || !func.hasLocalLinkage() ||
+            func.getCallingConv() == llvm::CallingConv::Fast)
+            continue;
+
+        auto called = [&](const llvm::Use &use) {
+            auto *call = llvm::dyn_cast<llvm::CallBase>(use.getUser());
+            return call && call->isCallee(&use);
+        };
+        if (!llvm::all_of(func.uses(), called))
+            continue;
+
+        func.setCallingConv(llvm::CallingConv::Fast);
+        for (auto *user : func.users())
+            llvm::cast<llvm::CallBase>(user)->setCallingConv(
+                llvm::CallingConv::Fast);
+        summaries[func.getName().str()].fastcc = true;
+    }
+
+    for (auto &func : module) {
+        // All are found before changing any, which can fold phis
+        llvm::SmallVector<llvm::CallInst *, 8> calls;
+        Returns known;
+        for (auto &inst : llvm::instructions(func)) {
+            auto *call = llvm::dyn_cast<llvm::CallInst>(&inst);
+            auto *callee = call ? call->getCalledFunction() : nullptr;
+            if (callee && !callee->isIntrinsic() && !call->isMustTailCall() &&
+                returned_by(call, call->getParent(), known) &&
+                only_pure_after(call, nullptr))
+                calls.push_back(call);
+        }
+
+        size_t must_tail = 0, tail = 0;
+        for (auto *call : calls) {
+            auto *callee = call->getCalledFunction();
+            auto *block = call->getParent();
+
+            // Nothing can be between the call and its 'ret'
+            while (!call->getNextNode()->isTerminator())
+                call->getNextNode()->moveBefore(call);
+            if (!llvm::isa<llvm::ReturnInst>(block->getTerminator()))
+                return_directly(block, call);
+
+            if (callee->getFunctionType() == func.getFunctionType() &&
+                callee->getCallingConv() == func.getCallingConv()) {
+                call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+                ++must_tail;
+            } else {
+                call->setTailCallKind(llvm::CallInst::TCK_Tail);
+                ++tail;
+            }
+        }
+
+        if (must_tail || tail) {
+            llvm::removeUnreachableBlocks(func);
+            auto &summary = summaries[func.getName().str()];
+            summary.must_tail += must_tail;
+            summary.tail += tail;
+        }
+    }
+}
+
+void TailCalls::report(std::ostream &out) const {
+    auto calls = [](size_t n) { return n == 1 ? " call" : " calls"; };
+    for (auto &[name, summary] : summaries) {
+        out << name << ":\n";
+        if (summary.loops) {
+            out << "    loop, from " << summary.loops << calls(summary.loops)
+                << " to itself";
+            if (summary.accumulator) {
+                out << ", accumulating with "
+                    << operator_of(summary.accumulator);
+            }
+            out << "\n";
+        }
+        if (summary.kept) {
+            out << "    " << summary.kept << calls(summary.kept)
+                << " to itself kept, as + and * on f64s round differently "
+                   "if reordered (unless [fast])\n";
+        }
+        if (summary.must_tail) {
+            out << "    " << summary.must_tail << " musttail"
+                << calls(summary.must_tail) << "\n";
+        }
+        if (summary.tail) {
+            out << "    " << summary.tail << " tail" << calls(summary.tail)
+                << ", not guaranteed, the callee's types being different\n";
+        }
+        if (summary.fastcc)
+            out << "    fastcc\n";
+    }
+}
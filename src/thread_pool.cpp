@@ -0,0 +1,82 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <utility>
+
+ThreadPool::ThreadPool(unsigned threads) {
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned i = 1; i < threads; ++i)
+        workers.emplace_back([this] { worker_loop(); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+
+    for (auto &worker : workers)
+        worker.join();
+}
+
+void ThreadPool::run_iterations() {
+    for (auto i = next++; i < n; i = next++) {
+        try {
+            (*body)(i);
+        } catch (...) {
+            std::lock_guard lock(mutex);
+            if (!error)
+                error = std::current_exception();
+            next = n; // skip remaining iterations
+        }
+    }
+}
+
+void ThreadPool::worker_loop() {
+    size_t seen_generation = 0;
+
+    while (true) {
+        {
+            std::unique_lock lock(mutex);
+            work_ready.wait(lock, [&] {
+                return stopping || generation != seen_generation;
+            });
+            if (stopping)
+                return;
+            seen_generation = generation;
+        }
+
+        run_iterations();
+
+        {
+            std::lock_guard lock(mutex);
+            --busy;
+        }
+        work_done.notify_one();
+    }
+}
+
+void ThreadPool::parallel_for(size_t n, const std::function<void(size_t)> &fn) {
+    {
+        std::lock_guard lock(mutex);
+        this->body = &fn;
+        this->n = n;
+        this->next = 0;
+        this->busy = workers.size();
+        this->error = nullptr;
+        ++generation;
+    }
+    work_ready.notify_all();
+
+    run_iterations();
+
+    std::unique_lock lock(mutex);
+    work_done.wait(lock, [&] { return busy == 0; });
+
+    body = nullptr;
+    if (error)
+        std::rethrow_exception(std::exchange(error, nullptr));
+}
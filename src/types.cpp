@@ -0,0 +1,325 @@
+#include "types.hpp"
+#include "ast.hpp"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+#include <llvm/IR/DerivedTypes.h>
+
+std::optional<ValueType> type_named(std::string_view name) {
+    if (name == "i64")
+        return ValueType::I64;
+    if (name == "f32")
+        return ValueType::F32;
+    if (name == "f64")
+        return ValueType::F64;
+    return std::nullopt;
+}
+
+const char *type_name(ValueType type) {
+    switch (type) {
+    case ValueType::I64:
+        return "i64";
+    case ValueType::F32:
+        return "f32";
+    default:
+        return "f64";
+    }
+}
+
+// Same order as the enum, ie. ANY < I64 < F32 < F64
+ValueType join(ValueType a, ValueType b) { return std::max(a, b); }
+
+llvm::Type *llvm_type(ValueType type, llvm::LLVMContext &context) {
+    switch (type) {
+    case ValueType::I64:
+        return llvm::Type::getInt64Ty(context);
+    case ValueType::F32:
+        return llvm::Type::getFloatTy(context);
+    default:
+        return llvm::Type::getDoubleTy(context);
+    }
+}
+
+ValueType value_type(const llvm::Type *type) {
+    if (type->isIntegerTy(64))
+        return ValueType::I64;
+    if (type->isFloatTy())
+        return ValueType::F32;
+    return ValueType::F64;
+}
+
+namespace {
+// Type of a value without annotation, ie. f64 for ValueType::ANY
+ValueType concrete(ValueType type) {
+    return type == ValueType::ANY ? ValueType::F64 : type;
+}
+
+// A value of type 'from' can be used as 'to' without an explicit conversion
+bool widens_to(ValueType from, ValueType to) {
+    return from == ValueType::ANY || join(from, to) == to;
+}
+
+// Type a call converts to, if it's a conversion, for eg. i64(x)
+std::optional<ValueType> conversion(const FlatFunction &f, NodeIndex n) {
+    return type_named(Symbols.name(f.symbol(n)));
+}
+
+/**
+ * Type of each node, from its children's, in post-order. ValueType::ANY for
+ * the literals without suffix, and the nodes having only such values
+ */
+class TypeChecker : public FlatVisitor<TypeChecker, ValueType> {
+    const llvm::Function &func;
+    llvm::ArrayRef<Symbol> parameter_names;
+    FunctionLookup lookup;
+
+    // Type of each local variable, ie. of the first value assigned to it
+    std::vector<std::pair<Symbol, ValueType>> locals;
+
+    // First parameter of the name, same as codegen
+    std::optional<ValueType> parameter_type(Symbol name) const {
+        auto it =
+            std::find(parameter_names.begin(), parameter_names.end(), name);
+        if (it == parameter_names.end() ||
+            size_t(it - parameter_names.begin()) >= func.arg_size())
+            return std::nullopt;
+        return value_type(func.getArg(it - parameter_names.begin())->getType());
+    }
+
+    ValueType *local_type(Symbol name) {
+        for (auto &[local, type] : locals) {
+            if (local == name)
+                return &type;
+        }
+        return nullptr;
+    }
+
+  public:
+    std::vector<ValueType> types;
+    bool failed = false;
+
+    TypeChecker(const llvm::Function &func,
+                llvm::ArrayRef<Symbol> parameter_names, FunctionLookup lookup)
+        : func(func), parameter_names(parameter_names), lookup(lookup) {}
+
+    ValueType visit_number(const FlatFunction &f, NodeIndex n) {
+        return f.number_type(n);
+    }
+
+    ValueType visit_variable(const FlatFunction &f, NodeIndex n) {
+        if (auto type = parameter_type(f.symbol(n)))
+            return *type;
+        auto *type = local_type(f.symbol(n));
+        return type ? *type : ValueType::F64;
+    }
+
+    ValueType visit_unary(const FlatFunction &f, NodeIndex n) {
+        return types[f.children_of(n)[0]];
+    }
+
+    ValueType visit_binary(const FlatFunction &f, NodeIndex n) {
+        auto operands = f.children_of(n);
+        return join(types[operands[0]], types[operands[1]]);
+    }
+
+    ValueType visit_if(const FlatFunction &f, NodeIndex n) {
+        auto parts = f.children_of(n);
+        return join(types[parts[1]], types[parts[2]]);
+    }
+
+    ValueType visit_block(const FlatFunction &f, NodeIndex n) {
+        return types[f.children_of(n).back()];
+    }
+
+    ValueType visit_call(const FlatFunction &f, NodeIndex n) {
+        auto name = std::string(Symbols.name(f.symbol(n)));
+        auto args = f.children_of(n);
+
+        if (auto type = conversion(f, n)) {
+            if (args.size() != 1)
+                error(name + "() converts one value, but is passed " +
+                      std::to_string(args.size()));
+            return *type;
+        }
+
+        auto *callee = lookup(f.symbol(n));
+        if (!callee || callee->arg_size() != args.size())
+            return ValueType::F64;
+
+        for (size_t i = 0; i < args.size(); ++i) {
+            auto type = value_type(callee->getArg(i)->getType());
+            if (!widens_to(types[args[i]], type)) {
+                error("Argument " + std::to_string(i + 1) + " of " + name +
+                      "() is " + type_name(types[args[i]]) +
+                      ", but its parameter is " + type_name(type) +
+                      "\n\t\tConvert it explicitly, for eg. " +
+                      type_name(type) + "(x)");
+            }
+        }
+        return value_type(callee->getReturnType());
+    }
+
+    // Value is converted to the variable's type, which is of the first value
+    // for a local
+    ValueType visit_assign(const FlatFunction &f, NodeIndex n) {
+        auto value = types[f.children_of(n)[0]];
+        auto type = parameter_type(f.symbol(n));
+        if (!type) {
+            if (auto *local = local_type(f.symbol(n)))
+                type = *local;
+        }
+        if (!type) {
+            locals.emplace_back(f.symbol(n), concrete(value));
+            return concrete(value);
+        }
+
+        if (!widens_to(value, *type)) {
+            error(std::string("Value assigned to ") +
+                  std::string(Symbols.name(f.symbol(n))) + " is " +
+                  type_name(value) + ", but it's " + type_name(*type) +
+                  "\n\t\tConvert it explicitly, for eg. " +
+                  type_name(*type) + "(x)");
+        }
+        return *type;
+    }
+
+    // 0, like a literal
+    ValueType visit_while(const FlatFunction &, NodeIndex) {
+        return ValueType::ANY;
+    }
+
+    void error(const std::string &message) {
+        LogError(message);
+        failed = true;
+    }
+};
+} // namespace
+
+std::optional<std::vector<ValueType>>
+infer_types(const FlatFunction &f, const llvm::Function &func,
+            llvm::ArrayRef<Symbol> parameter_names, FunctionLookup lookup) {
+    TypeChecker checker(func, parameter_names, lookup);
+    if (auto n = read_before_assignment(f); n != NO_NODE) {
+        checker.error(std::string(Symbols.name(f.symbol(n))) +
+                      " is used before it's assigned a value\n\t\tA local "
+                      "variable's type is of the first value assigned to it");
+    }
+
+    auto &types = checker.types;
+    types.resize(f.size());
+    for (NodeIndex n = 0; n < f.size(); ++n)
+        types[n] = checker.visit(f, n);
+
+    // A literal written like 2.0, or an operator on literals with one
+    std::vector<bool> fraction(f.size());
+    for (NodeIndex n = 0; n < f.size(); ++n) {
+        auto kind = f.kinds[n];
+        if (kind == NodeKind::NUMBER) {
+            fraction[n] = f.number_fraction(n);
+        } else if (types[n] == ValueType::ANY &&
+                   (kind == NodeKind::UNARY || kind == NodeKind::BINARY)) {
+            fraction[n] = llvm::any_of(
+                f.children_of(n), [&](auto child) { return fraction[child]; });
+        }
+    }
+
+    auto return_type = value_type(func.getReturnType());
+    if (!widens_to(types[f.body], return_type)) {
+        checker.error(
+            std::string("Value of ") +
+            (f.name == Symbol::EMPTY
+                 ? std::string("the expression")
+                 : std::string(Symbols.name(f.name)) + "()") +
+            " is " + type_name(types[f.body]) + ", but it returns " +
+            type_name(return_type) + "\n\t\tConvert it explicitly, for eg. " +
+            type_name(return_type) + "(x)");
+    }
+    if (checker.failed)
+        return std::nullopt;
+
+    // Type the parents want each node in, the narrowest if more than one
+    // (a shared node, see optimise()), parents come after their children,
+    // so going backwards, all of them are done before the node
+    std::vector<ValueType> wanted(f.size(), ValueType::ANY);
+    auto want = [&](NodeIndex n, ValueType type) {
+        if (wanted[n] == ValueType::ANY || join(type, wanted[n]) == wanted[n])
+            wanted[n] = type;
+    };
+    want(f.body, return_type);
+
+    for (auto n = f.size(); n-- > 0;) {
+        auto children = f.children_of(n);
+
+        // Literals and operators on them are computed as f64, and converted
+        // by their parent, an 'if' or a block of those takes the type wanted
+        if (types[n] == ValueType::ANY) {
+            auto kind = f.kinds[n];
+
+            // Else 'n / 2.0' with 'n: i64' would quietly be an integer
+            // division
+            if (fraction[n] && concrete(wanted[n]) == ValueType::I64) {
+                checker.error("A number written with a fraction or exponent, "
+                              "like 2.0, can't be an i64\n\t\tWrite it as a "
+                              "whole number, or convert explicitly, for eg. "
+                              "f64(x)");
+            }
+            types[n] = kind == NodeKind::IF || kind == NodeKind::BLOCK
+                           ? concrete(wanted[n])
+                           : ValueType::F64;
+        }
+
+        switch (f.kinds[n]) {
+        case NodeKind::UNARY:
+        case NodeKind::BINARY:
+            for (auto child : children)
+                want(child, types[n]);
+            break;
+        case NodeKind::IF:
+            want(children[1], types[n]);
+            want(children[2], types[n]);
+            break;
+        case NodeKind::BLOCK:
+            want(children.back(), types[n]);
+            break;
+        case NodeKind::ASSIGN:
+            want(children[0], types[n]);
+            break;
+        case NodeKind::CALL:
+            if (auto *callee = lookup(f.symbol(n));
+                callee && !conversion(f, n) &&
+                callee->arg_size() == children.size()) {
+                for (size_t i = 0; i < children.size(); ++i)
+                    want(children[i],
+                         value_type(callee->getArg(i)->getType()));
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    if (checker.failed)
+        return std::nullopt;
+    return std::move(types);
+}
+
+bool is_untyped(const FlatFunction &f, FunctionLookup lookup) {
+    auto is_any = [](ValueType type) { return type == ValueType::ANY; };
+    if (f.return_type != ValueType::ANY ||
+        !std::all_of(f.parameter_types.begin(), f.parameter_types.end(),
+                     is_any) ||
+        !std::all_of(f.number_types.begin(), f.number_types.end(), is_any))
+        return false;
+
+    for (NodeIndex n = 0; n < f.size(); ++n) {
+        if (f.kinds[n] != NodeKind::CALL)
+            continue;
+        if (conversion(f, n))
+            return false;
+        if (auto *callee = lookup(f.symbol(n));
+            callee && !callee->getReturnType()->isDoubleTy())
+            return false;
+    }
+    return true;
+}